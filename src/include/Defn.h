@@ -446,6 +446,16 @@ typedef struct {
 #define UNSET_NO_SPECIAL_SYMBOLS(b) ((b)->sxpinfo.gp &= (~SPECIAL_SYMBOL_MASK))
 #define NO_SPECIAL_SYMBOLS(b) ((b)->sxpinfo.gp & SPECIAL_SYMBOL_MASK)
 
+/* symbols the S3 dispatch cache in objects.c depends on */
+#define S3_METHOD_SYMBOL_MASK (1<<11)
+#define SET_S3_METHOD_SYMBOL(b) ((b)->sxpinfo.gp |= S3_METHOD_SYMBOL_MASK)
+#define IS_S3_METHOD_SYMBOL(b) ((b)->sxpinfo.gp & S3_METHOD_SYMBOL_MASK)
+
+/* symbols the function lookup cache in envir.c depends on */
+#define FUN_CACHE_SYMBOL_MASK (1<<10)
+#define SET_FUN_CACHE_SYMBOL(b) ((b)->sxpinfo.gp |= FUN_CACHE_SYMBOL_MASK)
+#define IS_FUN_CACHE_SYMBOL(b) ((b)->sxpinfo.gp & FUN_CACHE_SYMBOL_MASK)
+
 #else /* USE_RINTERNALS */
 
 typedef struct VECREC *VECP;
@@ -478,6 +488,12 @@ void (SET_NO_SPECIAL_SYMBOLS)(SEXP b);
 void (UNSET_NO_SPECIAL_SYMBOLS)(SEXP b);
 Rboolean (NO_SPECIAL_SYMBOLS)(SEXP b);
 
+void (SET_S3_METHOD_SYMBOL)(SEXP b);
+Rboolean (IS_S3_METHOD_SYMBOL)(SEXP b);
+
+void (SET_FUN_CACHE_SYMBOL)(SEXP b);
+Rboolean (IS_FUN_CACHE_SYMBOL)(SEXP b);
+
 #endif /* USE_RINTERNALS */
 
 #define TYPED_STACK
@@ -541,6 +557,7 @@ typedef struct RCNTXT {
     int bcintactive;            /* R_BCIntActive value */
     SEXP bcbody;                /* R_BCbody value */
     void* bcpc;                 /* R_BCpc value */
+    void *bcframes;             /* R_BCFrames value */
     SEXP handlerstack;          /* condition handler stack */
     SEXP restartstack;          /* stack of available restarts */
     struct RPRSTACK *prstack;   /* stack of pending promises */
@@ -676,6 +693,7 @@ extern0 int	R_BCIntActive INI_as(0); /* bcEval called more recently than
                                             eval */
 extern0 void*	R_BCpc INI_as(NULL);/* current byte code instruction */
 extern0 SEXP	R_BCbody INI_as(NULL); /* current byte code object */
+extern0 void*	R_BCFrames INI_as(NULL); /* operands of active bcEval calls */
 extern0 SEXP	R_NHeap;	    /* Start of the cons cell heap */
 extern0 SEXP	R_FreeSEXP;	    /* Cons cell free list */
 extern0 R_size_t R_Collected;	    /* Number of free cons cells (after gc) */
@@ -690,6 +708,15 @@ LibExtern SEXP*	R_PPStack;	    /* The pointer protection stack */
 extern0 SEXP	R_CurrentExpr;	    /* Currently evaluating expression */
 extern0 SEXP	R_ReturnedValue;    /* Slot for return-ing values */
 extern0 SEXP*	R_SymbolTable;	    /* The symbol table */
+extern0 unsigned int R_S3MethodsEpoch INI_as(1); /* bumped when a binding the S3
+						  dispatch cache used changes */
+extern0 unsigned int R_FunCacheEpoch INI_as(1); /* bumped when a binding the
+						 function lookup cache used
+						 changes */
+#define R_CachedSymbolChanged(sym) do { \
+    if (IS_S3_METHOD_SYMBOL(sym)) R_S3MethodsEpoch++; \
+    if (IS_FUN_CACHE_SYMBOL(sym)) R_FunCacheEpoch++; \
+} while (0)
 #ifdef R_USE_SIGNALS
 extern0 RCNTXT R_Toplevel;	      /* Storage for the toplevel context */
 extern0 RCNTXT* R_ToplevelContext;  /* The toplevel context */
@@ -731,6 +758,13 @@ extern0 Rboolean R_Verbose	INI_as(FALSE);	/* Be verbose */
 extern0 TR_TYPE R_TraceLevel    INI_as(TR_DISABLED); /* Tracing level */
 extern  char*   R_TraceDir      INI_as(NULL);
 extern  char*   R_TraceFile     INI_as(NULL);
+extern0 TR_FORMAT R_TraceFormat INI_as(TR_FORMAT_TEXT); /* trace_summary format */
+extern0 int     R_TraceCheckpoint INI_as(60); /* seconds between binary checkpoints */
+extern0 int     R_TraceClosures INI_as(0);    /* closures in the per-closure table */
+extern0 long    R_TraceAllocSample INI_as(0); /* mean bytes between allocation samples */
+extern0 int     R_TraceMemInterval INI_as(1000); /* ms between memory samples, 0 = off */
+extern0 int     R_TraceBCProf   INI_as(0);    /* opcode pairs in the byte code profile */
+extern0 Rboolean R_TraceNativeCalls INI_as(FALSE); /* time native calls per symbol */
 
 /* extern int	R_Console; */	    /* Console active flag */
 /* IoBuffer R_ConsoleIob; : --> ./IOStuff.h */
@@ -823,9 +857,11 @@ extern void R_init_jit_enabled(void);
 extern void R_initAssignSymbols(void);
 #ifdef R_USE_SIGNALS
 extern SEXP R_findBCInterpreterSrcref(RCNTXT*);
+extern int R_findBCInterpreterPC(RCNTXT*);
 #endif
 extern SEXP R_getCurrentSrcref();
 extern SEXP R_getBCInterpreterExpression();
+extern const char *R_bcOpName(int);
 
 LibExtern SEXP R_CachedScalarReal INI_as(NULL);
 LibExtern SEXP R_CachedScalarInteger INI_as(NULL);
@@ -1134,6 +1170,8 @@ SEXP evalListKeepMissing(SEXP, SEXP);
 int factorsConform(SEXP, SEXP);
 void NORET findcontext(int, SEXP, SEXP);
 SEXP findVar1(SEXP, SEXP, SEXPTYPE, int);
+SEXP findFunCached(SEXP, SEXP);
+Rboolean R_EnvIsCacheKey(SEXP);
 void FrameClassFix(SEXP);
 SEXP frameSubscript(int, SEXP, SEXP);
 R_xlen_t get1index(SEXP, SEXP, R_xlen_t, int, int, SEXP);
@@ -1212,6 +1250,7 @@ SEXP R_data_class2(SEXP);
 char *R_LibraryFileName(const char *, char *, size_t);
 SEXP R_LoadFromFile(FILE*, int);
 SEXP R_NewHashedEnv(SEXP, SEXP);
+void R_HashClosureFrame(SEXP, int);
 extern int R_Newhashpjw(const char *);
 FILE* R_OpenLibraryFile(const char *);
 SEXP R_Primitive(const char *);
@@ -1266,7 +1305,7 @@ void NORET R_jumpctxt(RCNTXT *, int, SEXP);
 SEXP ItemName(SEXP, R_xlen_t);
 
 /* ../main/CommandLineArgs.c ** Trace instrumentation */
-void write_commandArgs(FILE* out);
+void format_commandArgs(char *buf, size_t size);
 
 /* ../main/errors.c : */
 void NORET errorcall_cpy(SEXP, const char *, ...);
@@ -1349,6 +1388,21 @@ void resetICUcollator(void); /* from util.c */
 void dt_invalidate_locale(); /* from Rstrptime.h */
 int R_OutputCon; /* from connections.c */
 extern int R_InitReadItemDepth, R_ReadItemDepth; /* from serialize.c */
+
+/* open-addressing table of object pointers, from serialize.c */
+typedef struct {
+    SEXP key;	/* NULL for an empty slot */
+    int val;
+} R_ptrhash_entry_t;
+typedef struct {
+    R_ptrhash_entry_t *tab;
+    R_size_t size, count;	/* slots, numbers given out */
+    int shift;
+    SEXP keys;			/* preserved VECSXP of the keys, or NULL */
+} R_ptrhash_t;
+void R_PtrHashInit(R_ptrhash_t *ht, R_size_t size);
+void R_PtrHashFree(R_ptrhash_t *ht);
+int *R_PtrHashLookup(R_ptrhash_t *ht, SEXP key, Rboolean add);
 void get_current_mem(size_t *,size_t *,size_t *); /* from memory.c */
 unsigned long get_duplicate_counter(void);  /* from duplicate.c */
 void reset_duplicate_counter(void);  /* from duplicate.c */
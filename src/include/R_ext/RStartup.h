@@ -76,8 +76,15 @@ typedef struct
     Rboolean DebugInitFile;
     TR_TYPE TraceLevel;
     Rboolean TraceExternalCalls;
+    Rboolean TraceNativeCalls;
     char *TraceDir;
     char *TraceFile;
+    TR_FORMAT TraceFormat;
+    int TraceCheckpoint;
+    int TraceClosures;
+    long TraceAllocSample;
+    int TraceMemInterval;
+    int TraceBCProf;
     SA_TYPE RestoreAction;
     SA_TYPE SaveAction;
     R_SIZE_T vsize;
@@ -59,6 +59,9 @@ typedef struct clpconn {
 #define con_pushback	Rf_con_pushback
 
 int Rconn_fgetc(Rconnection con);
+Rboolean Rconn_canReadBlocks(Rconnection con, Rboolean wasopen);
+size_t Rconn_readBlock(Rconnection con, char *buf, size_t n);
+void Rconn_unreadBlock(Rconnection con, size_t n);
 int Rconn_ungetc(int c, Rconnection con);
 int Rconn_getline(Rconnection con, char *buf, int bufsize);
 int Rconn_printf(Rconnection con, const char *format, ...);
@@ -211,7 +211,9 @@ struct sxpinfo_struct {
     unsigned int is_cons   : 1; /* for tracing: this SEXP was allocated as a cons */
     unsigned int promise_gc: 1; /* for tracing: this SEXP should be counted as promise after GC */
     unsigned int promise_level: 16; /* for tracing: level the promise was created on */
-}; /*		    Tot: 32 +2+16 */
+    unsigned int gcepoch : 12; /* mark epoch of the old generation */
+    unsigned int mapped  :  1; /* large vector in a mapped block */
+}; /*		    Tot: 32 +2+16+12+1 */
 
 struct vecsxp_struct {
     R_len_t	length;
@@ -1049,7 +1051,8 @@ typedef enum {
     R_pstream_ascii_format,
     R_pstream_binary_format,
     R_pstream_xdr_format,
-    R_pstream_asciihex_format
+    R_pstream_asciihex_format,
+    R_pstream_aligned_binary_format
 } R_pstream_format_t;
 
 typedef struct R_outpstream_st *R_outpstream_t;
@@ -26,8 +26,10 @@ extern unsigned int mallocmeasure_quantum;
 extern size_t mallocmeasure_values[];
 extern size_t mallocmeasure_current_slot;
 
+void mallocmeasure_start(void);
 void mallocmeasure_finalize(void);
 void mallocmeasure_reset(void);
 void mallocmeasure_kill(void);
+void mallocmeasure_count_mapped(long bytes);
 
 #endif
@@ -17,12 +17,16 @@
 // Output defines
 #ifdef TRACE_ZIPPED
 #  define MEMORY_MAP_FILE "memory.map.gz"
-#  define EXTCALLS_NAME   "external_calls.txt.gz"
+#  define EXTCALLS_EXT    ".txt.gz"
 #else
 #  define MEMORY_MAP_FILE "memory.map"
-#  define EXTCALLS_NAME   "external_calls.txt"
+#  define EXTCALLS_EXT    ".txt"
 #endif
+#define EXTCALLS_PREFIX   "external_calls"
+#define EXTCALLS_NAME     EXTCALLS_PREFIX EXTCALLS_EXT
 #define SUMMARY_NAME      "trace_summary"
+#define BINSUMMARY_NAME   "trace_summary.bin"
+#define ALLOCSTACKS_PREFIX "alloc_stacks"
 
 #define EOS -1
 #define MAX_FNAME 128
@@ -38,6 +42,12 @@ typedef enum {
     TR_ALL,
 } TR_TYPE;
 
+/* trace summary output format */
+typedef enum {
+    TR_FORMAT_TEXT,
+    TR_FORMAT_BINARY,
+} TR_FORMAT;
+
 
 /* vector allocation statistics struct */
 typedef struct {
@@ -84,6 +94,11 @@ typedef struct {
 extern traceR_promise_stats_t traceR_promise_stats;
 extern int                    traceR_is_active;
 extern Rboolean               traceR_TraceExternalCalls;
+extern Rboolean               traceR_extcalls_active;
+extern Rboolean               traceR_checkpoints_active;
+extern Rboolean               traceR_closure_stats_active;
+extern Rboolean               traceR_allocsample_active;
+extern Rboolean               traceR_bcprof_active;
 
 // counters for the three classes of arguments
 // (implicit parameters for trcR_count_closure_args and emit_closure)
@@ -94,12 +109,10 @@ extern unsigned int trcR_by_position, trcR_by_keyword, trcR_by_dots;
 #  define FOPEN(file)              R_gzopen(file, "wb")
 #  define FCLOSE(hdl)              R_gzclose(hdl)
 #  define WRITE_FUN(f, data, size) R_gzwrite(f, data, size)
-#  define FPRINTF                  gz_printf
 #else
 #  define FOPEN(file) fopen(file, "w")
 #  define FCLOSE(hdl) fclose(hdl)
 #  define WRITE_FUN(f, data, size) fwrite(data, size, 1, f)
-#  define FPRINTF fprintf
 #endif
 
 void traceR_initialize(void);
@@ -107,21 +120,140 @@ void traceR_start_repl(void);
 void traceR_finish_clean(void);
 void traceR_forked(long childpid);
 
+/* periodic checkpoints of the binary summary, polled after each GC */
+void traceR_checkpoint_poll_int(void);
+
+static inline void traceR_checkpoint_poll(void) {
+    if (traceR_checkpoints_active)
+	traceR_checkpoint_poll_int();
+}
+
 /* Note: The arg counters are implicitly passed via globals: */
 /*   trcR_by_position, trcR_by_keyword, trcR_by_dots         */
-void trcR_count_closure_args(SEXP op);
+void trcR_count_closure_args(SEXP op, SEXP call);
+
+
+/* per-closure attribution (--trace-closures), see closurestats.c */
+void traceR_start_closure_stats(void);
+void traceR_reset_closure_stats(void);
+void traceR_closure_call(SEXP call, SEXP op);
+void traceR_closure_compiled(SEXP oldbody, SEXP newbody);
+void traceR_closure_vector_alloc(traceR_vector_class_t type, size_t elements,
+				 size_t size, size_t asize);
+void traceR_closure_promise(void);
+void traceR_closure_duplicate(unsigned long elements);
+
+static inline void traceR_count_closure_promise(void) {
+    if (traceR_closure_stats_active)
+	traceR_closure_promise();
+}
+
+static inline void traceR_count_closure_compiled(SEXP oldbody, SEXP newbody) {
+    if (traceR_closure_stats_active)
+	traceR_closure_compiled(oldbody, newbody);
+}
+
+static inline void traceR_count_closure_duplicate(unsigned long elements) {
+    if (traceR_closure_stats_active)
+	traceR_closure_duplicate(elements);
+}
+
+
+/* external call tracing (--trace-externalcalls, --trace-nativecalls), see extcalls.c */
+typedef struct {
+    int       id;        // interned symbol, -1 if the call is not traced
+    long long start_ns;
+    long long start_cpu_ns;
+    long long nested_ns;      // native time totals when the call started,
+    long long nested_cpu_ns;  // to leave out the time of nested calls
+} traceR_extcall_t;
+
+void traceR_extcall_name_int(int /*NativeSymbolType*/ type,
+			     const char *funcname,
+			     void /*DL_FUNC*/ *fun);
+void traceR_extcall_begin_int(traceR_extcall_t *call,
+			      int /*NativeSymbolType*/ type,
+			      void /*DL_FUNC*/ *fun);
+void traceR_extcall_end_int(traceR_extcall_t *call);
+void traceR_extcall_copied_int(traceR_extcall_t *call, size_t bytes_in, size_t bytes_out);
 
+/* a native routine was resolved, its name is known */
+static inline void traceR_extcall_name(int /*NativeSymbolType*/ type,
+				       const char *funcname,
+				       void /*DL_FUNC*/ *fun) {
+    if (traceR_extcalls_active)
+	traceR_extcall_name_int(type, funcname, fun);
+}
+
+/* around the call of a native routine */
+static inline void traceR_extcall_begin(traceR_extcall_t *call,
+					int /*NativeSymbolType*/ type,
+					void /*DL_FUNC*/ *fun) {
+    call->id = -1;
+    if (traceR_extcalls_active)
+	traceR_extcall_begin_int(call, type, fun);
+}
+
+static inline void traceR_extcall_end(traceR_extcall_t *call) {
+    if (call->id >= 0)
+	traceR_extcall_end_int(call);
+}
+
+/* argument bytes .C and .Fortran copied for the call, after the copy back */
+static inline void traceR_extcall_copied(traceR_extcall_t *call,
+					 size_t bytes_in, size_t bytes_out) {
+    if (call->id >= 0)
+	traceR_extcall_copied_int(call, bytes_in, bytes_out);
+}
+
+/* sampling allocation profiler (--trace-allocsample), see allocsample.c */
+void traceR_start_allocsample(void);
+void traceR_reset_allocsample(void);
+void traceR_allocsample(size_t bytes);
+
+/* garbage collection pauses, see gcstats.c */
+#define TRACER_GC_LEVELS 3  // NUM_OLD_GENERATIONS + 1 in memory.c
 
-/* external call tracing */
-void traceR_report_external_int(int /*NativeSymbolType*/ type,
-				char *funcname,
-				void /*DL_FUNC*/ *fun);
+struct timespec;  // no <time.h> here, datetime.c sets up its own time API
+
+void traceR_count_gc(int level, const struct timespec *start,
+		     size_t used_before, size_t used_after, size_t large_freed);
+void traceR_start_gcstats(void);
+void traceR_reset_gcstats(void);
+
+/* byte code opcode profiler (--trace-bcprof), see bcprof.c */
+#define TRACER_BC_MAXOPS 256  // at least OPCOUNT in eval.c
+
+extern int           traceR_bcprof_op;  // opcode being executed
+extern unsigned long traceR_bcprof_counts[TRACER_BC_MAXOPS];
+extern unsigned long traceR_bcprof_fallbacks[TRACER_BC_MAXOPS];
+extern unsigned long traceR_bcprof_boxed[TRACER_BC_MAXOPS];
+extern unsigned long traceR_bcprof_pairs[TRACER_BC_MAXOPS][TRACER_BC_MAXOPS];
+
+void traceR_start_bcprof(void);
+void traceR_reset_bcprof(void);
+
+/* called from the counting entries of the byte code instructions (see
+   bcProfiledBody in eval.c), returns op as the next prev */
+static inline int traceR_count_opcode(int prev, int op) {
+    traceR_bcprof_counts[op]++;
+    if (prev >= 0)
+	traceR_bcprof_pairs[prev][op]++;
+    traceR_bcprof_op = op;
+    return op;
+}
+
+/* the current instruction leaves its scalar fast path */
+static inline void traceR_count_bc_fallback(void) {
+    if (traceR_bcprof_active)
+	traceR_bcprof_fallbacks[traceR_bcprof_op]++;
+}
 
-static inline void traceR_report_external(int /*NativeSymbolType*/ type,
-					  char *funcname,
-					  void /*DL_FUNC*/ *fun) {
-    if (traceR_TraceExternalCalls)
-	traceR_report_external_int(type, funcname, fun);
+/* the current instruction reads a scalar operand from a boxed value
+   rather than an unboxed stack entry */
+static inline void traceR_count_bc_boxed(void) {
+    if (traceR_bcprof_active)
+	traceR_bcprof_boxed[traceR_bcprof_op]++;
 }
 
 /* vector allocation logging */
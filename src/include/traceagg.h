@@ -0,0 +1,58 @@
+/*
+ *  r-instrumented : Various measurements for R
+ *  Copyright (C) 2014  TU Dortmund Informatik LS XII
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, a copy is available at
+ *  http://www.r-project.org/Licenses/
+ *
+ *  traceagg.h: merging the counters of several trace summaries
+ *
+ *  This header must not depend on R headers, it is also used by the
+ *  standalone tracebin2text converter.
+ */
+
+#ifndef TRACEAGG_H
+#define TRACEAGG_H
+
+#include "tracebin.h"
+
+typedef struct traceout traceout_t;
+typedef struct traceagg traceagg_t;
+
+/*
+ * Rows with the given keyword are merged. Each character of ops
+ * describes one value of the row:
+ *   k  part of the row identity (e.g. a histogram bin), kept
+ *   +  summed
+ *   <  minimum
+ *   >  maximum
+ * Rows with a different number of values are ignored.
+ */
+typedef struct {
+    const char *key;
+    const char *ops;
+} tragg_rule_t;
+
+traceagg_t *tragg_create(const tragg_rule_t *rules, unsigned int nrules);
+void tragg_free(traceagg_t *agg);
+
+/* fed by the traceout layer, see trout_set_aggregate */
+void tragg_label(traceagg_t *agg, const char *labels);
+void tragg_table(traceagg_t *agg, const char *key, const char *name);
+void tragg_row(traceagg_t *agg, const char *key, const tracebin_record_t *rec);
+
+/* write an aggregate section with the merged rows */
+void tragg_write(traceagg_t *agg, traceout_t *out, unsigned int processes);
+
+#endif
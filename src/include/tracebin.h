@@ -0,0 +1,104 @@
+/*
+ *  r-instrumented : Various measurements for R
+ *  Copyright (C) 2014  TU Dortmund Informatik LS XII
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, a copy is available at
+ *  http://www.r-project.org/Licenses/
+ *
+ *  tracebin.h: binary trace summary ring file
+ *
+ *  This header must not depend on R headers, it is also used by the
+ *  standalone tracebin2text converter.
+ */
+
+#ifndef TRACEBIN_H
+#define TRACEBIN_H
+
+#include <stdint.h>
+
+#define TRACEBIN_MAGIC        0x42525452  /* "RTRB" */
+#define TRACEBIN_VERSION      2
+#define TRACEBIN_HEADER_SIZE  4096
+#define TRACEBIN_RECORDS      32768       /* default ring size, 4 MiB */
+#define TRACEBIN_MAXVALS      14
+#define TRACEBIN_STRBYTES     (TRACEBIN_MAXVALS * 8)
+
+/* record kinds */
+typedef enum {
+    TRB_CHECKPOINT_BEGIN = 1, /* u[0] = final flag */
+    TRB_CHECKPOINT_END,
+    TRB_KEYDEF,               /* key id -> keyword string */
+    TRB_ROW,                  /* keyword with numeric values */
+    TRB_STRING,               /* keyword with one string value */
+    TRB_LABEL,                /* "#!LABEL" line, tab separated string */
+    TRB_TABLE,                /* "#!TABLE" line, key + table name */
+    TRB_COMMENT,              /* "# " line */
+    TRB_LINE,                 /* preformatted text line */
+    TRB_SECTION,              /* start of a child's data, i[0] = child number,
+				 i[1] = its pid, i[2] = pid of its parent */
+    TRB_AGGREGATE             /* start of the merged counters, u[0] = processes */
+} tracebin_kind_t;
+
+/* one fixed-size record, 128 bytes */
+typedef struct {
+    uint8_t  version;
+    uint8_t  kind;
+    uint8_t  nvals;     /* number of values or string bytes in this record */
+    uint8_t  more;      /* string continues in the next record */
+    uint16_t key;
+    uint16_t fmask;     /* bit i set: d[i] is a double */
+    uint16_t smask;     /* bit i set: i[i] is signed */
+    uint16_t pad;
+    uint32_t seq;       /* checkpoint this record belongs to */
+    union {
+	uint64_t u[TRACEBIN_MAXVALS];
+	int64_t  i[TRACEBIN_MAXVALS];
+	double   d[TRACEBIN_MAXVALS];
+	char     s[TRACEBIN_STRBYTES];
+    } v;
+} tracebin_record_t;
+
+/* file header, padded to TRACEBIN_HEADER_SIZE */
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t capacity;     /* number of records in the ring */
+    uint64_t head;         /* number of records written so far */
+    uint64_t last_begin;   /* first record of the last complete checkpoint */
+    uint64_t last_end;     /* one past its last record */
+    uint32_t last_seq;     /* its sequence number, 0 if there is none */
+    uint32_t last_final;   /* set if it was written at the end of the run */
+} tracebin_header_t;
+
+typedef struct tracebin tracebin_t;
+
+typedef int (*tracebin_fun_t)(const tracebin_record_t *rec, void *data);
+
+/* writer */
+tracebin_t *tracebin_create(const char *path, uint32_t capacity);
+void tracebin_begin(tracebin_t *tb, int final);
+void tracebin_append(tracebin_t *tb, tracebin_record_t *rec);
+void tracebin_end(tracebin_t *tb);
+int tracebin_resize(tracebin_t *tb, uint32_t capacity);
+void tracebin_close(tracebin_t *tb);
+void tracebin_forget(tracebin_t *tb);
+
+/* reader */
+tracebin_t *tracebin_open(const char *path);
+const tracebin_header_t *tracebin_header(const tracebin_t *tb);
+int tracebin_foreach(const tracebin_t *tb, tracebin_fun_t fun, void *data);
+int tracebin_is_binary(const char *path);
+
+#endif
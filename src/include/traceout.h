@@ -0,0 +1,62 @@
+/*
+ *  r-instrumented : Various measurements for R
+ *  Copyright (C) 2014  TU Dortmund Informatik LS XII
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, a copy is available at
+ *  http://www.r-project.org/Licenses/
+ *
+ *  traceout.h: trace summary output in text or binary format
+ */
+
+#ifndef TRACEOUT_H
+#define TRACEOUT_H
+
+#include <stdio.h>
+#include "tracebin.h"
+#include "traceagg.h"
+
+traceout_t *trout_open_text(FILE *fd);
+traceout_t *trout_open_binary(tracebin_t *tb);
+void trout_close(traceout_t *out);
+
+/* checkpoints only have an effect for the binary backend */
+void trout_begin(traceout_t *out, int final);
+void trout_end(traceout_t *out);
+
+/*
+ * One keyword line with numeric values. Each character of types
+ * describes one value argument, similar to a printf conversion:
+ *   d int, u unsigned int, l long, L unsigned long, z size_t, f double
+ */
+void trout_row(traceout_t *out, const char *key, const char *types, ...);
+void trout_record(traceout_t *out, const char *key, const tracebin_record_t *rec);
+
+void trout_string(traceout_t *out, const char *key, const char *value);
+void trout_label(traceout_t *out, const char *labels);
+void trout_table(traceout_t *out, const char *key, const char *name);
+void trout_comment(traceout_t *out, const char *text);
+void trout_line(traceout_t *out, const char *line);
+void trout_section(traceout_t *out, unsigned int child, long pid, long parent);
+void trout_aggregate(traceout_t *out, unsigned int processes);
+
+/* pass all rows, labels and tables written from now on to agg (or none) */
+void trout_set_aggregate(traceout_t *out, traceagg_t *agg);
+
+/*
+ * Copy the last complete checkpoint of a binary file. Child sections
+ * in it are numbered on from *sections.
+ */
+int trout_replay(traceout_t *out, const tracebin_t *tb, unsigned int *sections);
+
+#endif
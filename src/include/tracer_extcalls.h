@@ -0,0 +1,11 @@
+#ifndef TRACER_EXTCALLS_H
+#define TRACER_EXTCALLS_H
+
+#include "traceout.h"
+
+int  extcalls_open(const char *path);
+int  extcalls_fork(const char *path);
+void extcalls_close(void);
+void extcalls_write(traceout_t *out);
+
+#endif
@@ -1,8 +1,11 @@
 #ifndef TRACER_FREEMEM_H
 #define TRACER_FREEMEM_H
 
-void freemem_spawn(const char *filename);
+#include "traceout.h"
+
+void freemem_start(void);
 void freemem_stop(void);
 void freemem_fork(void);
+void freemem_write(traceout_t *out, int final, unsigned int max_rows);
 
 #endif
@@ -0,0 +1,458 @@
+/*
+ *  r-instrumented : Various measurements for R
+ *  Copyright (C) 2014  TU Dortmund Informatik LS XII
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, a copy is available at
+ *  http://www.r-project.org/Licenses/
+ *
+ *  allocsample.c: sampling allocation profiler
+ *
+ *  The distance in bytes between two samples is drawn from an
+ *  exponential distribution, so every allocated byte has the same
+ *  chance of being sampled. A sample records the R call stack with the
+ *  source location (or byte code offset) in each frame; identical
+ *  stacks are merged. The result is written in the folded stack format
+ *  read by flamegraph.pl, weighted by the estimated number of bytes.
+ *
+ *  Samples are taken from inside allocVector, so nothing here may
+ *  allocate R objects.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#define R_USE_SIGNALS 1
+#include <Defn.h>
+#include <trace.h>
+
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "traceout.h"
+
+#define MAX_STACK_DEPTH 256
+#define MAX_FRAME_NAME  512
+#define INITIAL_SLOTS   1024  // must be a power of two
+
+/* frame names, the id of a frame is its index in frame_names */
+static char         **frame_names;
+static unsigned int   frame_count;
+static unsigned int  *frame_table;    // id + 1, 0 is an empty slot
+static unsigned int   frame_slots;
+
+/* distinct stacks, the frame ids are stored outermost first */
+typedef struct {
+    unsigned int   hash;
+    unsigned int   depth;      // 0 is an empty slot
+    unsigned int  *frames;
+    unsigned long  samples;
+    double         bytes;
+} stack_slot_t;
+
+static stack_slot_t  *stacks;
+static unsigned int   stack_slots;
+static unsigned int   stack_count;
+
+static long           bytes_left;
+static unsigned long  total_samples;
+static double         total_bytes;
+static Rboolean       sample_failed;
+static uint64_t       rng_state;
+
+static SEXP filename_symbol;  // installed lazily, tracing starts before InitNames()
+
+
+/*
+ * distance to the next sample
+ */
+
+/* xorshift64*, R's own RNG must not be disturbed */
+static double random_unit(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+
+    /* uniform in (0, 1] */
+    return (((rng_state * 0x2545F4914F6CDD1DULL) >> 11) + 1) * (1.0 / 9007199254740992.0);
+}
+
+static long next_distance(void) {
+    double d = -log(random_unit()) * R_TraceAllocSample;
+
+    if (d < 1)
+	return 1;
+    if (d > LONG_MAX / 2)
+	return LONG_MAX / 2;
+    return (long)d;
+}
+
+static void seed_rng(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    rng_state = ((uint64_t)now.tv_sec * 1000000007ULL) ^ now.tv_nsec ^
+	((uint64_t)getpid() << 32);
+    if (rng_state == 0)
+	rng_state = 1;
+}
+
+
+/*
+ * frame and stack tables
+ */
+
+static unsigned int hash_string(const char *str) {
+    unsigned int h = 5381;
+
+    for (const char *p = str; *p; p++)
+	h = h * 33 + (unsigned char)*p;
+    return h;
+}
+
+static unsigned int hash_ids(const unsigned int *ids, unsigned int n) {
+    unsigned int h = 2166136261U;
+
+    for (unsigned int i = 0; i < n; i++)
+	h = (h ^ ids[i]) * 16777619U;
+    return h;
+}
+
+static Rboolean grow_frames(void) {
+    unsigned int newslots = frame_slots ? 2 * frame_slots : INITIAL_SLOTS;
+    unsigned int *newtable = calloc(newslots, sizeof(unsigned int));
+    char **newnames = realloc(frame_names, newslots * sizeof(char *));
+
+    if (newtable == NULL || newnames == NULL) {
+	free(newtable);
+	if (newnames)
+	    frame_names = newnames;
+	return FALSE;
+    }
+
+    for (unsigned int id = 0; id < frame_count; id++) {
+	unsigned int j = hash_string(newnames[id]) & (newslots - 1);
+	while (newtable[j])
+	    j = (j + 1) & (newslots - 1);
+	newtable[j] = id + 1;
+    }
+
+    free(frame_table);
+    frame_table     = newtable;
+    frame_slots     = newslots;
+    frame_names     = newnames;
+    return TRUE;
+}
+
+static Rboolean intern_frame(const char *name, unsigned int *id) {
+    if (4 * (frame_count + 1) > 3 * frame_slots && !grow_frames())
+	return FALSE;
+
+    unsigned int i = hash_string(name) & (frame_slots - 1);
+    while (frame_table[i]) {
+	if (!strcmp(frame_names[frame_table[i] - 1], name)) {
+	    *id = frame_table[i] - 1;
+	    return TRUE;
+	}
+	i = (i + 1) & (frame_slots - 1);
+    }
+
+    char *copy = strdup(name);
+    if (copy == NULL)
+	return FALSE;
+
+    *id = frame_count++;
+    frame_names[*id] = copy;
+    frame_table[i]   = *id + 1;
+    return TRUE;
+}
+
+static Rboolean grow_stacks(void) {
+    unsigned int newslots = stack_slots ? 2 * stack_slots : INITIAL_SLOTS;
+    stack_slot_t *newtable = calloc(newslots, sizeof(stack_slot_t));
+
+    if (newtable == NULL)
+	return FALSE;
+
+    for (unsigned int i = 0; i < stack_slots; i++) {
+	if (stacks[i].depth == 0)
+	    continue;
+
+	unsigned int j = stacks[i].hash & (newslots - 1);
+	while (newtable[j].depth)
+	    j = (j + 1) & (newslots - 1);
+	newtable[j] = stacks[i];
+    }
+
+    free(stacks);
+    stacks      = newtable;
+    stack_slots = newslots;
+    return TRUE;
+}
+
+/* ids are given outermost first */
+static stack_slot_t *intern_stack(const unsigned int *ids, unsigned int depth) {
+    if (4 * (stack_count + 1) > 3 * stack_slots && !grow_stacks())
+	return NULL;
+
+    unsigned int h = hash_ids(ids, depth);
+    unsigned int i = h & (stack_slots - 1);
+
+    while (stacks[i].depth) {
+	if (stacks[i].hash == h && stacks[i].depth == depth &&
+	    !memcmp(stacks[i].frames, ids, depth * sizeof(unsigned int)))
+	    return &stacks[i];
+	i = (i + 1) & (stack_slots - 1);
+    }
+
+    unsigned int *copy = malloc(depth * sizeof(unsigned int));
+    if (copy == NULL)
+	return NULL;
+    memcpy(copy, ids, depth * sizeof(unsigned int));
+
+    stacks[i].hash   = h;
+    stacks[i].depth  = depth;
+    stacks[i].frames = copy;
+    stack_count++;
+    return &stacks[i];
+}
+
+
+/*
+ * stack capture
+ */
+
+/* name of the called function, following doprof() in eval.c */
+static void call_name(char *buf, size_t size, SEXP call) {
+    SEXP fun = CAR(call);
+
+    if (TYPEOF(fun) == SYMSXP)
+	snprintf(buf, size, "%s", CHAR(PRINTNAME(fun)));
+    else if (TYPEOF(fun) == LANGSXP &&
+	     (CAR(fun) == R_DoubleColonSymbol ||
+	      CAR(fun) == R_TripleColonSymbol ||
+	      CAR(fun) == R_DollarSymbol) &&
+	     TYPEOF(CADR(fun)) == SYMSXP &&
+	     TYPEOF(CADDR(fun)) == SYMSXP)
+	snprintf(buf, size, "%s%s%s",
+		 CHAR(PRINTNAME(CADR(fun))),
+		 CHAR(PRINTNAME(CAR(fun))),
+		 CHAR(PRINTNAME(CADDR(fun))));
+    else
+	snprintf(buf, size, "<Anonymous>");
+}
+
+/*
+ * Location inside a running function. The state is saved in the next
+ * context that was created while the function ran (inner), or is still
+ * in the globals for the innermost one.
+ */
+static void append_location(char *buf, size_t size, RCNTXT *inner) {
+    size_t len = strlen(buf);
+    SEXP srcref = inner ? inner->srcref : R_Srcref;
+    int bcactive = inner ? inner->bcintactive : R_BCIntActive;
+
+    if (srcref == R_InBCInterpreter)
+	srcref = R_findBCInterpreterSrcref(inner);
+
+    if (TYPEOF(srcref) == INTSXP && LENGTH(srcref) >= 6) {
+	const char *file = "<text>";
+	SEXP srcfile = getAttrib(srcref, R_SrcfileSymbol);
+
+	if (filename_symbol == NULL)
+	    filename_symbol = install("filename");
+	if (TYPEOF(srcfile) == ENVSXP) {
+	    SEXP fn = findVarInFrame(srcfile, filename_symbol);
+	    if (TYPEOF(fn) == STRSXP && LENGTH(fn) > 0 && CHAR(STRING_ELT(fn, 0))[0])
+		file = CHAR(STRING_ELT(fn, 0));
+	}
+	snprintf(buf + len, size - len, " (%s:%d)", file, INTEGER(srcref)[0]);
+    } else if (bcactive) {
+	int pc = R_findBCInterpreterPC(inner);
+	if (pc >= 0)
+	    snprintf(buf + len, size - len, " (pc %d)", pc);
+    }
+}
+
+/* ';' separates frames and newlines separate stacks in the folded format */
+static void sanitize(char *buf) {
+    for (char *p = buf; *p; p++)
+	if (*p == ';' || *p == '\n' || *p == '\r')
+	    *p = ':';
+}
+
+static void take_sample(double weight) {
+    unsigned int ids[MAX_STACK_DEPTH];
+    unsigned int depth = 0;
+    char buf[MAX_FRAME_NAME];
+    RCNTXT *inner = NULL;
+
+    /* innermost frames first, the outermost ones are cut off on deep stacks */
+    for (RCNTXT *c = R_GlobalContext;
+	 c != NULL && c->callflag != CTXT_TOPLEVEL && depth < MAX_STACK_DEPTH;
+	 c = c->nextcontext) {
+	if ((c->callflag & (CTXT_FUNCTION | CTXT_BUILTIN)) &&
+	    TYPEOF(c->call) == LANGSXP) {
+	    call_name(buf, sizeof(buf), c->call);
+	    append_location(buf, sizeof(buf), inner);
+	    sanitize(buf);
+	    if (!intern_frame(buf, &ids[depth++])) {
+		sample_failed = TRUE;
+		return;
+	    }
+	}
+	inner = c;
+    }
+
+    if (depth == 0) {
+	strcpy(buf, "<toplevel>");
+	append_location(buf, sizeof(buf), NULL);
+	sanitize(buf);
+	if (!intern_frame(buf, &ids[depth++])) {
+	    sample_failed = TRUE;
+	    return;
+	}
+    }
+
+    /* outermost first */
+    for (unsigned int i = 0; i < depth / 2; i++) {
+	unsigned int tmp = ids[i];
+	ids[i] = ids[depth - 1 - i];
+	ids[depth - 1 - i] = tmp;
+    }
+
+    stack_slot_t *stack = intern_stack(ids, depth);
+    if (stack == NULL) {
+	sample_failed = TRUE;
+	return;
+    }
+
+    stack->samples++;
+    stack->bytes += weight;
+    total_samples++;
+    total_bytes += weight;
+}
+
+/* only called if traceR_allocsample_active is set */
+void traceR_allocsample(size_t bytes) {
+    bytes_left -= bytes;
+    if (bytes_left >= 0)
+	return;
+
+    bytes_left = next_distance();
+
+    /*
+     * An allocation of this size is sampled with probability
+     * 1 - exp(-bytes/interval), weight it accordingly to get an
+     * unbiased estimate of the allocated bytes.
+     */
+    double p = -expm1(-(double)bytes / R_TraceAllocSample);
+    take_sample(p > 0 ? bytes / p : (double)R_TraceAllocSample);
+}
+
+
+/*
+ * output
+ */
+
+static void write_folded(const char *path) {
+    FILE *fd = fopen(path, "w");
+
+    if (fd == NULL) {
+	perror(path);
+	return;
+    }
+
+    for (unsigned int i = 0; i < stack_slots; i++) {
+	stack_slot_t *stack = &stacks[i];
+
+	if (stack->depth == 0 || stack->samples == 0)
+	    continue;
+
+	for (unsigned int j = 0; j < stack->depth; j++) {
+	    if (j)
+		fputc(';', fd);
+	    fputs(frame_names[stack->frames[j]], fd);
+	}
+	fprintf(fd, " %.0f\n", stack->bytes);
+    }
+
+    fclose(fd);
+}
+
+void traceR_write_allocsample(traceout_t *out, Rboolean final) {
+    char path[MAX_DNAME + 32];
+
+    if (!traceR_allocsample_active)
+	return;
+
+    trout_row(out, "AllocSampleInterval", "l", R_TraceAllocSample);
+    trout_label(out, "samples\tbytes");
+    trout_row(out, "AllocSamples", "Lf", total_samples, total_bytes);
+    trout_label(out, "stacks\tframes");
+    trout_row(out, "AllocSampleStacks", "uu", stack_count, frame_count);
+    if (sample_failed)
+	trout_row(out, "AllocSampleFailed", "d", 1);
+
+    /* the stack file is only written once, at the end of the run */
+    if (!final)
+	return;
+
+    if (R_isForkedChild)
+	snprintf(path, sizeof(path), "%s%s" ALLOCSTACKS_PREFIX "_%d.folded",
+		 R_TraceDir ? R_TraceDir : "", R_TraceDir ? "/" : "", getpid());
+    else
+	snprintf(path, sizeof(path), "%s%s" ALLOCSTACKS_PREFIX ".folded",
+		 R_TraceDir ? R_TraceDir : "", R_TraceDir ? "/" : "");
+
+    write_folded(path);
+    trout_string(out, "AllocSampleFile", path);
+}
+
+
+/*
+ * setup
+ */
+
+void traceR_start_allocsample(void) {
+    if (R_TraceAllocSample <= 0)
+	return;
+
+    seed_rng();
+    bytes_left = next_distance();
+    traceR_allocsample_active = TRUE;
+}
+
+/* clear all samples, e.g. in a forked child */
+void traceR_reset_allocsample(void) {
+    for (unsigned int i = 0; i < stack_slots; i++) {
+	stacks[i].samples = 0;
+	stacks[i].bytes   = 0;
+    }
+
+    total_samples = 0;
+    total_bytes   = 0;
+    sample_failed = FALSE;
+
+    if (traceR_allocsample_active) {
+	seed_rng();
+	bytes_left = next_distance();
+    }
+}
@@ -0,0 +1,155 @@
+/*
+ *  r-instrumented : Various measurements for R
+ *  Copyright (C) 2014  TU Dortmund Informatik LS XII
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, a copy is available at
+ *  http://www.r-project.org/Licenses/
+ *
+ *  bcprof.c: byte code opcode profile
+ *
+ *  The byte code interpreter counts every instruction it dispatches and
+ *  every pair of consecutive instructions (see traceR_count_opcode in
+ *  trace.h). Instructions with a scalar fast path (arithmetic, compare,
+ *  math functions, variable lookup through the cache and the vector and
+ *  matrix subset/subassign instructions) also count how often they had
+ *  to fall back to the generic implementation, and how many of the scalar
+ *  operands they used were boxed R values rather than unboxed entries of
+ *  the typed node stack. Only the counting is done here; the pairs are
+ *  ranked when the summary is written.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <Defn.h>
+#include <trace.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "traceout.h"
+
+typedef struct {
+    unsigned int  first;
+    unsigned int  second;
+    unsigned long count;
+} opcode_pair_t;
+
+static int compare_pairs(const void *a, const void *b) {
+    const opcode_pair_t *pa = a, *pb = b;
+
+    if (pa->count != pb->count)
+	return pa->count < pb->count ? 1 : -1;
+    if (pa->first != pb->first)
+	return pa->first < pb->first ? -1 : 1;
+    return pa->second < pb->second ? -1 : pa->second > pb->second;
+}
+
+static void write_pairs(traceout_t *out) {
+    opcode_pair_t *pairs;
+    size_t npairs = 0;
+
+    for (unsigned int i = 0; i < TRACER_BC_MAXOPS; i++)
+	for (unsigned int j = 0; j < TRACER_BC_MAXOPS; j++)
+	    if (traceR_bcprof_pairs[i][j])
+		npairs++;
+
+    trout_row(out, "BCOpPairCount", "z", npairs);
+    if (npairs == 0)
+	return;
+
+    pairs = malloc(npairs * sizeof(opcode_pair_t));
+    if (pairs == NULL) {
+	trout_row(out, "BCOpPairsFailed", "d", 1);
+	return;
+    }
+
+    npairs = 0;
+    for (unsigned int i = 0; i < TRACER_BC_MAXOPS; i++)
+	for (unsigned int j = 0; j < TRACER_BC_MAXOPS; j++)
+	    if (traceR_bcprof_pairs[i][j]) {
+		pairs[npairs].first  = i;
+		pairs[npairs].second = j;
+		pairs[npairs].count  = traceR_bcprof_pairs[i][j];
+		npairs++;
+	    }
+
+    qsort(pairs, npairs, sizeof(opcode_pair_t), compare_pairs);
+    if (npairs > (size_t)R_TraceBCProf)
+	npairs = R_TraceBCProf;
+
+    trout_label(out, "first\tsecond\tcount");
+    trout_table(out, "BCOpPair", "BCOpcodePairs");
+    for (size_t i = 0; i < npairs; i++)
+	trout_row(out, "BCOpPair", "uuL", pairs[i].first, pairs[i].second, pairs[i].count);
+
+    free(pairs);
+}
+
+void traceR_write_bcprof(traceout_t *out) {
+    unsigned long total = 0, fallbacks = 0;
+    char buf[128];
+
+    if (!traceR_bcprof_active)
+	return;
+
+    for (unsigned int i = 0; i < TRACER_BC_MAXOPS; i++) {
+	total     += traceR_bcprof_counts[i];
+	fallbacks += traceR_bcprof_fallbacks[i];
+    }
+
+    trout_label(out, "instructions\tfallbacks");
+    trout_row(out, "BCInstructions", "LL", total, fallbacks);
+
+    trout_label(out, "opcode\tname");
+    trout_table(out, "BCOpName", "BCOpcodeNames");
+    for (unsigned int i = 0; i < TRACER_BC_MAXOPS; i++) {
+	const char *name = R_bcOpName(i);
+
+	if (traceR_bcprof_counts[i] == 0)
+	    continue;
+	snprintf(buf, sizeof(buf), "%u\t%s", i, name ? name : "-");
+	trout_string(out, "BCOpName", buf);
+    }
+
+    trout_label(out, "opcode\tcount\tfallbacks\tboxed");
+    trout_table(out, "BCOpcode", "BCOpcodeCounts");
+    for (unsigned int i = 0; i < TRACER_BC_MAXOPS; i++) {
+	if (traceR_bcprof_counts[i] == 0)
+	    continue;
+	trout_row(out, "BCOpcode", "uLLL", i,
+		  traceR_bcprof_counts[i], traceR_bcprof_fallbacks[i],
+		  traceR_bcprof_boxed[i]);
+    }
+
+    write_pairs(out);
+}
+
+void traceR_start_bcprof(void) {
+    if (R_TraceBCProf <= 0)
+	return;
+
+    traceR_bcprof_op     = 0;
+    traceR_bcprof_active = TRUE;
+}
+
+/* clear all counters, e.g. in a forked child */
+void traceR_reset_bcprof(void) {
+    memset(traceR_bcprof_counts, 0, sizeof(traceR_bcprof_counts));
+    memset(traceR_bcprof_fallbacks, 0, sizeof(traceR_bcprof_fallbacks));
+    memset(traceR_bcprof_boxed, 0, sizeof(traceR_bcprof_boxed));
+    memset(traceR_bcprof_pairs, 0, sizeof(traceR_bcprof_pairs));
+}
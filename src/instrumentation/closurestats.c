@@ -0,0 +1,395 @@
+/*
+ *  r-instrumented : Various measurements for R
+ *  Copyright (C) 2014  TU Dortmund Informatik LS XII
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, a copy is available at
+ *  http://www.r-project.org/Licenses/
+ *
+ *  closurestats.c: per-closure call and allocation attribution
+ *
+ *  Closures are identified by their body expression, so all closures
+ *  created from the same function expression share one entry. When the
+ *  JIT compiles a closure, the compiled body is added as an alias of the
+ *  same entry. Bodies are preserved once they have an entry, otherwise
+ *  the garbage collector could hand the address to an unrelated body.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#define R_USE_SIGNALS 1
+#include <Defn.h>
+#include <trace.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "traceout.h"
+
+typedef struct {
+    char         *name;
+    char         *srcref;
+
+    unsigned long calls;
+    unsigned long by_position;
+    unsigned long by_keyword;
+    unsigned long by_dots;
+    unsigned long promises;
+    unsigned long dup_elts;
+    vec_alloc_stats_t vectors[TR_VECCLASS_TOTAL + 1];
+} closure_stats_t;
+
+/* hash table slot, several bodies may share the same statistics */
+typedef struct {
+    SEXP          body;
+    unsigned int  idx;
+} closure_slot_t;
+
+#define INITIAL_SLOTS 1024  // must be a power of two
+#define TOPLEVEL      0     // stats index of code outside of any closure
+
+static closure_slot_t   *table;
+static unsigned int      table_slots;
+static unsigned int      table_used;
+
+/* bodies added from allocation hooks, preserved on the next call */
+static SEXP             *pending;
+static unsigned int      npending;
+static unsigned int      maxpending;
+
+static closure_stats_t  *stats;
+static unsigned int      nstats;
+static unsigned int      maxstats;
+static Rboolean          stats_failed;
+
+/* last context looked up by current_stats() */
+static RCNTXT           *cache_ctx;
+static SEXP              cache_fun;
+static unsigned int      cache_idx;
+
+static SEXP filename_symbol;  // installed lazily, tracing starts before InitNames()
+
+static unsigned int hash_body(SEXP body) {
+    uintptr_t h = (uintptr_t)body;
+
+    h ^= h >> 17;
+    h *= 0x9E3779B97F4A7C15ULL;
+    return (unsigned int)(h >> 32);
+}
+
+static Rboolean grow_table(void) {
+    unsigned int newslots = table_slots ? 2 * table_slots : INITIAL_SLOTS;
+    closure_slot_t *newtable = calloc(newslots, sizeof(closure_slot_t));
+
+    if (newtable == NULL)
+	return FALSE;
+
+    for (unsigned int i = 0; i < table_slots; i++) {
+	if (table[i].body == NULL)
+	    continue;
+
+	unsigned int j = hash_body(table[i].body) & (newslots - 1);
+	while (newtable[j].body != NULL)
+	    j = (j + 1) & (newslots - 1);
+	newtable[j] = table[i];
+    }
+
+    free(table);
+    table       = newtable;
+    table_slots = newslots;
+    return TRUE;
+}
+
+static Rboolean new_stats(unsigned int *idx) {
+    if (nstats >= maxstats) {
+	unsigned int newmax = maxstats ? 2 * maxstats : INITIAL_SLOTS;
+	closure_stats_t *newstats = realloc(stats, newmax * sizeof(closure_stats_t));
+
+	if (newstats == NULL)
+	    return FALSE;
+	memset(newstats + maxstats, 0, (newmax - maxstats) * sizeof(closure_stats_t));
+	stats    = newstats;
+	maxstats = newmax;
+    }
+
+    *idx = nstats++;
+    return TRUE;
+}
+
+/*
+ * find the slot of a body, a new slot gets fresh statistics unless
+ * share is given; NULL if there is no memory left
+ */
+static closure_slot_t *lookup(SEXP body, const unsigned int *share) {
+    if (4 * (table_used + 1) > 3 * table_slots && !grow_table()) {
+	stats_failed = TRUE;
+	return NULL;
+    }
+
+    unsigned int i = hash_body(body) & (table_slots - 1);
+    while (table[i].body != NULL) {
+	if (table[i].body == body)
+	    return &table[i];
+	i = (i + 1) & (table_slots - 1);
+    }
+
+    /* no allocations allowed here, so the body is preserved later */
+    if (npending >= maxpending) {
+	unsigned int newmax = maxpending ? 2 * maxpending : 64;
+	SEXP *newpending = realloc(pending, newmax * sizeof(SEXP));
+
+	if (newpending == NULL) {
+	    stats_failed = TRUE;
+	    return NULL;
+	}
+	pending    = newpending;
+	maxpending = newmax;
+    }
+
+    if (share)
+	table[i].idx = *share;
+    else if (!new_stats(&table[i].idx)) {
+	stats_failed = TRUE;
+	return NULL;
+    }
+
+    pending[npending++] = body;
+    table[i].body = body;
+    table_used++;
+    return &table[i];
+}
+
+static void describe(closure_stats_t *entry, SEXP call, SEXP op) {
+    char buf[MAX_DNAME];
+
+    SEXP fun = CAR(call);
+
+    /* pkg::fun and pkg:::fun */
+    if (TYPEOF(fun) == LANGSXP && length(fun) == 3 &&
+	(CAR(fun) == R_DoubleColonSymbol || CAR(fun) == R_TripleColonSymbol))
+	fun = CADDR(fun);
+    entry->name = strdup(TYPEOF(fun) == SYMSXP ? CHAR(PRINTNAME(fun)) : "<anonymous>");
+
+    SEXP srcref = getAttrib(op, R_SrcrefSymbol);
+    if (TYPEOF(srcref) == INTSXP && LENGTH(srcref) >= 6) {
+	const char *file = "<unknown>";
+	SEXP srcfile = getAttrib(srcref, R_SrcfileSymbol);
+
+	if (filename_symbol == NULL)
+	    filename_symbol = install("filename");
+	if (TYPEOF(srcfile) == ENVSXP) {
+	    SEXP fn = findVarInFrame(srcfile, filename_symbol);
+	    if (TYPEOF(fn) == STRSXP && LENGTH(fn) > 0)
+		file = CHAR(STRING_ELT(fn, 0));
+	}
+	snprintf(buf, sizeof(buf), "%s:%d", file, INTEGER(srcref)[0]);
+	entry->srcref = strdup(buf);
+    }
+}
+
+static void preserve_pending(void) {
+    while (npending > 0)
+	R_PreserveObject(pending[--npending]);
+}
+
+/* statistics of the innermost closure that is currently executing */
+static closure_stats_t *current_stats(void) {
+    RCNTXT *c;
+
+    for (c = R_GlobalContext; c != NULL; c = c->nextcontext) {
+	if ((c->callflag & CTXT_FUNCTION) && TYPEOF(c->callfun) == CLOSXP)
+	    break;
+	if (c->callflag == CTXT_TOPLEVEL)
+	    return &stats[TOPLEVEL];
+    }
+
+    if (c == NULL)
+	return &stats[TOPLEVEL];
+
+    if (c != cache_ctx || c->callfun != cache_fun) {
+	closure_slot_t *slot = lookup(BODY_EXPR(c->callfun), NULL);
+
+	if (slot == NULL)
+	    return &stats[TOPLEVEL];
+
+	cache_ctx = c;
+	cache_fun = c->callfun;
+	cache_idx = slot->idx;
+    }
+
+    return &stats[cache_idx];
+}
+
+
+/*
+ * counting functions, only called if traceR_closure_stats_active is set
+ */
+
+void traceR_closure_call(SEXP call, SEXP op) {
+    closure_slot_t *slot = lookup(BODY_EXPR(op), NULL);
+
+    if (slot == NULL)
+	return;
+
+    closure_stats_t *entry = &stats[slot->idx];
+
+    preserve_pending();
+    if (entry->name == NULL)
+	describe(entry, call, op);
+
+    entry->calls++;
+    entry->by_position += trcR_by_position;
+    entry->by_keyword  += trcR_by_keyword;
+    entry->by_dots     += trcR_by_dots;
+}
+
+/* the JIT replaced the body of a closure, keep counting in the same entry */
+void traceR_closure_compiled(SEXP oldbody, SEXP newbody) {
+    closure_slot_t *slot = lookup(oldbody, NULL);
+
+    if (slot != NULL) {
+	unsigned int idx = slot->idx;
+	lookup(newbody, &idx);
+	preserve_pending();
+    }
+}
+
+void traceR_closure_vector_alloc(traceR_vector_class_t type, size_t elements,
+				 size_t size, size_t asize) {
+    closure_stats_t *entry = current_stats();
+    vec_alloc_stats_t *stat = &entry->vectors[type];
+
+    stat->allocs++;
+    stat->elements += elements;
+    stat->size     += size;
+    stat->asize    += asize;
+
+    stat = &entry->vectors[TR_VECCLASS_TOTAL];
+    stat->allocs++;
+    stat->elements += elements;
+    stat->size     += size;
+    stat->asize    += asize;
+}
+
+void traceR_closure_promise(void) {
+    current_stats()->promises++;
+}
+
+void traceR_closure_duplicate(unsigned long elements) {
+    current_stats()->dup_elts += elements;
+}
+
+
+/*
+ * output
+ */
+
+static int compare_entries(const void *a, const void *b) {
+    const closure_stats_t *ea = &stats[*(const unsigned int *)a];
+    const closure_stats_t *eb = &stats[*(const unsigned int *)b];
+    unsigned long sa = ea->vectors[TR_VECCLASS_TOTAL].asize;
+    unsigned long sb = eb->vectors[TR_VECCLASS_TOTAL].asize;
+
+    if (sa != sb)
+	return sa < sb ? 1 : -1;
+    if (ea->calls != eb->calls)
+	return ea->calls < eb->calls ? 1 : -1;
+    return 0;
+}
+
+void traceR_write_closure_stats(traceout_t *out) {
+    if (!traceR_closure_stats_active)
+	return;
+
+    unsigned int *sorted = malloc(nstats * sizeof(unsigned int));
+    if (sorted == NULL) {
+	trout_row(out, "ClosureStatsFailed", "d", 1);
+	return;
+    }
+
+    unsigned int n = nstats;
+    for (unsigned int i = 0; i < n; i++)
+	sorted[i] = i;
+
+    qsort(sorted, n, sizeof(unsigned int), compare_entries);
+    if (n > (unsigned int)R_TraceClosures)
+	n = R_TraceClosures;
+
+    trout_comment(out, "per-closure statistics, sorted by allocated vector size");
+    trout_row(out, "ClosureCount", "u", nstats - 1);
+    if (stats_failed)
+	trout_row(out, "ClosureStatsFailed", "d", 1);
+
+    char buf[2 * MAX_DNAME];
+
+    trout_label(out, "rank\tname\tsrcref");
+    trout_table(out, "ClosureName", "ClosureNames");
+    for (unsigned int i = 0; i < n; i++) {
+	closure_stats_t *e = &stats[sorted[i]];
+
+	snprintf(buf, sizeof(buf), "%u\t%s\t%s", i + 1,
+		 e->name ? e->name : "<unknown>",
+		 e->srcref ? e->srcref : "-");
+	trout_string(out, "ClosureName", buf);
+    }
+
+    trout_label(out, "rank\tcalls\tby_position\tby_keyword\tby_dots\tpromises\tdup_elements\t"
+		"zero_allocs\tone_allocs\tsmall_allocs\tlarge_allocs\telements\tasize");
+    trout_table(out, "ClosureStats", "ClosureStatistics");
+    for (unsigned int i = 0; i < n; i++) {
+	closure_stats_t *e = &stats[sorted[i]];
+
+	trout_row(out, "ClosureStats", "uLLLLLLLLLLLL", i + 1,
+		  e->calls, e->by_position, e->by_keyword, e->by_dots,
+		  e->promises, e->dup_elts,
+		  e->vectors[TR_VECCLASS_ZERO].allocs,
+		  e->vectors[TR_VECCLASS_ONE].allocs,
+		  e->vectors[TR_VECCLASS_SMALL].allocs,
+		  e->vectors[TR_VECCLASS_LARGE].allocs,
+		  e->vectors[TR_VECCLASS_TOTAL].elements,
+		  e->vectors[TR_VECCLASS_TOTAL].asize);
+    }
+
+    free(sorted);
+}
+
+
+/*
+ * setup
+ */
+
+void traceR_start_closure_stats(void) {
+    unsigned int idx;
+
+    if (R_TraceClosures <= 0 || !new_stats(&idx))
+	return;
+
+    stats[TOPLEVEL].name = strdup("<toplevel>");
+    traceR_closure_stats_active = TRUE;
+}
+
+/* clear all counters, e.g. in a forked child */
+void traceR_reset_closure_stats(void) {
+    for (unsigned int i = 0; i < nstats; i++) {
+	closure_stats_t *e = &stats[i];
+
+	e->calls = e->by_position = e->by_keyword = e->by_dots = 0;
+	e->promises = e->dup_elts = 0;
+	memset(e->vectors, 0, sizeof(e->vectors));
+    }
+
+    stats_failed = FALSE;
+}
@@ -0,0 +1,477 @@
+/*
+ *  r-instrumented : Various measurements for R
+ *  Copyright (C) 2014  TU Dortmund Informatik LS XII
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, a copy is available at
+ *  http://www.r-project.org/Licenses/
+ *
+ *  extcalls.c: calls to native code (--trace-externalcalls, --trace-nativecalls)
+ *
+ *  Native symbols are interned to small integer ids when they are
+ *  resolved, keyed by their address and call type. Calls, their time
+ *  and the argument bytes .C/.Fortran copy are counted per symbol.
+ *
+ *  With the log, every call also appends a fixed-size record to a
+ *  single-producer ring; a writer thread formats and compresses the
+ *  records. If the writer falls behind, the R thread waits for it, so
+ *  no call is lost.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <Defn.h>
+#include <trace.h>
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <zlib.h>
+
+#include "tracer_extcalls.h"
+
+#ifdef TRACE_ZIPPED
+  typedef gzFile TRACEFILE;
+  /* fast compression, the log is large and written while R runs */
+# define LOG_OPEN(file) R_gzopen(file, "wb1")
+
+/* borrow gzio replacement functions from connections.c
+   which includes them from gzio.h */
+gzFile R_gzopen (const char *path, const char *mode);
+int R_gzclose (gzFile file);
+int R_gzwrite (gzFile file, voidpc buf, unsigned len);
+#else
+  typedef FILE  *TRACEFILE;
+# define LOG_OPEN(file) FOPEN(file)
+#endif
+
+#define RING_SIZE     65536  // records, must be a power of 2
+#define WRITE_BUFFER  65536  // bytes formatted before each write
+#define WRITER_SLEEP  10     // ms the writer waits when the ring is empty
+#define STALL_SLEEP   50     // us the R thread waits when the ring is full
+
+typedef struct {
+    void          *fun;
+    int            type;
+    char          *name;       // NULL if only the address is known
+    unsigned long  calls;
+    uint64_t       native_ns;  // completed calls only, with nested calls
+    uint64_t       cpu_ns;     // only with --trace-nativecalls
+    uint64_t       bytes_in;   // copied by .C and .Fortran
+    uint64_t       bytes_out;
+} extsym_t;
+
+/* all symbols, nested calls are only counted once */
+typedef struct {
+    unsigned long  calls;
+    uint64_t       native_ns;
+    uint64_t       cpu_ns;
+    uint64_t       bytes_in;
+    uint64_t       bytes_out;
+} extcall_totals_t;
+
+typedef struct {
+    uint32_t id;
+    int32_t  type;
+    uint64_t start_ns;
+    uint64_t duration_ns;
+} extcall_record_t;
+
+/* symbols, the writer thread reads them with sym_lock held */
+static pthread_mutex_t sym_lock = PTHREAD_MUTEX_INITIALIZER;
+static extsym_t       *syms;
+static unsigned int    nsyms;
+static unsigned int    maxsyms;
+static int            *sym_hash;   // ids + 1, 0 is empty
+static unsigned int    hash_size;  // power of 2
+static int             syms_failed;
+static extcall_totals_t totals;
+
+/* ring, head is only written by the R thread and tail by the writer */
+static extcall_record_t ring[RING_SIZE];
+static uint64_t         ring_head;
+static uint64_t         ring_tail;
+static unsigned long    ring_stalls;
+
+static TRACEFILE        log_fd;
+static struct timespec  origin;
+static pthread_t        writer_thread;
+static int              writer_running;
+static int              writer_stop;
+static char             write_buf[WRITE_BUFFER + 1024 + 128];
+
+/*
+ * symbol table
+ */
+
+static unsigned int hash_fun(void *fun, int type) {
+    uintptr_t h = (uintptr_t)fun >> 3;
+
+    h ^= (uintptr_t)type * 0x9e3779b9U;
+    h *= 0x9e3779b97f4a7c15ULL;
+    return (unsigned int)(h >> 32);
+}
+
+static int rehash(unsigned int newsize) {
+    int *newhash = calloc(newsize, sizeof(int));
+    if (newhash == NULL)
+	return -1;
+
+    for (unsigned int id = 0; id < nsyms; id++) {
+	unsigned int i = hash_fun(syms[id].fun, syms[id].type) & (newsize - 1);
+
+	while (newhash[i])
+	    i = (i + 1) & (newsize - 1);
+	newhash[i] = id + 1;
+    }
+
+    free(sym_hash);
+    sym_hash  = newhash;
+    hash_size = newsize;
+    return 0;
+}
+
+/* id of a symbol, a new one is added if needed; -1 if memory ran out */
+static int intern(int type, void *fun) {
+    unsigned int i;
+
+    if (hash_size) {
+	i = hash_fun(fun, type) & (hash_size - 1);
+	while (sym_hash[i]) {
+	    extsym_t *s = &syms[sym_hash[i] - 1];
+
+	    if (s->fun == fun && s->type == type)
+		return sym_hash[i] - 1;
+	    i = (i + 1) & (hash_size - 1);
+	}
+    }
+
+    /* new symbol, keep the hash table at most half full */
+    pthread_mutex_lock(&sym_lock);
+    if (nsyms >= maxsyms) {
+	unsigned int newmax = maxsyms ? 2 * maxsyms : 256;
+	extsym_t *newsyms = realloc(syms, newmax * sizeof(extsym_t));
+
+	if (newsyms == NULL) {
+	    syms_failed = 1;
+	    pthread_mutex_unlock(&sym_lock);
+	    return -1;
+	}
+	syms    = newsyms;
+	maxsyms = newmax;
+    }
+    if (2 * (nsyms + 1) > hash_size && rehash(hash_size ? 2 * hash_size : 512)) {
+	syms_failed = 1;
+	pthread_mutex_unlock(&sym_lock);
+	return -1;
+    }
+
+    int id = nsyms++;
+    memset(&syms[id], 0, sizeof(extsym_t));
+    syms[id].fun  = fun;
+    syms[id].type = type;
+    pthread_mutex_unlock(&sym_lock);
+
+    i = hash_fun(fun, type) & (hash_size - 1);
+    while (sym_hash[i])
+	i = (i + 1) & (hash_size - 1);
+    sym_hash[i] = id + 1;
+    return id;
+}
+
+/* called when a native routine is resolved, names its symbol */
+void traceR_extcall_name_int(int type, const char *funcname, void *fun) {
+    int id = intern(type, fun);
+
+    if (id < 0 || syms[id].name || funcname == NULL || funcname[0] == 0)
+	return;
+
+    char *name = strdup(funcname);
+    pthread_mutex_lock(&sym_lock);
+    syms[id].name = name;
+    pthread_mutex_unlock(&sym_lock);
+}
+
+/*
+ * writer
+ */
+
+static uint64_t now_ns(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)(now.tv_sec - origin.tv_sec) * 1000000000ULL +
+	now.tv_nsec - origin.tv_nsec;
+}
+
+static size_t format_record(char *buf, const extcall_record_t *rec) {
+    const extsym_t *s = &syms[rec->id];
+
+    if (s->name)
+	return snprintf(buf, 1024 + 128, "%d %s %p %" PRIu64 " %" PRIu64 "\n", rec->type,
+		       s->name, s->fun, rec->start_ns, rec->duration_ns);
+
+    /* function name is not available */
+    return sprintf(buf, "%d @%p %p %" PRIu64 " %" PRIu64 "\n", rec->type,
+		   s->fun, s->fun, rec->start_ns, rec->duration_ns);
+}
+
+/* write all records in the ring, returns their number */
+static uint64_t drain(void) {
+    uint64_t head = __atomic_load_n(&ring_head, __ATOMIC_ACQUIRE);
+    uint64_t tail = ring_tail;
+    size_t used = 0;
+
+    if (head == tail)
+	return 0;
+
+    pthread_mutex_lock(&sym_lock);
+    for (uint64_t i = tail; i < head; i++) {
+	used += format_record(write_buf + used, &ring[i & (RING_SIZE - 1)]);
+
+	if (used >= WRITE_BUFFER) {
+	    WRITE_FUN(log_fd, write_buf, used);
+	    used = 0;
+	    __atomic_store_n(&ring_tail, i + 1, __ATOMIC_RELEASE);
+	}
+    }
+    pthread_mutex_unlock(&sym_lock);
+
+    if (used)
+	WRITE_FUN(log_fd, write_buf, used);
+    __atomic_store_n(&ring_tail, head, __ATOMIC_RELEASE);
+    return head - tail;
+}
+
+/* process CPU time, so threads started by the native code count as well */
+static uint64_t cpu_ns(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static void *writer_loop(void *arg) {
+    const struct timespec pause = { 0, WRITER_SLEEP * 1000000L };
+    (void) arg;
+
+    while (!__atomic_load_n(&writer_stop, __ATOMIC_ACQUIRE))
+	if (drain() < RING_SIZE / 4)
+	    nanosleep(&pause, NULL);
+
+    drain();
+    return NULL;
+}
+
+static void push_record(const extcall_record_t *rec) {
+    const struct timespec pause = { 0, STALL_SLEEP * 1000L };
+    uint64_t head = ring_head;
+
+    while (head - __atomic_load_n(&ring_tail, __ATOMIC_ACQUIRE) >= RING_SIZE) {
+	ring_stalls++;
+	if (writer_running)
+	    nanosleep(&pause, NULL);
+	else
+	    drain();
+    }
+
+    ring[head & (RING_SIZE - 1)] = *rec;
+    __atomic_store_n(&ring_head, head + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * hooks around native calls, only called if traceR_extcalls_active is set
+ *
+ * A call that is left by an R error never ends; it is counted, but its
+ * time is not. Nested calls (native code calling R calling native code)
+ * add their time to their own symbol, but only once to the totals: a
+ * call only adds the part of its time that the calls completed while
+ * it ran did not add already.
+ */
+
+/* the part of a call's time that is not in the totals yet */
+static uint64_t outer_part(uint64_t own, uint64_t total, uint64_t at_begin) {
+    /* the totals were reset in a child forked during the call */
+    uint64_t inner = total >= at_begin ? total - at_begin : total;
+
+    return own > inner ? own - inner : 0;
+}
+
+void traceR_extcall_begin_int(traceR_extcall_t *call, int type, void *fun) {
+    int id = intern(type, fun);
+
+    if (id < 0)
+	return;
+
+    syms[id].calls++;
+    totals.calls++;
+    call->id            = id;
+    call->nested_ns     = totals.native_ns;
+    call->nested_cpu_ns = totals.cpu_ns;
+    call->start_cpu_ns  = R_TraceNativeCalls ? cpu_ns() : 0;
+    call->start_ns      = now_ns();
+}
+
+void traceR_extcall_end_int(traceR_extcall_t *call) {
+    uint64_t end = now_ns();
+    uint64_t wall = end - call->start_ns;
+    extsym_t *s = &syms[call->id];
+
+    s->native_ns += wall;
+    totals.native_ns += outer_part(wall, totals.native_ns, call->nested_ns);
+    if (R_TraceNativeCalls) {
+	/* a forked child starts with a CPU time of 0 */
+	uint64_t now = cpu_ns();
+	uint64_t cpu = now > (uint64_t)call->start_cpu_ns ? now - call->start_cpu_ns : 0;
+
+	s->cpu_ns += cpu;
+	totals.cpu_ns += outer_part(cpu, totals.cpu_ns, call->nested_cpu_ns);
+    }
+
+    if (log_fd) {
+	extcall_record_t rec;
+
+	rec.id          = call->id;
+	rec.type        = s->type;
+	rec.start_ns    = call->start_ns;
+	rec.duration_ns = wall;
+	push_record(&rec);
+    }
+}
+
+void traceR_extcall_copied_int(traceR_extcall_t *call, size_t bytes_in, size_t bytes_out) {
+    extsym_t *s = &syms[call->id];
+
+    s->bytes_in       += bytes_in;
+    s->bytes_out      += bytes_out;
+    totals.bytes_in   += bytes_in;
+    totals.bytes_out  += bytes_out;
+}
+
+/*
+ * setup
+ */
+
+static int open_log(const char *path) {
+    if (path == NULL)
+	return 0;
+
+    log_fd = LOG_OPEN(path);
+    if (log_fd == NULL)
+	return -1;
+
+    ring_head = ring_tail = 0;
+    writer_stop = 0;
+    if (pthread_create(&writer_thread, NULL, writer_loop, NULL) == 0)
+	writer_running = 1;
+    return 0;
+}
+
+/* start counting, path is the log or NULL for the statistics only */
+int extcalls_open(const char *path) {
+    clock_gettime(CLOCK_MONOTONIC, &origin);
+    traceR_extcalls_active = TRUE;
+    return open_log(path);
+}
+
+void extcalls_close(void) {
+    if (log_fd == NULL)
+	return;
+
+    if (writer_running) {
+	__atomic_store_n(&writer_stop, 1, __ATOMIC_RELEASE);
+	pthread_join(writer_thread, NULL);
+	writer_running = 0;
+    }
+    drain();
+    FCLOSE(log_fd);
+    log_fd = NULL;
+}
+
+/*
+ * Called in a freshly forked child: the writer thread did not survive
+ * the fork, and the inherited log and the records not yet written
+ * belong to the parent. The log is dropped without closing it, that
+ * would flush the parent's buffer. Symbol ids and the time origin are
+ * kept, so the logs of all processes line up.
+ */
+int extcalls_fork(const char *path) {
+    pthread_mutex_init(&sym_lock, NULL);
+    log_fd         = NULL;
+    writer_running = 0;
+    ring_stalls    = 0;
+    for (unsigned int i = 0; i < nsyms; i++) {
+	syms[i].calls     = 0;
+	syms[i].native_ns = 0;
+	syms[i].cpu_ns    = 0;
+	syms[i].bytes_in  = 0;
+	syms[i].bytes_out = 0;
+    }
+    memset(&totals, 0, sizeof(totals));
+    return open_log(path);
+}
+
+void extcalls_write(traceout_t *out) {
+    unsigned int called = 0;
+    char buf[1024 + 64];  // MaxSymbolBytes in dotcode.c
+
+    for (unsigned int i = 0; i < nsyms; i++)
+	if (syms[i].calls)
+	    called++;
+
+    trout_label(out, "symbols\tcalled\tcalls_logged");
+    trout_row(out, "ExternalCallSymbols", "uuL", nsyms, called,
+	      (unsigned long)ring_head);
+    trout_label(out, "calls\tnative_usec\tcpu_usec\tbytes_in\tbytes_out");
+    trout_row(out, "ExternalCallTotal", "LLLLL", totals.calls,
+	      (unsigned long)(totals.native_ns / 1000),
+	      (unsigned long)(totals.cpu_ns / 1000),
+	      (unsigned long)totals.bytes_in, (unsigned long)totals.bytes_out);
+    if (ring_stalls)
+	trout_row(out, "ExternalCallStalls", "L", ring_stalls);
+    if (syms_failed)
+	trout_row(out, "ExternalCallsFailed", "d", 1);
+
+    trout_label(out, "id\ttype\tname\taddress");
+    trout_table(out, "ExternalCallName", "ExternalCallNames");
+    for (unsigned int i = 0; i < nsyms; i++) {
+	extsym_t *s = &syms[i];
+
+	if (s->calls == 0)
+	    continue;
+	if (s->name)
+	    snprintf(buf, sizeof(buf), "%u\t%d\t%s\t%p", i, s->type, s->name, s->fun);
+	else
+	    snprintf(buf, sizeof(buf), "%u\t%d\t@%p\t%p", i, s->type, s->fun, s->fun);
+	trout_string(out, "ExternalCallName", buf);
+    }
+
+    trout_label(out, "id\tcalls\tnative_usec\tcpu_usec\tbytes_in\tbytes_out");
+    trout_table(out, "ExternalCallStats", "ExternalCallStatistics");
+    for (unsigned int i = 0; i < nsyms; i++) {
+	extsym_t *s = &syms[i];
+
+	if (s->calls == 0)
+	    continue;
+	trout_row(out, "ExternalCallStats", "uLLLLL", i, s->calls,
+		  (unsigned long)(s->native_ns / 1000),
+		  (unsigned long)(s->cpu_ns / 1000),
+		  (unsigned long)s->bytes_in, (unsigned long)s->bytes_out);
+    }
+}
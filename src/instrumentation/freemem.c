@@ -1,148 +1,263 @@
-#include <sys/time.h>
-#include <sys/types.h>
-#include <sys/wait.h>
-#include <signal.h>
+/*
+ * freemem.c: memory usage over time
+ *
+ * A sampler thread records the free memory of the system, the resident
+ * and proportional set size of this process and the size of the R heap
+ * in one time series. The samples are kept at full resolution; only the
+ * output may combine neighbouring samples (see freemem_write).
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <Defn.h>
+
+#include <errno.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
-#include <string.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include "tracer_freemem.h"
 
-//#define FREEMEM_SLOTS 86400  // enough for one day at one-second resolution
-#define FREEMEM_SLOTS 3600    // reduced default resolution because the plot takes too long
+typedef struct {
+  uint32_t time_ms;     // since the sampler was started
+  int64_t  free_kb;     // -1 if not available
+  int64_t  avail_kb;
+  int64_t  rss_kb;
+  int64_t  pss_kb;
+  uint64_t heap_nodes;  // bytes
+  uint64_t heap_vectors;
+} freemem_sample_t;
+
+static pthread_t sampler_thread;
+static int sampler_running;
+static int sampler_stop;
+static pthread_mutex_t sample_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  stop_cond;
 
-static pid_t child_pid;
-static volatile int terminate_query;
-static struct sigaction usr1_act;
+static struct timespec origin;
+static freemem_sample_t *samples;
+static size_t sample_count;
+static size_t sample_max;
+static int sample_failed;
 
-static uint64_t freemem_values[FREEMEM_SLOTS];
-static unsigned int slot_quantum = 1;
-static unsigned int current_slot;
+/* "Key:   value kB" lines as in /proc/meminfo and smaps_rollup */
+static int64_t parse_kb(const char *line, const char *key) {
+  size_t len = strlen(key);
 
-static void usr1_handler(int signal) {
-  terminate_query = 1;
+  if (strncmp(line, key, len) || line[len] != ':')
+    return -1;
+  return strtoll(line + len + 1, NULL, 10);
 }
 
-static int64_t query_freemem(void) {
+static void query_meminfo(freemem_sample_t *s) {
   FILE *fd = fopen("/proc/meminfo", "r");
-  char buf[1024];
-  int64_t result = -1;
+  char buf[256];
+  int64_t v;
 
+  s->free_kb = s->avail_kb = -1;
   if (fd == NULL)
-    return -1;
-
-  /* MemTotal:       11989664 kB */
-  if (fgets(buf, sizeof(buf), fd) == NULL)
-    goto out;
+    return;
 
-  /* MemFree:         4549212 kB */
-  if (fscanf(fd, "MemFree: %ld", &result) <= 0)
-    result = -1;
+  while (fgets(buf, sizeof(buf), fd) && (s->free_kb < 0 || s->avail_kb < 0)) {
+    if ((v = parse_kb(buf, "MemFree")) >= 0)
+      s->free_kb = v;
+    else if ((v = parse_kb(buf, "MemAvailable")) >= 0)
+      s->avail_kb = v;
+  }
 
- out:
   fclose(fd);
-  return result;
 }
 
-static void kill_child(void) {
-  if (child_pid) {
-    kill(child_pid, SIGKILL);
-  }
-}
+static void query_process(freemem_sample_t *s) {
+  FILE *fd = fopen("/proc/self/smaps_rollup", "r");
+  char buf[256];
+  int64_t v;
 
-void freemem_spawn(const char *statsfile) {
-  pid_t p = fork();
+  s->rss_kb = s->pss_kb = -1;
 
-  if (p != 0) {
-    child_pid = p;
-    atexit(kill_child);
+  if (fd) {
+    while (fgets(buf, sizeof(buf), fd) && (s->rss_kb < 0 || s->pss_kb < 0)) {
+      if ((v = parse_kb(buf, "Rss")) >= 0)
+        s->rss_kb = v;
+      else if ((v = parse_kb(buf, "Pss")) >= 0)
+        s->pss_kb = v;
+    }
+    fclose(fd);
     return;
   }
 
-  /* install signal handler */
-  usr1_act.sa_handler = usr1_handler;
-  usr1_act.sa_flags   = SA_RESETHAND;
-  sigaction(SIGUSR1, &usr1_act, NULL);
+  /* kernels before 4.14 have no smaps_rollup, statm still has the RSS */
+  fd = fopen("/proc/self/statm", "r");
+  if (fd) {
+    long size, resident;
+
+    if (fscanf(fd, "%ld %ld", &size, &resident) == 2)
+      s->rss_kb = resident * (sysconf(_SC_PAGESIZE) / 1024);
+    fclose(fd);
+  }
+}
+
+static void take_sample(void) {
+  freemem_sample_t s;
+  struct timespec now;
+  size_t smallv, largev, nodes;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  s.time_ms = (now.tv_sec - origin.tv_sec) * 1000 +
+    (now.tv_nsec - origin.tv_nsec) / 1000000;
 
-  /* start measurement loop */
-  struct timeval next_query, cur_query;
-  gettimeofday(&next_query, NULL);
+  query_meminfo(&s);
+  query_process(&s);
 
-  while (!terminate_query) {
-    /* wait until next_query has arrived or passed */
-    while (1) {
-      struct timeval diff;
-      gettimeofday(&cur_query, NULL);
+  /* read without synchronisation, a sample may be slightly off during a GC */
+  get_current_mem(&smallv, &largev, &nodes);
+  s.heap_nodes   = nodes;
+  s.heap_vectors = (smallv + largev) * sizeof(VECREC);
 
-      if (timercmp(&cur_query, &next_query, >=))
-        break;
+  pthread_mutex_lock(&sample_lock);
+  if (sample_count >= sample_max) {
+    size_t newmax = sample_max ? 2 * sample_max : 1024;
+    freemem_sample_t *newsamples = realloc(samples, newmax * sizeof(freemem_sample_t));
 
-      timersub(&next_query, &cur_query, &diff);
-      usleep(diff.tv_usec);
+    if (newsamples == NULL) {
+      sample_failed = 1;
+      pthread_mutex_unlock(&sample_lock);
+      return;
     }
+    samples    = newsamples;
+    sample_max = newmax;
+  }
+  samples[sample_count++] = s;
+  pthread_mutex_unlock(&sample_lock);
+}
+
+static void *sampler_loop(void *arg) {
+  struct timespec next = origin;
+  (void) arg;
 
-    /* do the query */
-    int64_t res = query_freemem();
-    if (res >= 0)
-      freemem_values[current_slot] = res;
-
-    current_slot++;
-    if (current_slot > FREEMEM_SLOTS) {
-      /* overflow, reduce resolution by half */
-      for (unsigned int i=0; i < FREEMEM_SLOTS/2; i++) {
-        if (freemem_values[2*i] < freemem_values[2*i+1]) {
-          freemem_values[i] = freemem_values[2*i];
-        } else {
-          freemem_values[i] = freemem_values[2*i+1];
-        }
-      }
-
-      slot_quantum *= 2;
-      current_slot /= 2;
+  pthread_mutex_lock(&sample_lock);
+  while (!sampler_stop) {
+    pthread_mutex_unlock(&sample_lock);
+    take_sample();
+    pthread_mutex_lock(&sample_lock);
+
+    /* fixed schedule, a slow query does not shift later samples */
+    next.tv_sec  += R_TraceMemInterval / 1000;
+    next.tv_nsec += (R_TraceMemInterval % 1000) * 1000000L;
+    if (next.tv_nsec >= 1000000000L) {
+      next.tv_sec++;
+      next.tv_nsec -= 1000000000L;
     }
 
-    // FIXME: Handle the case where query_memory needs more than one quantum
-    next_query.tv_sec += slot_quantum;
+    while (!sampler_stop &&
+           pthread_cond_timedwait(&stop_cond, &sample_lock, &next) != ETIMEDOUT)
+      ;
   }
+  pthread_mutex_unlock(&sample_lock);
 
-  FILE *fd = fopen(statsfile, "w");
-  if (!fd) {
-    perror("freequery fopen");
-    exit(99);
-  }
+  /* the final state of the run */
+  take_sample();
+  return NULL;
+}
 
-  fprintf(fd, "freeslots\t%u\n", current_slot);
-  fprintf(fd, "FreememQuantum\t%u\n", slot_quantum);
-  fprintf(fd, "#!LABEL\ttime\tmemory\n");
-  fprintf(fd, "#!TABLE\tfreeslot\tFreeMemoryOverTime\n");
+void freemem_start(void) {
+  pthread_condattr_t attr;
 
-  uint64_t minvalue = UINT64_MAX;
+  if (sampler_running || R_TraceMemInterval <= 0)
+    return;
 
-  for (unsigned int i = 0; i < current_slot; i++) {
-    fprintf(fd, "freeslot\t%u\t%lu\n", i, freemem_values[i]);
-    if (freemem_values[i] < minvalue)
-      minvalue = freemem_values[i];
-  }
-  fprintf(fd, "minfree\t%ld\n", minvalue);
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&stop_cond, &attr);
+  pthread_condattr_destroy(&attr);
 
-  fclose(fd);
+  clock_gettime(CLOCK_MONOTONIC, &origin);
+  sampler_stop = 0;
+  if (pthread_create(&sampler_thread, NULL, sampler_loop, NULL) == 0)
+    sampler_running = 1;
+}
+
+void freemem_stop(void) {
+  if (!sampler_running)
+    return;
+
+  pthread_mutex_lock(&sample_lock);
+  sampler_stop = 1;
+  pthread_cond_signal(&stop_cond);
+  pthread_mutex_unlock(&sample_lock);
 
-  exit(0);
+  pthread_join(sampler_thread, NULL);
+  sampler_running = 0;
 }
 
+/* called in a freshly forked child: the sampler thread did not survive the fork */
+void freemem_fork(void) {
+  pthread_mutex_init(&sample_lock, NULL);
+  sampler_running = 0;
+  sample_count    = 0;
+  sample_failed   = 0;
+  freemem_start();
+}
 
-void freemem_stop(void) {
-  if (child_pid) {
-    kill(child_pid, SIGUSR1);
-    while (!waitpid(child_pid, NULL, WNOHANG)) {
-      usleep(10000);
+static int64_t min_known(int64_t a, int64_t b) {
+  return a < 0 ? b : b < 0 ? a : a < b ? a : b;
+}
+
+static int64_t max_known(int64_t a, int64_t b) {
+  return a > b ? a : b;
+}
+
+/*
+ * Write the time series. If there are more than max_rows samples,
+ * each row combines several of them: the lowest free memory and the
+ * highest process and heap sizes are kept.
+ */
+void freemem_write(traceout_t *out, int final, unsigned int max_rows) {
+  if (final)
+    freemem_stop();
+
+  pthread_mutex_lock(&sample_lock);
+
+  size_t group = 1;
+  if (max_rows && sample_count > max_rows)
+    group = (sample_count + max_rows - 1) / max_rows;
+
+  int64_t minfree = -1;
+  for (size_t i = 0; i < sample_count; i++)
+    minfree = min_known(minfree, samples[i].free_kb);
+
+  trout_row(out, "MemInterval", "l", (long)R_TraceMemInterval);
+  trout_row(out, "MemSamples", "z", sample_count);
+  trout_row(out, "MemSampleGroup", "z", group);
+  if (sample_failed)
+    trout_row(out, "MemSamplesFailed", "d", 1);
+  trout_row(out, "minfree", "l", (long)minfree);
+
+  trout_label(out, "time_ms\tfree_kb\tavailable_kb\trss_kb\tpss_kb\theap_node_bytes\theap_vector_bytes");
+  trout_table(out, "MemSample", "MemoryTimeSeries");
+  for (size_t i = 0; i < sample_count; i += group) {
+    freemem_sample_t s = samples[i];
+
+    for (size_t j = i + 1; j < i + group && j < sample_count; j++) {
+      s.free_kb      = min_known(s.free_kb, samples[j].free_kb);
+      s.avail_kb     = min_known(s.avail_kb, samples[j].avail_kb);
+      s.rss_kb       = max_known(s.rss_kb, samples[j].rss_kb);
+      s.pss_kb       = max_known(s.pss_kb, samples[j].pss_kb);
+      if (samples[j].heap_nodes > s.heap_nodes)
+        s.heap_nodes = samples[j].heap_nodes;
+      if (samples[j].heap_vectors > s.heap_vectors)
+        s.heap_vectors = samples[j].heap_vectors;
     }
-    child_pid = 0;
+
+    trout_row(out, "MemSample", "ullllLL", s.time_ms,
+              (long)s.free_kb, (long)s.avail_kb, (long)s.rss_kb, (long)s.pss_kb,
+              (unsigned long)s.heap_nodes, (unsigned long)s.heap_vectors);
   }
-}
 
-void freemem_fork(void) {
-  /* we don't need to measure more than once per machine, but we shouldn't kill the measurement either */
-  child_pid = 0;
+  pthread_mutex_unlock(&sample_lock);
 }
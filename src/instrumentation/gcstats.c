@@ -0,0 +1,214 @@
+/*
+ *  r-instrumented : Various measurements for R
+ *  Copyright (C) 2014  TU Dortmund Informatik LS XII
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, a copy is available at
+ *  http://www.r-project.org/Licenses/
+ *
+ *  gcstats.c: garbage collection pause statistics
+ *
+ *  Every collection is timed with the monotonic clock and counted per
+ *  level (the number of old generations collected), in a log2 pause
+ *  histogram and in a timeline. The timeline has a fixed number of
+ *  entries; when it is full, neighbouring entries are merged so that
+ *  each one covers twice as many collections as before. Merged entries
+ *  keep the longest pause, so tail latencies stay visible.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <Defn.h>
+#include <trace.h>
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "traceout.h"
+
+#define PAUSE_BINS     32
+#define TIMELINE_SIZE  4096  // must be even, keeps checkpoints small
+
+typedef struct {
+    unsigned long collections;
+    uint64_t      pause_ns;
+    uint64_t      max_pause_ns;
+    unsigned long reclaimed;
+    unsigned long large_freed;
+} gc_level_stats_t;
+
+typedef struct {
+    uint64_t      time_ns;      // start of the first collection, since tracing started
+    unsigned int  collections;
+    int           max_level;
+    uint64_t      pause_ns;
+    uint64_t      max_pause_ns;
+    unsigned long reclaimed;
+    unsigned long heap;         // after the last collection
+} gc_event_t;
+
+static struct timespec  origin;
+static gc_level_stats_t levels[TRACER_GC_LEVELS];
+static unsigned long    pause_bins[PAUSE_BINS][TRACER_GC_LEVELS];
+static unsigned int     max_pause_bin;
+
+static gc_event_t       timeline[TIMELINE_SIZE];
+static unsigned int     timeline_used;
+static unsigned int     timeline_quantum = 1;  // collections per entry
+
+static uint64_t elapsed_ns(const struct timespec *from, const struct timespec *to) {
+    return (uint64_t)(to->tv_sec - from->tv_sec) * 1000000000ULL +
+	to->tv_nsec - from->tv_nsec;
+}
+
+static unsigned int pause_bin(uint64_t pause_ns) {
+    uint64_t usec = pause_ns / 1000;
+    unsigned int bin = 0;
+
+    while (usec > 1 && bin < PAUSE_BINS - 1) {
+	usec >>= 1;
+	bin++;
+    }
+    return bin;
+}
+
+static void merge_events(gc_event_t *to, const gc_event_t *from) {
+    to->collections += from->collections;
+    to->pause_ns    += from->pause_ns;
+    to->reclaimed   += from->reclaimed;
+    to->heap         = from->heap;
+    if (from->max_level > to->max_level)
+	to->max_level = from->max_level;
+    if (from->max_pause_ns > to->max_pause_ns)
+	to->max_pause_ns = from->max_pause_ns;
+}
+
+/* halve the timeline resolution */
+static void compact_timeline(void) {
+    for (unsigned int i = 0; i < TIMELINE_SIZE / 2; i++) {
+	timeline[i] = timeline[2 * i];
+	merge_events(&timeline[i], &timeline[2 * i + 1]);
+    }
+
+    memset(&timeline[TIMELINE_SIZE / 2], 0, TIMELINE_SIZE / 2 * sizeof(gc_event_t));
+    timeline_used = TIMELINE_SIZE / 2;
+    timeline_quantum *= 2;
+}
+
+void traceR_count_gc(int level, const struct timespec *start,
+		     size_t used_before, size_t used_after, size_t large_freed) {
+    struct timespec end;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    uint64_t pause = elapsed_ns(start, &end);
+    unsigned long reclaimed = used_before > used_after ? used_before - used_after : 0;
+
+    if (level < 0 || level >= TRACER_GC_LEVELS)
+	level = TRACER_GC_LEVELS - 1;
+
+    /* per level */
+    gc_level_stats_t *stats = &levels[level];
+    stats->collections++;
+    stats->pause_ns    += pause;
+    stats->reclaimed   += reclaimed;
+    stats->large_freed += large_freed;
+    if (pause > stats->max_pause_ns)
+	stats->max_pause_ns = pause;
+
+    /* histogram */
+    unsigned int bin = pause_bin(pause);
+    pause_bins[bin][level]++;
+    if (bin > max_pause_bin)
+	max_pause_bin = bin;
+
+    /* timeline */
+    gc_event_t event = {
+	.time_ns      = elapsed_ns(&origin, start),
+	.collections  = 1,
+	.max_level    = level,
+	.pause_ns     = pause,
+	.max_pause_ns = pause,
+	.reclaimed    = reclaimed,
+	.heap         = used_after,
+    };
+
+    if (timeline_used > 0 &&
+	timeline[timeline_used - 1].collections < timeline_quantum) {
+	merge_events(&timeline[timeline_used - 1], &event);
+	return;
+    }
+
+    if (timeline_used == TIMELINE_SIZE) {
+	compact_timeline();
+	if (timeline[timeline_used - 1].collections < timeline_quantum) {
+	    merge_events(&timeline[timeline_used - 1], &event);
+	    return;
+	}
+    }
+
+    timeline[timeline_used++] = event;
+}
+
+void traceR_write_gcstats(traceout_t *out) {
+    trout_label(out, "level\tcollections\tpause_usec\tmax_pause_usec\treclaimed_bytes\tlarge_freed_bytes");
+    trout_table(out, "GCLevel", "GCLevelStatistics");
+    for (int i = 0; i < TRACER_GC_LEVELS; i++) {
+	gc_level_stats_t *stats = &levels[i];
+
+	trout_row(out, "GCLevel", "dLLLLL", i, stats->collections,
+		  (unsigned long)(stats->pause_ns / 1000),
+		  (unsigned long)(stats->max_pause_ns / 1000),
+		  stats->reclaimed, stats->large_freed);
+    }
+
+    trout_label(out, "bin\tlower_usec\tupper_usec\tlevel0\tlevel1\tlevel2");
+    trout_table(out, "GCPauseBin", "GCPauseHistogram");
+    for (unsigned int i = 0; i <= max_pause_bin; i++) {
+	trout_row(out, "GCPauseBin", "uLLLLL", i,
+		  i == 0 ? 0UL : 1UL << i,
+		  (2UL << i) - 1,
+		  pause_bins[i][0], pause_bins[i][1], pause_bins[i][2]);
+    }
+
+    trout_row(out, "GCTimelineQuantum", "u", timeline_quantum);
+    trout_label(out, "time_usec\tcollections\tmax_level\tpause_usec\tmax_pause_usec\treclaimed_bytes\theap_bytes");
+    trout_table(out, "GCEvent", "GCTimeline");
+    for (unsigned int i = 0; i < timeline_used; i++) {
+	gc_event_t *event = &timeline[i];
+
+	trout_row(out, "GCEvent", "LudLLLL",
+		  (unsigned long)(event->time_ns / 1000),
+		  event->collections, event->max_level,
+		  (unsigned long)(event->pause_ns / 1000),
+		  (unsigned long)(event->max_pause_ns / 1000),
+		  event->reclaimed, event->heap);
+    }
+}
+
+void traceR_start_gcstats(void) {
+    clock_gettime(CLOCK_MONOTONIC, &origin);
+}
+
+/* clear all statistics, e.g. in a forked child */
+void traceR_reset_gcstats(void) {
+    memset(levels, 0, sizeof(levels));
+    memset(pause_bins, 0, sizeof(pause_bins));
+    memset(timeline, 0, sizeof(timeline));
+    max_pause_bin    = 0;
+    timeline_used    = 0;
+    timeline_quantum = 1;
+}
@@ -24,6 +24,7 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <dlfcn.h>
+#include <pthread.h>
 #include <limits.h>
 #include <malloc.h>
 #include <stdbool.h>
@@ -43,38 +44,100 @@ unsigned int mallocmeasure_quantum = 1;
 size_t mallocmeasure_values[1];
 size_t mallocmeasure_current_slot = 0; // if this is 0, the output is omitted
 
+void mallocmeasure_start(void) {}
 void mallocmeasure_finalize(void) {}
 void mallocmeasure_reset(void) {}
 void mallocmeasure_kill(void) {}
+void mallocmeasure_count_mapped(long bytes) { (void) bytes; }
 
 #else
 
 //#define PEAKSLOTS 86400  // enough for one day at one-second resolution
 #define PEAKSLOTS 3600    // reduced default resolution because the plot takes too long
 
+/* number of per-thread counter shards, threads beyond this share one */
+#define MM_SHARDS 64
+
+/* interval of the sampler thread that looks for the peak allocation */
+#define MM_SAMPLE_USEC 10000
+
+/*
+ * Every thread that allocates memory gets its own counter shard. A shard
+ * is only ever written by its owning thread, so the hooks can update it
+ * with a plain (relaxed) load/store pair instead of a locked instruction.
+ * The sampler thread sums all shards without taking any lock. Memory
+ * allocated by one thread and freed by another makes individual shards
+ * negative, which is why the counters are signed.
+ */
+typedef struct {
+  long bytes;
+  char pad[64 - sizeof(long)];
+} mm_shard_t;
+
+static mm_shard_t shards[MM_SHARDS];
+static mm_shard_t overflow_shard;  // shared by all threads past MM_SHARDS
+static unsigned int shards_used;
+static __thread mm_shard_t *my_shard
+  __attribute__((tls_model("initial-exec")));
+
 static void *(*real_calloc)(size_t nmemb, size_t size);
 static void *(*real_malloc)(size_t size);
 static void *(*real_realloc)(void *ptr, size_t size);
 static void (*real_free)(void *ptr);
-static bool stop_measurements = false;
 static volatile bool in_init  = false;
 static char init_mem[1024];
 static char *cur_init = init_mem;
-static size_t current_alloc = 0;
 
+/* sampler state, only touched by the sampler thread while it runs */
+static pthread_t sampler_thread;
+static bool sampler_running = false;
+static volatile bool sampler_stop = false;
+static volatile bool stop_measurements = false;
 static size_t current_peak;
 static struct timespec peak_slot_starttime;
+
 unsigned int mallocmeasure_quantum = 1;
 size_t mallocmeasure_values[PEAKSLOTS + 1];
 size_t mallocmeasure_current_slot;
 
-static void update_memstats(void) {
-  if (stop_measurements)
-    return;
+static mm_shard_t *claim_shard(void) {
+  unsigned int idx = __atomic_fetch_add(&shards_used, 1, __ATOMIC_RELAXED);
+
+  my_shard = idx < MM_SHARDS ? &shards[idx] : &overflow_shard;
+  return my_shard;
+}
+
+static inline void count_alloc(long delta) {
+  mm_shard_t *s = my_shard;
+
+  if (s == NULL)
+    s = claim_shard();
 
+  if (s != &overflow_shard)
+    __atomic_store_n(&s->bytes, __atomic_load_n(&s->bytes, __ATOMIC_RELAXED) + delta,
+                     __ATOMIC_RELAXED);
+  else
+    __atomic_fetch_add(&s->bytes, delta, __ATOMIC_RELAXED);
+}
+
+static size_t current_alloc(void) {
+  unsigned int used = __atomic_load_n(&shards_used, __ATOMIC_RELAXED);
+  long sum = __atomic_load_n(&overflow_shard.bytes, __ATOMIC_RELAXED);
+
+  if (used > MM_SHARDS)
+    used = MM_SHARDS;
+
+  for (unsigned int i = 0; i < used; i++)
+    sum += __atomic_load_n(&shards[i].bytes, __ATOMIC_RELAXED);
+
+  return sum > 0 ? (size_t)sum : 0;
+}
+
+/* sample the current allocation and close slots whose time has passed */
+static void update_memstats(void) {
   /* check if more than mallocmeasure_quantum seconds have elapsed */
   struct timespec now, diff;
-  clock_gettime(CLOCK_REALTIME_COARSE, &now);
+  clock_gettime(CLOCK_MONOTONIC, &now);
 
   if (now.tv_nsec < peak_slot_starttime.tv_nsec) {
     diff.tv_sec  = now.tv_sec - peak_slot_starttime.tv_sec - 1;
@@ -110,22 +173,75 @@ static void update_memstats(void) {
     current_peak = 0;
   }
 
-  if (current_peak < current_alloc)
-    current_peak = current_alloc;
+  size_t cur = current_alloc();
+  if (current_peak < cur)
+    current_peak = cur;
+}
+
+static void *sampler_loop(void *arg) {
+  (void) arg;
+
+  while (!sampler_stop) {
+    if (!stop_measurements)
+      update_memstats();
+    usleep(MM_SAMPLE_USEC);
+  }
+
+  /* one last sample so short runs still see their final allocation */
+  if (!stop_measurements)
+    update_memstats();
+
+  return NULL;
+}
+
+static void start_sampler(void) {
+  if (sampler_running)
+    return;
+
+  clock_gettime(CLOCK_MONOTONIC, &peak_slot_starttime);
+  current_peak = current_alloc();
+  sampler_stop = false;
+
+  if (pthread_create(&sampler_thread, NULL, sampler_loop, NULL) == 0)
+    sampler_running = true;
+}
+
+static void stop_sampler(void) {
+  if (!sampler_running)
+    return;
+
+  sampler_stop = true;
+  pthread_join(sampler_thread, NULL);
+  sampler_running = false;
+}
+
+void mallocmeasure_start(void) {
+  start_sampler();
 }
 
 void mallocmeasure_kill(void) {
   stop_measurements = true;
 }
 
+/* memory the allocator maps itself, which the hooks do not see */
+void mallocmeasure_count_mapped(long bytes) {
+  count_alloc(bytes);
+}
+
+/* called in a freshly forked child: the sampler thread did not survive the fork */
 void mallocmeasure_reset(void) {
+  sampler_running = false;
   mallocmeasure_current_slot = 0;
+  mallocmeasure_quantum = 1;
+  start_sampler();
 }
 
 void mallocmeasure_finalize(void) {
+  stop_sampler();
+
   /* write the final memory peak into the list */
   mallocmeasure_values[mallocmeasure_current_slot++] = current_peak;
-}  
+}
 
 static void init_hooks(void) {
   in_init = true;
@@ -136,8 +252,6 @@ static void init_hooks(void) {
   real_free    = dlsym(RTLD_NEXT, "free");
 
   in_init = false;
-
-  clock_gettime(CLOCK_REALTIME_COARSE, &peak_slot_starttime);
 }
 
 /* --- hooks --- */
@@ -158,10 +272,8 @@ void *calloc(size_t nmemb, size_t size) {
 
   void *result = real_calloc(nmemb, size);
 
-  if (result != NULL) {
-    current_alloc += malloc_usable_size(result);
-    update_memstats();
-  }
+  if (result != NULL)
+    count_alloc(malloc_usable_size(result));
 
   return result;
 }
@@ -171,10 +283,8 @@ void *malloc(size_t size) {
     init_hooks();
 
   void *result = real_malloc(size);
-  if (result != NULL) {
-    current_alloc += malloc_usable_size(result);
-    update_memstats();
-  }
+  if (result != NULL)
+    count_alloc(malloc_usable_size(result));
 
   return result;
 }
@@ -183,14 +293,14 @@ void *realloc(void *ptr, size_t size) {
   if (real_realloc == NULL)
     init_hooks();
 
-  size_t tmp = current_alloc - malloc_usable_size(ptr);
+  size_t oldsize = malloc_usable_size(ptr);
 
   void *result = real_realloc(ptr, size);
 
-  if (result != NULL) {
-    current_alloc = tmp + malloc_usable_size(result);
-    update_memstats();
-  }
+  if (result != NULL)
+    count_alloc((long)malloc_usable_size(result) - (long)oldsize);
+  else if (size == 0)
+    count_alloc(-(long)oldsize);  // realloc(ptr, 0) freed the block
 
   return result;
 }
@@ -199,8 +309,8 @@ void free(void *ptr) {
   if (real_free == NULL)
     init_hooks();
 
-  current_alloc -= malloc_usable_size(ptr);
-  update_memstats();
+  if (ptr != NULL)
+    count_alloc(-(long)malloc_usable_size(ptr));
 
   real_free(ptr);
 }
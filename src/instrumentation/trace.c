@@ -27,31 +27,45 @@
 #include <unistd.h>
 #include <errno.h>
 #include <stdarg.h>
-#include <zlib.h>
+#include <signal.h>
 
 #include "mallocmeasure.h"
+#include "tracer_extcalls.h"
 #include "tracer_freemem.h"
-
-#ifdef TRACE_ZIPPED
-  typedef gzFile TRACEFILE;
-#else
-  typedef FILE  *TRACEFILE;
-#endif
+#include "traceout.h"
+#include "traceagg.h"
 
 typedef struct TraceInfo_ {
     char filename[MAX_DNAME];
 
-    TRACEFILE extcalls_fd;
+    char extcalls_name[MAX_DNAME];
+
+    /* binary format: ring file and its writer */
+    tracebin_t *ring;
+    traceout_t *ringout;
 } TraceInfo;
 
 static TraceInfo trace_info;
 
 // fork support
-static char **childfiles;
+typedef struct {
+    char       *name;
+    long        pid;   // 0 if not known
+    tracebin_t *tb;    // opened before merging, NULL for text files
+} childfile_t;
+
+#define CHILD_WAIT_SEC 5
+
+static childfile_t *childfiles;
 static unsigned int childfiles_count;
 static unsigned int childfiles_max;
 static struct timeval start_time_us, end_time_us;
 
+// binary checkpoints
+#define FREEMEM_BINARY_ROWS 8192
+static time_t next_checkpoint;
+static unsigned int checkpoint_seq;
+
 // Trace counters
 extern unsigned long duplicate_object, duplicate_elts, duplicate1_elts;
 
@@ -69,6 +83,43 @@ extern unsigned long duplicate_object, duplicate_elts, duplicate1_elts;
 extern unsigned long allocated_list, allocated_list_elts;
 extern int gc_count;
 
+// closure frames hashed at the call and when growing, see envir.c
+extern unsigned long hashed_frames_call, hashed_frames_grown;
+
+// JIT compilations and cache behaviour, see eval.c
+extern unsigned long jit_compiled, jit_cache_hits, jit_env_mismatch, jit_cache_evictions;
+extern unsigned long jit_cache_size;
+
+// scalar stores of the byte code interpreter, see SETVAR in eval.c
+extern unsigned long bc_scalar_inplace, bc_scalar_copied, bc_scalar_boxed;
+
+// parallel marking in the garbage collector, see memory.c
+extern unsigned long gc_parallel_marks, gc_parallel_mark_nodes;
+extern unsigned long gc_parallel_mark_steals, gc_parallel_mark_busiest;
+
+// bump allocation of small vector nodes, see memory.c
+extern unsigned long bump_alloc_nodes, bump_alloc_new_pages, bump_alloc_reused_pages;
+
+// mapped blocks of large vectors, see memory.c
+extern unsigned long large_blocks_mapped, large_blocks_reused;
+extern unsigned long large_blocks_unmapped, large_blocks_advised;
+
+// function lookup cache of the byte code interpreter, see envir.c
+extern unsigned long fun_cache_hits, fun_cache_misses, fun_cache_uncached;
+
+// aligned vectors of unserialized files, see serialize.c
+extern unsigned long unserialize_mapped_vectors, unserialize_mapped_bytes;
+extern unsigned long unserialize_copied_vectors;
+
+// blocks of multithreaded compressed connections, see connections.c
+extern unsigned long blockz_blocks, blockz_bytes_in, blockz_bytes_out;
+
+// reference hash tables of serialize and save, see serialize.c
+extern unsigned long ptrhash_lookups, ptrhash_probes, ptrhash_collisions;
+
+// blocks read by scan and read.table, see scan.c
+extern unsigned long scan_blocks, scan_block_bytes, scan_run_bytes;
+
 
 /*
  *
@@ -96,8 +147,9 @@ static int           max_hist_args   = -1;
 static Rboolean      argcount_failed = FALSE;
 
 /* update the counters for closure argument histograms */
-void trcR_count_closure_args(SEXP op) {
-    (void) op; // this simple version does not support per-closure counting
+void trcR_count_closure_args(SEXP op, SEXP call) {
+    if (traceR_closure_stats_active)
+	traceR_closure_call(call, op);
 
     int cur_args = trcR_by_position + trcR_by_keyword + trcR_by_dots;
 
@@ -133,18 +185,18 @@ void trcR_count_closure_args(SEXP op) {
 }
 
 /* write argument histogram to trace file */
-static void write_arg_histogram(FILE *fd) {
+static void write_arg_histogram(traceout_t *out) {
     if (argcount_failed) {
-	fprintf(fd, "# argument count histogram calculation failed\n");
-	fprintf(fd, "ArgHistogramFailed\t1\n");
+	trout_comment(out, "argument count histogram calculation failed");
+	trout_row(out, "ArgHistogramFailed", "d", 1);
 	return;
     }
 
-    fprintf(fd, "# argument count histogram\n");
-    fprintf(fd, "#!LABEL\tcount\tcalls\tby_position\tby_keyword\tby_dots\tnpos_calls\tnkey_calls\tndots_calls\n");
-    fprintf(fd, "#!TABLE\tArgCount\tArgumentCounts\n"); // FIXME: Enough parameters?
+    trout_comment(out, "argument count histogram");
+    trout_label(out, "count\tcalls\tby_position\tby_keyword\tby_dots\tnpos_calls\tnkey_calls\tndots_calls");
+    trout_table(out, "ArgCount", "ArgumentCounts"); // FIXME: Enough parameters?
     for (int i = 0; i <= max_hist_args; i++) {
-	fprintf(fd, "ArgCount\t%d\t%u\t%u\t%u\t%u\t%u\t%u\t%u\n", i,
+	trout_row(out, "ArgCount", "duuuuuuu", i,
 		arg_histogram[i].calls,
 		arg_histogram[i].by_position,
 		arg_histogram[i].by_keyword,
@@ -160,14 +212,14 @@ static void write_arg_histogram(FILE *fd) {
  * utility functions
  */
 
-static void add_childfile(char *orig_name) {
+static void add_childfile(char *orig_name, long pid) {
   char *name = strdup(orig_name);
   if (!name)
     abort();
 
   if (childfiles == NULL) {
     childfiles_max = 100;
-    childfiles = malloc(childfiles_max * sizeof(long));
+    childfiles = malloc(childfiles_max * sizeof(childfile_t));
     if (childfiles == NULL) {
       perror("malloc childfiles");
       abort();
@@ -175,7 +227,7 @@ static void add_childfile(char *orig_name) {
   }
 
   if (childfiles_count >= childfiles_max) {
-    char **newfiles = realloc(childfiles, 2*childfiles_max*sizeof(long));
+    childfile_t *newfiles = realloc(childfiles, 2*childfiles_max*sizeof(childfile_t));
     if (newfiles == NULL) {
       perror("realloc childfiles");
       abort();
@@ -184,7 +236,22 @@ static void add_childfile(char *orig_name) {
     childfiles_max *= 2;
   }
 
-  childfiles[childfiles_count++] = name;
+  childfiles[childfiles_count].name = name;
+  childfiles[childfiles_count].pid  = pid;
+  childfiles[childfiles_count].tb   = NULL;
+  childfiles_count++;
+}
+
+static void free_childfiles(void) {
+  for (unsigned int i = 0; i < childfiles_count; i++) {
+    free(childfiles[i].name);
+    if (childfiles[i].tb)
+      tracebin_close(childfiles[i].tb);
+  }
+  free(childfiles);
+  childfiles       = NULL;
+  childfiles_max   = 0;
+  childfiles_count = 0;
 }
 
 
@@ -200,31 +267,6 @@ static void __attribute__((__format__(printf, 1, 2)))
 }
 
 
-#ifdef TRACE_ZIPPED
-
-/* borrow gzio replacement functions from connections.c
-   which includes them from gzio.h */
-
-gzFile R_gzopen (const char *path, const char *mode);
-int R_gzclose (gzFile file);
-int R_gzwrite (gzFile file, voidpc buf, unsigned len);
-
-// gzprintf replacement because it's not even in gzio.h
-static int __attribute__((format(printf, 2, 3)))
-  gz_printf(TRACEFILE file, const char *format, ...) {
-    char strbuf[2000];
-    int res;
-    va_list args;
-
-    va_start(args, format);
-    res = vsnprintf(strbuf, sizeof(strbuf), format, args);
-    va_end(args);
-    WRITE_FUN(file, strbuf, res);
-    return res;
-}
-
-#endif
-
 
 /*
  * tracing directory init/cleanup
@@ -240,7 +282,8 @@ static void create_tracedir() {
             && errno != EEXIST)
           print_error_msg("Can't create directory: %s\n", R_TraceDir);
 
-        snprintf(trace_info.filename, sizeof(trace_info.filename), "%s/%s", R_TraceDir, SUMMARY_NAME);
+        snprintf(trace_info.filename, sizeof(trace_info.filename), "%s/%s", R_TraceDir,
+		 R_TraceFormat == TR_FORMAT_BINARY ? BINSUMMARY_NAME : SUMMARY_NAME);
     } else {
       strncpy(trace_info.filename, R_TraceFile, sizeof(trace_info.filename)-1);
     }
@@ -254,29 +297,77 @@ static void initialize_trace_defaults(TR_TYPE mode) {
     traceR_is_active = 0;
 }
 
-static void init_externalcalls() {
-    char str[MAX_DNAME];
+/*
+ * start the external call statistics and open their log (if requested),
+ * forked children get their own
+ */
+static void open_externalcalls(int child) {
+    char *str = trace_info.extcalls_name;
+    char name[MAX_FNAME];
 
-    if (!traceR_TraceExternalCalls)
+    if (!traceR_TraceExternalCalls) {
+	if (R_TraceNativeCalls)
+	    child ? extcalls_fork(NULL) : extcalls_open(NULL);
 	return;
+    }
+
+    if (child)
+      snprintf(name, sizeof(name), "%s_%d%s", EXTCALLS_PREFIX, getpid(), EXTCALLS_EXT);
+    else
+      strcpy(name, EXTCALLS_NAME);
 
-    /* open the externalcalls file for writing */
     if (R_TraceDir) {
-      sprintf(str, "%s/%s", R_TraceDir, EXTCALLS_NAME);
+      snprintf(str, MAX_DNAME, "%s/%s", R_TraceDir, name);
     } else {
-      strcpy(str, EXTCALLS_NAME);
+      strcpy(str, name);
     }
-    trace_info.extcalls_fd = FOPEN(str);
-    if (trace_info.extcalls_fd == NULL) {
+    if ((child ? extcalls_fork(str) : extcalls_open(str)) < 0) {
 	print_error_msg("Could not open file '%s' for writing", str);
 	abort();
     }
 }
 
+/* create the ring file for the binary summary format */
+static void open_ring(const char *filename) {
+    trace_info.ring = tracebin_create(filename, TRACEBIN_RECORDS);
+    if (trace_info.ring == NULL) {
+	print_error_msg("Could not create binary trace file '%s'", filename);
+	abort();
+    }
+    trace_info.ringout = trout_open_binary(trace_info.ring);
+}
+
+static void close_ring(void) {
+    trout_close(trace_info.ringout);
+    tracebin_close(trace_info.ring);
+    trace_info.ringout = NULL;
+    trace_info.ring    = NULL;
+}
+
+static void start_checkpoints(void) {
+    struct timespec now;
+
+    if (trace_info.ring == NULL || R_TraceCheckpoint <= 0)
+	return;
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+    next_checkpoint = now.tv_sec + R_TraceCheckpoint;
+    traceR_checkpoints_active = TRUE;
+}
+
 static void start_tracing() {
     if (!traceR_is_active) {
 	traceR_is_active = 1;
-	freemem_spawn(trace_info.filename);
+	if (R_TraceFormat == TR_FORMAT_BINARY) {
+	    open_ring(trace_info.filename);
+	    start_checkpoints();
+	}
+	freemem_start();
+	mallocmeasure_start();
+	traceR_start_closure_stats();
+	traceR_start_allocsample();
+	traceR_start_gcstats();
+	traceR_start_bcprof();
     }
 }
 
@@ -285,91 +376,131 @@ static void start_tracing() {
  * Summary output
  */
 
-void close_memory_map();
-void write_missing_results(FILE *out);
-static void write_vector_allocs(FILE *out);
+static void write_vector_allocs(traceout_t *out);
 void traceR_count_all_promises(void);
-
-static void write_allocation_summary(FILE *out) {
-    fprintf(out, "PtrSize\t%lu\n", sizeof(void*));
-    fprintf(out, "#!LABEL\tSEXPREC\tSEXPREC_ALIGN\n");
-    fprintf(out, "StructSize\t%u\t%u\n",
+void traceR_write_closure_stats(traceout_t *out);
+void traceR_write_allocsample(traceout_t *out, Rboolean final);
+void traceR_write_gcstats(traceout_t *out);
+void traceR_write_bcprof(traceout_t *out);
+
+static void write_allocation_summary(traceout_t *out, Rboolean final) {
+    trout_row(out, "PtrSize", "z", sizeof(void*));
+    trout_label(out, "SEXPREC\tSEXPREC_ALIGN");
+    trout_row(out, "StructSize", "uu",
 	    (unsigned int)sizeof(SEXPREC),
 	    (unsigned int)sizeof(SEXPREC_ALIGN));
 
     /* memory allocations */
-    fprintf(out, "AllocatedCons\t%lu\n", allocated_cons);
+    trout_row(out, "AllocatedCons", "L", allocated_cons);
     if (!R_isForkedChild) {
       /* measuring just the child peak is annoying, so this is left out */
-      fprintf(out, "AllocatedConsPeak\t%lu\n", allocated_cons_peak * sizeof(SEXPREC)); // convert to bytes too
+      trout_row(out, "AllocatedConsPeak", "L", allocated_cons_peak * sizeof(SEXPREC)); // convert to bytes too
     }
-    fprintf(out, "AllocatedNonCons\t%lu\n", allocated_noncons);
-    fprintf(out, "AllocatedEnv\t%lu\n", allocated_env);
-    fprintf(out, "AllocatedPromises\t%lu\n", allocated_prom);
-    fprintf(out, "AllocatedSXP\t%lu\n", allocated_sexp);
-    fprintf(out, "AllocatedExternal\t%lu\n", allocated_external);
-    fprintf(out, "#!LABEL\tallocs\telements\n");
-    fprintf(out, "AllocatedList\t%lu\t%lu\n", allocated_list, allocated_list_elts);
-    fprintf(out, "#!LABEL\tallocs\telements\tsize\n");
-    fprintf(out, "AllocatedStringBuffer\t%lu\t%lu\t%lu\n", allocated_sb, allocated_sb_elts, allocated_sb_size);
+    trout_row(out, "AllocatedNonCons", "L", allocated_noncons);
+    trout_row(out, "AllocatedEnv", "L", allocated_env);
+    trout_row(out, "AllocatedPromises", "L", allocated_prom);
+    trout_row(out, "AllocatedSXP", "L", allocated_sexp);
+    trout_row(out, "AllocatedExternal", "L", allocated_external);
+    trout_label(out, "allocs\telements");
+    trout_row(out, "AllocatedList", "LL", allocated_list, allocated_list_elts);
+    trout_label(out, "allocs\telements\tsize");
+    trout_row(out, "AllocatedStringBuffer", "LLL", allocated_sb, allocated_sb_elts, allocated_sb_size);
 
     write_vector_allocs(out);
 
-    fprintf(out, "GC_count\t%d\n", gc_count);
+    trout_row(out, "GC_count", "d", gc_count);
+    traceR_write_gcstats(out);
 
-    /* promises */
-    traceR_count_all_promises();
+    /* promises (a checkpoint can't account for the ones still alive) */
+    if (final)
+	traceR_count_all_promises();
 
-    fprintf(out, "HighestPromiseStack\t%u\n", R_PendingPromiseMaxHeight);
+    trout_row(out, "HighestPromiseStack", "u", R_PendingPromiseMaxHeight);
 
-    fprintf(out, "#!LABEL\tallocated\tcollected\tunevaled\n");
-    fprintf(out, "Promises\t%lu\t%lu\t%lu\n",
+    trout_label(out, "allocated\tcollected\tunevaled");
+    trout_row(out, "Promises", "LLL",
 	    traceR_promise_stats.created,
 	    traceR_promise_stats.collected,
 	    traceR_promise_stats.created - traceR_promise_stats.collected_evaled);
 
-    fprintf(out, "#!LABEL\tsame\tlower\thigher\tfail\treset\n");
-    fprintf(out, "PromiseSetval\t%lu\t%lu\t%lu\t%lu\t%lu\n",
+    trout_label(out, "same\tlower\thigher\tfail\treset");
+    trout_row(out, "PromiseSetval", "LLLLL",
 	    traceR_promise_stats.same,
 	    traceR_promise_stats.lower,
 	    traceR_promise_stats.higher,
 	    traceR_promise_stats.fail,
 	    traceR_promise_stats.reset);
 
-    fprintf(out, "#!LABEL\tlower\thigher\n");
-    fprintf(out, "PromiseMaxDiff\t%u\t%u\n",
+    trout_label(out, "lower\thigher");
+    trout_row(out, "PromiseMaxDiff", "uu",
 	    traceR_promise_stats.maxdiff_lower,
 	    traceR_promise_stats.maxdiff_higher);
 
-    fprintf(out, "#!LABEL\tlevel_difference\tcount\n");
-    fprintf(out, "#!TABLE\tPromiseLevelDifference\tPromiseLevelDifference\n");
+    trout_label(out, "level_difference\tcount");
+    trout_table(out, "PromiseLevelDifference", "PromiseLevelDifference");
 
     for (unsigned int i = 0;
 	 i < TRACER_PROMISE_LOWER_LIMIT + TRACER_PROMISE_HIGHER_LIMIT + 1;
 	 i++) {
-	fprintf(out, "PromiseLevelDifference\t%d\t%lu\n",
+	trout_row(out, "PromiseLevelDifference", "dL",
 		(int)i - TRACER_PROMISE_LOWER_LIMIT,
 		traceR_promise_stats.diff_plain[i]);
     }
 
     /* misc */
-    fprintf(out, "#!LABEL\tobject\telements\t1elements\n");
-    fprintf(out, "Duplicate\t%lu\t%lu\t%lu\n", duplicate_object, duplicate_elts, duplicate1_elts);
-
-    /* memory over time */
-    mallocmeasure_finalize();
-    if (mallocmeasure_current_slot) {
-	fprintf(out, "MallocmeasureQuantum\t%u\n", mallocmeasure_quantum);
-	fprintf(out, "#!LABEL\ttime\tmemory\n");
-	fprintf(out, "#!TABLE\tPeakMemory\tMemoryOverTime\n");
-	for (unsigned int i = 0; i < mallocmeasure_current_slot; i++) {
-	    fprintf(out, "PeakMemory\t%u\t%lu\n", i, mallocmeasure_values[i]);
+    trout_label(out, "object\telements\t1elements");
+    trout_row(out, "Duplicate", "LLL", duplicate_object, duplicate_elts, duplicate1_elts);
+    trout_label(out, "at_call\tgrown");
+    trout_row(out, "HashedFrames", "LL", hashed_frames_call, hashed_frames_grown);
+    trout_label(out, "compiled\thits\tenv_mismatch\tevictions\tsize");
+    trout_row(out, "JITCache", "LLLLL", jit_compiled, jit_cache_hits,
+	      jit_env_mismatch, jit_cache_evictions, jit_cache_size);
+    trout_label(out, "in_place\tcopied\tboxed");
+    trout_row(out, "ScalarStores", "LLL", bc_scalar_inplace, bc_scalar_copied,
+	      bc_scalar_boxed);
+    trout_label(out, "collections\tnodes\tsteals\tbusiest");
+    trout_row(out, "ParallelMark", "LLLL", gc_parallel_marks,
+	      gc_parallel_mark_nodes, gc_parallel_mark_steals,
+	      gc_parallel_mark_busiest);
+    trout_label(out, "nodes\tnew_pages\treused_pages");
+    trout_row(out, "BumpAllocation", "LLL", bump_alloc_nodes,
+	      bump_alloc_new_pages, bump_alloc_reused_pages);
+    trout_label(out, "mapped\treused\tunmapped\tadvised");
+    trout_row(out, "LargeBlocks", "LLLL", large_blocks_mapped,
+	      large_blocks_reused, large_blocks_unmapped, large_blocks_advised);
+    trout_label(out, "hits\tmisses\tuncached");
+    trout_row(out, "FunctionCache", "LLL", fun_cache_hits, fun_cache_misses,
+	      fun_cache_uncached);
+    trout_label(out, "mapped\tbytes\tcopied");
+    trout_row(out, "MappedVectors", "LLL", unserialize_mapped_vectors,
+	      unserialize_mapped_bytes, unserialize_copied_vectors);
+    trout_label(out, "blocks\tin\tout");
+    trout_row(out, "BlockCompression", "LLL", blockz_blocks,
+	      blockz_bytes_in, blockz_bytes_out);
+    trout_label(out, "lookups\tprobes\tcollisions");
+    trout_row(out, "ReferenceHash", "LLL", ptrhash_lookups, ptrhash_probes,
+	      ptrhash_collisions);
+    trout_label(out, "blocks\tbytes\truns");
+    trout_row(out, "ScanBlocks", "LLL", scan_blocks, scan_block_bytes,
+	      scan_run_bytes);
+
+    /* memory over time (a checkpoint only shows the finished slots) */
+    if (final)
+	mallocmeasure_finalize();
+    size_t slots = __atomic_load_n(&mallocmeasure_current_slot, __ATOMIC_RELAXED);
+    if (slots) {
+	trout_row(out, "MallocmeasureQuantum", "u", mallocmeasure_quantum);
+	trout_label(out, "time\tmemory");
+	trout_table(out, "PeakMemory", "MemoryOverTime");
+	for (unsigned int i = 0; i < slots; i++) {
+	    trout_row(out, "PeakMemory", "uz", i, mallocmeasure_values[i]);
 	}
     }
 }
 
-static void write_trace_summary(FILE *out) {
-    R_gc();
+static void write_trace_summary(traceout_t *out, Rboolean final) {
+    if (final)
+	R_gc();
     char str[TIME_BUFF > MAX_DNAME? TIME_BUFF : MAX_DNAME];
     time_t current_time = time(0);
     struct tm *local_time = localtime(&current_time);
@@ -380,36 +511,280 @@ static void write_trace_summary(FILE *out) {
       abort();
     }
 
-    fprintf(out, "Hostname\t%s\n", str);
+    trout_string(out, "Hostname", str);
 
     if (getcwd(str, MAX_DNAME) == NULL)
       abort();
-    fprintf(out, "Workdir\t%s\n", str);
-    fprintf(out, "Args\t"); write_commandArgs(out);
+    trout_string(out, "Workdir", str);
+    format_commandArgs(str, MAX_DNAME);
+    trout_string(out, "Args", str);
     // TODO print trace_type all/repl/bootstrap
 
     strftime (str, TIME_BUFF, "%c", local_time);
-    fprintf(out, "TraceDate\t%s\n", str);
+    trout_string(out, "TraceDate", str);
     getrusage(RUSAGE_SELF, &my_rusage);
-    fprintf(out, "RusageMaxResidentMemorySet\t%ld\n", my_rusage.ru_maxrss);
-    fprintf(out, "RusageSharedMemSize\t%ld\n", my_rusage.ru_ixrss);
-    fprintf(out, "RusageUnsharedDataSize\t%ld\n", my_rusage.ru_idrss);
-    fprintf(out, "RusagePageReclaims\t%ld\n", my_rusage.ru_minflt);
-    fprintf(out, "RusagePageFaults\t%ld\n", my_rusage.ru_majflt);
-    fprintf(out, "RusageSwaps\t%ld\n", my_rusage.ru_nswap);
-    fprintf(out, "RusageBlockInputOps\t%ld\n", my_rusage.ru_inblock);
-    fprintf(out, "RusageBlockOutputOps\t%ld\n", my_rusage.ru_oublock);
-    fprintf(out, "RusageIPCSends\t%ld\n", my_rusage.ru_msgsnd);
-    fprintf(out, "RusageIPCRecv\t%ld\n", my_rusage.ru_msgrcv);
-    fprintf(out, "RusageSignalsRcvd\t%ld\n", my_rusage.ru_nsignals);
-    fprintf(out, "RusageVolnContextSwitches\t%ld\n", my_rusage.ru_nvcsw);
-    fprintf(out, "RusageInvolnContextSwitches\t%ld\n", my_rusage.ru_nivcsw);
-
-    write_allocation_summary(out);
+    trout_row(out, "RusageMaxResidentMemorySet", "l", my_rusage.ru_maxrss);
+    trout_row(out, "RusageSharedMemSize", "l", my_rusage.ru_ixrss);
+    trout_row(out, "RusageUnsharedDataSize", "l", my_rusage.ru_idrss);
+    trout_row(out, "RusagePageReclaims", "l", my_rusage.ru_minflt);
+    trout_row(out, "RusagePageFaults", "l", my_rusage.ru_majflt);
+    trout_row(out, "RusageSwaps", "l", my_rusage.ru_nswap);
+    trout_row(out, "RusageBlockInputOps", "l", my_rusage.ru_inblock);
+    trout_row(out, "RusageBlockOutputOps", "l", my_rusage.ru_oublock);
+    trout_row(out, "RusageIPCSends", "l", my_rusage.ru_msgsnd);
+    trout_row(out, "RusageIPCRecv", "l", my_rusage.ru_msgrcv);
+    trout_row(out, "RusageSignalsRcvd", "l", my_rusage.ru_nsignals);
+    trout_row(out, "RusageVolnContextSwitches", "l", my_rusage.ru_nvcsw);
+    trout_row(out, "RusageInvolnContextSwitches", "l", my_rusage.ru_nivcsw);
+    if (traceR_TraceExternalCalls)
+      trout_string(out, "ExternalCallsFile", trace_info.extcalls_name);
+    if (traceR_extcalls_active)
+      extcalls_write(out);
+
+    /* a checkpoint has to fit into the ring together with everything else */
+    freemem_write(out, final, trace_info.ring ? FREEMEM_BINARY_ROWS : 0);
+
+    write_allocation_summary(out, final);
     write_arg_histogram(out);
+    traceR_write_closure_stats(out);
+    traceR_write_allocsample(out, final);
+    traceR_write_bcprof(out);
 }
 
-static void write_summary() {
+static void write_times(traceout_t *out, struct timeval *end) {
+    trout_row(out, "StartTimeUsec", "l", start_time_us.tv_sec * 1000000UL + start_time_us.tv_usec);
+    trout_row(out, "EndTimeUsec", "l", end->tv_sec * 1000000UL + end->tv_usec);
+    struct tms ustimes;
+    long ticks_per_sec = sysconf(_SC_CLK_TCK);
+    times(&ustimes);
+    trout_row(out, "UserTime", "f", ustimes.tms_utime / (double)ticks_per_sec);
+    trout_row(out, "SystemTime", "f", ustimes.tms_stime / (double)ticks_per_sec);
+}
+
+/*
+ * Rows that are merged over all processes at the end of the parent's
+ * summary, see traceagg.h for the meaning of the operations. Timelines
+ * and per-closure data are not comparable between processes, they are
+ * only kept in the section of each child.
+ */
+static const tragg_rule_t aggregate_rules[] = {
+    { "StartTimeUsec",               "<" },
+    { "EndTimeUsec",                 ">" },
+    { "UserTime",                    "+" },
+    { "SystemTime",                  "+" },
+    { "RusageMaxResidentMemorySet",  ">" },
+    { "RusagePageReclaims",          "+" },
+    { "RusagePageFaults",            "+" },
+    { "RusageBlockInputOps",         "+" },
+    { "RusageBlockOutputOps",        "+" },
+    { "RusageVolnContextSwitches",   "+" },
+    { "RusageInvolnContextSwitches", "+" },
+    { "AllocatedCons",               "+" },
+    { "AllocatedNonCons",            "+" },
+    { "AllocatedEnv",                "+" },
+    { "AllocatedPromises",           "+" },
+    { "AllocatedSXP",                "+" },
+    { "AllocatedExternal",           "+" },
+    { "AllocatedList",               "++" },
+    { "AllocatedStringBuffer",       "+++" },
+    { "AllocatedVectors",            "++++" },
+    { "AllocatedZeroVectors",        "++++" },
+    { "AllocatedOneVectors",         "++++" },
+    { "AllocatedSmallVectors",       "++++" },
+    { "AllocatedLargeVectors",       "++++" },
+    { "VectorAllocBin",              "kkk++++" },
+    { "GC_count",                    "+" },
+    { "GCLevel",                     "k++>++" },
+    { "GCPauseBin",                  "kkk+++" },
+    { "HighestPromiseStack",         ">" },
+    { "Promises",                    "+++" },
+    { "PromiseSetval",               "+++++" },
+    { "PromiseMaxDiff",              ">>" },
+    { "PromiseLevelDifference",      "k+" },
+    { "Duplicate",                   "+++" },
+    { "HashedFrames",                "++" },
+    { "JITCache",                    "++++>" },
+    { "ScalarStores",                "+++" },
+    { "ParallelMark",                "++++" },
+    { "BumpAllocation",              "+++" },
+    { "LargeBlocks",                 "++++" },
+    { "FunctionCache",               "+++" },
+    { "MappedVectors",               "+++" },
+    { "BlockCompression",            "+++" },
+    { "ReferenceHash",               "+++" },
+    { "ScanBlocks",                  "+++" },
+    { "ArgCount",                    "k+++++++" },
+    { "AllocSamples",                "++" },
+    { "ExternalCallTotal",           "+++++" },
+    { "BCInstructions",              "++" },
+    { "BCOpcode",                    "k++" },
+    { "BCOpPair",                    "kk+" },
+};
+
+static int monotonic_before(const struct timespec *deadline) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec < deadline->tv_sec ||
+      (now.tv_sec == deadline->tv_sec && now.tv_nsec < deadline->tv_nsec);
+}
+
+/*
+ * Open the binary child files. A child that is still running (e.g. it
+ * sent its result and is now writing its summary) gets a few seconds
+ * in total to finish, otherwise its last checkpoint is used.
+ */
+static void open_childfiles(void) {
+    struct timespec deadline, pause = { 0, 10000000 };
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += CHILD_WAIT_SEC;
+
+    for (unsigned int i = 0; i < childfiles_count; i++) {
+      childfile_t *child = &childfiles[i];
+
+      if (child->pid <= 0) {
+	if (tracebin_is_binary(child->name))
+	  child->tb = tracebin_open(child->name);
+	continue;
+      }
+
+      for (;;) {
+	child->tb = tracebin_open(child->name);
+	if (child->tb && tracebin_header(child->tb)->last_final)
+	  break;
+	if (kill(child->pid, 0) && errno == ESRCH)
+	  break;
+	if (!monotonic_before(&deadline))
+	  break;
+
+	if (child->tb)
+	  tracebin_close(child->tb);
+	child->tb = NULL;
+	nanosleep(&pause, NULL);
+      }
+    }
+}
+
+/* upper bound for the records needed to copy all child files */
+static uint64_t childfile_records(void) {
+    uint64_t total = 0;
+
+    for (unsigned int i = 0; i < childfiles_count; i++) {
+      if (childfiles[i].tb) {
+	const tracebin_header_t *hdr = tracebin_header(childfiles[i].tb);
+	total += hdr->last_end - hdr->last_begin;
+	continue;
+      }
+
+      FILE *fd = fopen(childfiles[i].name, "r");
+      char *line = NULL;
+      size_t linemax = 0;
+      ssize_t len;
+
+      if (fd == NULL)
+	continue;
+      while ((len = getline(&line, &linemax, fd)) >= 0)
+	total += len / TRACEBIN_STRBYTES + 1;
+      free(line);
+      fclose(fd);
+    }
+
+    return total;
+}
+
+/* copy a text file into the summary, line by line */
+static void merge_text_lines(traceout_t *out, FILE *fd) {
+    char *line = NULL;
+    size_t linemax = 0;
+    ssize_t len;
+
+    while ((len = getline(&line, &linemax, fd)) >= 0) {
+	if (len > 0 && line[len - 1] == '\n')
+	    line[len - 1] = 0;
+	trout_line(out, line);
+    }
+
+    free(line);
+}
+
+/*
+ * Combine all child summary files. Binary files are copied record by
+ * record, their own child sections (nested forks) are numbered on in
+ * the order they appear. Returns the number of sections written.
+ */
+static unsigned int merge_childfiles(traceout_t *out) {
+    unsigned int sections = 0;
+
+    trout_row(out, "childcount", "d", childfiles_count);
+    for (unsigned int i = 0; i < childfiles_count; i++) {
+      childfile_t *child = &childfiles[i];
+
+      if (child->tb) {
+        trout_section(out, ++sections, child->pid, (long)getpid());
+        if (trout_replay(out, child->tb, &sections))
+          fprintf(stderr, "WARNING: No complete checkpoint in %s\n", child->name);
+        else if (!tracebin_header(child->tb)->last_final)
+          fprintf(stderr, "WARNING: Child %ld did not finish, using its checkpoint %u\n",
+                  child->pid, tracebin_header(child->tb)->last_seq);
+        unlink(child->name);
+        continue;
+      }
+
+      /* text summaries, e.g. of R processes started via traceR_getchildfile */
+      FILE *childfd = fopen(child->name, "r");
+      if (!childfd) {
+        fprintf(stderr, "WARNING: Unable to open %s: %s\n", child->name, strerror(errno));
+        continue;
+      }
+
+      unlink(child->name);
+
+      trout_section(out, ++sections, child->pid, (long)getpid());
+      merge_text_lines(out, childfd);
+      fclose(childfd);
+    }
+
+    return sections;
+}
+
+/* only the first process merges the counters of the whole process tree */
+static traceagg_t *start_aggregate(traceout_t *out) {
+    if (R_isForkedChild || childfiles_count == 0)
+      return NULL;
+
+    traceagg_t *agg = tragg_create(aggregate_rules,
+				   sizeof(aggregate_rules) / sizeof(aggregate_rules[0]));
+    trout_set_aggregate(out, agg);
+    return agg;
+}
+
+static void finish_aggregate(traceout_t *out, traceagg_t *agg, unsigned int sections) {
+    if (agg == NULL)
+      return;
+
+    trout_set_aggregate(out, NULL);
+    tragg_write(agg, out, sections + 1);
+    tragg_free(agg);
+}
+
+static void write_trace_with_children(traceout_t *out) {
+    traceagg_t *agg = start_aggregate(out);
+
+    write_times(out, &end_time_us);
+    if (trace_info.ring) {
+      trout_label(out, "sequence\tfinal");
+      trout_row(out, "TraceCheckpoint", "ud", ++checkpoint_seq, 1);
+    }
+    write_trace_summary(out, TRUE);
+
+    if (childfiles_count)
+      finish_aggregate(out, agg, merge_childfiles(out));
+
+    free_childfiles();
+}
+
+static void write_summary_text() {
     FILE *summary_fp;
     char str[MAX_DNAME];
 
@@ -427,39 +802,66 @@ static void write_summary() {
 	return;
     }
 
-    fprintf(summary_fp, "StartTimeUsec\t%ld\n", start_time_us.tv_sec * 1000000UL + start_time_us.tv_usec);
-    fprintf(summary_fp, "EndTimeUsec\t%ld\n", end_time_us.tv_sec * 1000000UL + end_time_us.tv_usec);
-    struct tms ustimes;
-    long ticks_per_sec = sysconf(_SC_CLK_TCK);
-    times(&ustimes);
-    fprintf(summary_fp, "UserTime\t%f\n", ustimes.tms_utime / (double)ticks_per_sec);
-    fprintf(summary_fp, "SystemTime\t%f\n", ustimes.tms_stime / (double)ticks_per_sec);
+    traceout_t *out = trout_open_text(summary_fp);
+    if (out == NULL) {
+	fclose(summary_fp);
+	return;
+    }
 
-    write_trace_summary(summary_fp);
+    open_childfiles();
+    write_trace_with_children(out);
 
-    /* if on parent: combine all child summary files */
-    if (childfiles_count) {
-      fprintf(summary_fp, "childcount\t%d\n", childfiles_count);
-      for (unsigned int i = 0; i < childfiles_count; i++) {
-        FILE *childfd = fopen(childfiles[i], "r");
-        if (!childfd) {
-          fprintf(stderr, "WARNING: Unable to open %s: %s\n", childfiles[i], strerror(errno));
-          continue;
-        }
+    trout_close(out);
+    fclose(summary_fp);
+}
 
-        unlink(childfiles[i]);
+static void write_summary_binary() {
+    traceout_t *out = trace_info.ringout;
+
+    /* our own data always fits, make room for the children on top */
+    open_childfiles();
+    uint64_t need = TRACEBIN_RECORDS + TRACEBIN_RECORDS / 8 + childfile_records();
+    if (need > TRACEBIN_RECORDS &&
+	tracebin_resize(trace_info.ring, need > UINT32_MAX ? UINT32_MAX : need))
+      fprintf(stderr, "WARNING: Could not enlarge %s for the child summaries\n",
+	      trace_info.filename);
+
+    trout_begin(out, TRUE);
+    write_trace_with_children(out);
+    trout_end(out);
+    close_ring();
+}
+
+static void write_summary() {
+    if (trace_info.ring)
+	write_summary_binary();
+    else
+	write_summary_text();
+}
 
-        fprintf(summary_fp, "#!CHILD\t%d\n", i+1);
+/* write the current counters to the ring without ending the run */
+static void write_checkpoint(void) {
+    traceout_t *out = trace_info.ringout;
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    trout_begin(out, FALSE);
+    write_times(out, &now);
+    trout_label(out, "sequence\tfinal");
+    trout_row(out, "TraceCheckpoint", "ud", ++checkpoint_seq, 0);
+    write_trace_summary(out, FALSE);
+    trout_end(out);
+}
 
-        while (fgets(str, sizeof(str), childfd)) {
-          fprintf(summary_fp, "%s", str);
-        }
+void traceR_checkpoint_poll_int(void) {
+    struct timespec now;
 
-        fclose(childfd);
-      }
-    }
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+    if (now.tv_sec < next_checkpoint)
+	return;
 
-    fclose(summary_fp);
+    next_checkpoint = now.tv_sec + R_TraceCheckpoint;
+    write_checkpoint();
 }
 
 /*
@@ -468,6 +870,7 @@ static void write_summary() {
 static void terminate_tracing() {
     // Stop tracing
     gettimeofday(&end_time_us, NULL);
+    traceR_checkpoints_active = FALSE;
     if (traceR_is_active) {
 	traceR_is_active = 0;
 	write_summary();
@@ -484,7 +887,7 @@ static void terminate_tracing() {
 void traceR_initialize(void) {
     create_tracedir();
     initialize_trace_defaults(R_TraceLevel);
-    init_externalcalls();
+    open_externalcalls(0);
 
     if (R_TraceLevel == TR_ALL || R_TraceLevel == TR_BOOTSTRAP)
 	start_tracing();
@@ -507,23 +910,8 @@ void traceR_finish_clean(void) {
 	terminate_tracing();
     }
 
-    if (traceR_TraceExternalCalls) {
-	FCLOSE(trace_info.extcalls_fd);
-    }
-}
-
-/* log calls to external code */
-void traceR_report_external_int(int /*NativeSymbolType*/ type,
-				char *funcname,
-				void /*DL_FUNC*/ *fun) {
-    if (funcname[0] == 0) {
-	/* function name is not available */
-	FPRINTF(trace_info.extcalls_fd, "%d @%p %p\n",
-		type, fun, fun);
-    } else {
-	FPRINTF(trace_info.extcalls_fd, "%d %s %p\n",
-		type, funcname, fun);
-    }
+    if (traceR_extcalls_active)
+	extcalls_close();
 }
 
 
@@ -604,16 +992,21 @@ void traceR_count_vector_alloc(traceR_vector_class_t type,
 	vecalloc_max_bin = bin;
 
     count_vecalloc(&vectors_byelements[bin], elements, size, asize);
+
+    if (traceR_closure_stats_active)
+	traceR_closure_vector_alloc(type, elements, size, asize);
+    if (traceR_allocsample_active)
+	traceR_allocsample(asize);
 }
 
-static void report_vectorstats(FILE *out, const char *name, vec_alloc_stats_t *stats) {
-    fprintf(out, "%s\t%lu\t%lu\t%lu\t%lu\n", name,
+static void report_vectorstats(traceout_t *out, const char *name, vec_alloc_stats_t *stats) {
+    trout_row(out, name, "LLLL",
 	    stats->allocs, stats->elements,
 	    stats->size,   stats->asize);
 }
 
-static void write_vector_allocs(FILE *out) {
-    fprintf(out, "#!LABEL\tallocs\telements\tsize\tasize\n");
+static void write_vector_allocs(traceout_t *out) {
+    trout_label(out, "allocs\telements\tsize\tasize");
     report_vectorstats(out, "AllocatedVectors",      &vectors_byclass[TR_VECCLASS_TOTAL]);
     report_vectorstats(out, "AllocatedZeroVectors",  &vectors_byclass[TR_VECCLASS_ZERO]);
     report_vectorstats(out, "AllocatedOneVectors",   &vectors_byclass[TR_VECCLASS_ONE]);
@@ -622,20 +1015,21 @@ static void write_vector_allocs(FILE *out) {
 
     unsigned int i;
 
-    fprintf(out, "VectorAllocExactLimit\t%d\n", (1 << (VECTOR_EXACT_LIMIT_LD)) - 1);
+    trout_row(out, "VectorAllocExactLimit", "d", (1 << (VECTOR_EXACT_LIMIT_LD)) - 1);
 
-    fprintf(out, "#!LABEL\tbin_id\tlower_limit\tupper_limit\tallocs\telements\tsize\tasize\n");
-    fprintf(out, "#!TABLE\tVectorAllocBin\tVectorAllocationHistogram\n");
+    trout_label(out, "bin_id\tlower_limit\tupper_limit\tallocs\telements\tsize\tasize");
+    trout_table(out, "VectorAllocBin", "VectorAllocationHistogram");
     for (i = 0; i <= vecalloc_max_bin; i++) {
-	fprintf(out,"VectorAllocBin\t%u\t%lu\t%lu", i,
-		vector_bin_lower(i), vector_bin_upper(i));
-	report_vectorstats(out, "", &vectors_byelements[i]);
+	vec_alloc_stats_t *stats = &vectors_byelements[i];
+
+	trout_row(out, "VectorAllocBin", "uzzLLLL", i,
+		vector_bin_lower(i), vector_bin_upper(i),
+		stats->allocs, stats->elements,
+		stats->size,   stats->asize);
     }
 }
 
 static void traceR_reset(void) {
-  // FIXME: Extcalls not reset, would require close+reopen of the log file
-
   allocated_cons        = 0;
   allocated_prom        = 0;
   allocated_env         = 0;
@@ -648,6 +1042,41 @@ static void traceR_reset(void) {
   duplicate_object      = 0;
   duplicate_elts        = 0;
   duplicate1_elts       = 0;
+  hashed_frames_call    = 0;
+  hashed_frames_grown   = 0;
+  jit_compiled          = 0;
+  jit_cache_hits        = 0;
+  jit_env_mismatch      = 0;
+  jit_cache_evictions   = 0;
+  bc_scalar_inplace     = 0;
+  bc_scalar_copied      = 0;
+  bc_scalar_boxed       = 0;
+  gc_parallel_marks        = 0;
+  gc_parallel_mark_nodes   = 0;
+  gc_parallel_mark_steals  = 0;
+  gc_parallel_mark_busiest = 0;
+  bump_alloc_nodes         = 0;
+  bump_alloc_new_pages     = 0;
+  bump_alloc_reused_pages  = 0;
+  large_blocks_mapped      = 0;
+  large_blocks_reused      = 0;
+  large_blocks_unmapped    = 0;
+  large_blocks_advised     = 0;
+  fun_cache_hits           = 0;
+  fun_cache_misses         = 0;
+  fun_cache_uncached       = 0;
+  unserialize_mapped_vectors = 0;
+  unserialize_mapped_bytes   = 0;
+  unserialize_copied_vectors = 0;
+  blockz_blocks            = 0;
+  blockz_bytes_in          = 0;
+  blockz_bytes_out         = 0;
+  ptrhash_lookups          = 0;
+  ptrhash_probes           = 0;
+  ptrhash_collisions       = 0;
+  scan_blocks              = 0;
+  scan_block_bytes         = 0;
+  scan_run_bytes           = 0;
   allocated_list        = 0;
   allocated_list_elts   = 0;
   gc_count              = 0;
@@ -662,39 +1091,50 @@ static void traceR_reset(void) {
   memset(vectors_byelements, 0, sizeof(vectors_byelements));
   vecalloc_max_bin = 0;
 
+  traceR_reset_closure_stats();
+  traceR_reset_allocsample();
+  traceR_reset_gcstats();
+  traceR_reset_bcprof();
   mallocmeasure_reset();
 }
 
 void traceR_forked(long childpid) {
   if (childpid == 0) {
-    /* in child */
-    if (R_isForkedChild) {
-      fprintf(stderr, "*** ERROR: Forking from child processes is currently not supported!\n");
-      abort();
-    }
-
+    /* in child (possibly of another child) */
     freemem_fork();
     traceR_reset();
-    for (unsigned int i = 0; i < childfiles_count; i++)
-      free(childfiles[i]);
-    free(childfiles);
-    childfiles       = NULL;
-    childfiles_max   = 0;
-    childfiles_count = 0;
+
+    /*
+     * The inherited ring and external call log belong to the parent.
+     * Children always write the binary format, the parent merges it
+     * into whatever format it uses itself. The old log is dropped
+     * without closing it, that would flush the parent's buffer.
+     */
+    if (traceR_is_active) {
+      char childfn[MAX_DNAME + 32];
+
+      if (trace_info.ring) {
+	trout_close(trace_info.ringout);
+	tracebin_forget(trace_info.ring);
+      }
+      snprintf(childfn, sizeof(childfn), "%s_%d", trace_info.filename, getpid());
+      open_ring(childfn);
+      start_checkpoints();
+    }
+    if (traceR_extcalls_active)
+      open_externalcalls(1);
+
+    /* the parent's children are none of our business */
+    free_childfiles();
     gettimeofday(&start_time_us, NULL);
     return;
   }
 
   /* in parent, add child data file name */
-  if (trace_info.extcalls_fd) {
-    fprintf(stderr, "*** ERROR: Cannot handle parallel operation while external call logging is active!\n");
-    abort();
-  }
-
   char childfn[1024];
   childfn[sizeof(childfn)-1] = 0;
   snprintf(childfn, sizeof(childfn)-1, "%s_%ld", trace_info.filename, childpid);
-  add_childfile(childfn);
+  add_childfile(childfn, childpid);
 }
 
 static unsigned int childcounter = 0;
@@ -723,5 +1163,5 @@ void traceR_getchildfile(char *buffer) {
   strcpy(buffer, rp);
   free(rp);
 
-  add_childfile(buffer);
+  add_childfile(buffer, 0);
 }
@@ -0,0 +1,221 @@
+/*
+ *  r-instrumented : Various measurements for R
+ *  Copyright (C) 2014  TU Dortmund Informatik LS XII
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, a copy is available at
+ *  http://www.r-project.org/Licenses/
+ *
+ *  traceagg.c: merging the counters of several trace summaries
+ *
+ *  The aggregator sees every row that is written while it is attached
+ *  to an output, both the process' own counters and the rows copied
+ *  from child files. Rows of keywords with a rule are merged by their
+ *  identity columns; the rows of one keyword are kept sorted by them,
+ *  so histograms of different lengths line up.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "traceagg.h"
+#include "traceout.h"
+
+typedef struct {
+    const char        *key;
+    const char        *ops;
+    unsigned int       nvals;
+
+    char              *label;
+    char              *table;
+
+    tracebin_record_t *rows;
+    unsigned int       count;
+    unsigned int       max;
+} aggkey_t;
+
+struct traceagg {
+    aggkey_t    *keys;
+    unsigned int nkeys;
+
+    char        *label;  // last label seen, it describes the rows that follow
+};
+
+traceagg_t *tragg_create(const tragg_rule_t *rules, unsigned int nrules) {
+    traceagg_t *agg = calloc(1, sizeof(traceagg_t));
+    if (agg == NULL)
+	return NULL;
+
+    agg->keys = calloc(nrules, sizeof(aggkey_t));
+    if (agg->keys == NULL) {
+	free(agg);
+	return NULL;
+    }
+
+    for (unsigned int i = 0; i < nrules; i++) {
+	agg->keys[i].key   = rules[i].key;
+	agg->keys[i].ops   = rules[i].ops;
+	agg->keys[i].nvals = strlen(rules[i].ops);
+    }
+    agg->nkeys = nrules;
+    return agg;
+}
+
+void tragg_free(traceagg_t *agg) {
+    if (agg == NULL)
+	return;
+
+    for (unsigned int i = 0; i < agg->nkeys; i++) {
+	free(agg->keys[i].label);
+	free(agg->keys[i].table);
+	free(agg->keys[i].rows);
+    }
+    free(agg->keys);
+    free(agg->label);
+    free(agg);
+}
+
+static aggkey_t *find_key(traceagg_t *agg, const char *key) {
+    for (unsigned int i = 0; i < agg->nkeys; i++)
+	if (!strcmp(agg->keys[i].key, key))
+	    return &agg->keys[i];
+    return NULL;
+}
+
+static unsigned int count_columns(const char *labels) {
+    unsigned int n = 1;
+
+    for (const char *p = labels; *p; p++)
+	if (*p == '\t')
+	    n++;
+    return n;
+}
+
+void tragg_label(traceagg_t *agg, const char *labels) {
+    free(agg->label);
+    agg->label = strdup(labels);
+}
+
+void tragg_table(traceagg_t *agg, const char *key, const char *name) {
+    aggkey_t *ak = find_key(agg, key);
+
+    if (ak && ak->table == NULL)
+	ak->table = strdup(name);
+}
+
+static int compare_value(const tracebin_record_t *a, const tracebin_record_t *b,
+			 unsigned int i) {
+    if (a->fmask & (1 << i))
+	return a->v.d[i] < b->v.d[i] ? -1 : a->v.d[i] > b->v.d[i];
+    if (a->smask & (1 << i))
+	return a->v.i[i] < b->v.i[i] ? -1 : a->v.i[i] > b->v.i[i];
+    return a->v.u[i] < b->v.u[i] ? -1 : a->v.u[i] > b->v.u[i];
+}
+
+static int compare_identity(const aggkey_t *ak, const tracebin_record_t *a,
+			    const tracebin_record_t *b) {
+    for (unsigned int i = 0; i < ak->nvals; i++) {
+	if (ak->ops[i] != 'k')
+	    continue;
+
+	int res = compare_value(a, b, i);
+	if (res)
+	    return res;
+    }
+    return 0;
+}
+
+static void merge_values(const aggkey_t *ak, tracebin_record_t *to,
+			 const tracebin_record_t *from) {
+    for (unsigned int i = 0; i < ak->nvals; i++) {
+	switch (ak->ops[i]) {
+	case '+':
+	    if (to->fmask & (1 << i))
+		to->v.d[i] += from->v.d[i];
+	    else
+		to->v.u[i] += from->v.u[i];  // also right for signed values
+	    break;
+	case '<':
+	    if (compare_value(from, to, i) < 0)
+		to->v.u[i] = from->v.u[i];
+	    break;
+	case '>':
+	    if (compare_value(from, to, i) > 0)
+		to->v.u[i] = from->v.u[i];
+	    break;
+	}
+    }
+}
+
+void tragg_row(traceagg_t *agg, const char *key, const tracebin_record_t *rec) {
+    aggkey_t *ak = find_key(agg, key);
+
+    if (ak == NULL || rec->nvals != ak->nvals)
+	return;
+
+    if (ak->label == NULL && agg->label && count_columns(agg->label) == ak->nvals)
+	ak->label = strdup(agg->label);
+
+    /* binary search for the row, or the place to insert it */
+    unsigned int lo = 0, hi = ak->count;
+    while (lo < hi) {
+	unsigned int mid = (lo + hi) / 2;
+	int res = compare_identity(ak, &ak->rows[mid], rec);
+
+	if (res == 0) {
+	    merge_values(ak, &ak->rows[mid], rec);
+	    return;
+	}
+	if (res < 0)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+
+    if (ak->count >= ak->max) {
+	unsigned int newmax = ak->max ? 2 * ak->max : 16;
+	tracebin_record_t *newrows = realloc(ak->rows, newmax * sizeof(tracebin_record_t));
+
+	/* out of memory: this row is missing in the aggregate */
+	if (newrows == NULL)
+	    return;
+	ak->rows = newrows;
+	ak->max  = newmax;
+    }
+
+    memmove(&ak->rows[lo + 1], &ak->rows[lo], (ak->count - lo) * sizeof(tracebin_record_t));
+    ak->rows[lo] = *rec;
+    ak->count++;
+}
+
+void tragg_write(traceagg_t *agg, traceout_t *out, unsigned int processes) {
+    const char *label = NULL;
+
+    trout_aggregate(out, processes);
+
+    for (unsigned int i = 0; i < agg->nkeys; i++) {
+	aggkey_t *ak = &agg->keys[i];
+
+	if (ak->count == 0)
+	    continue;
+
+	/* consecutive rows with the same columns share one label */
+	if (ak->label && (label == NULL || strcmp(label, ak->label)))
+	    trout_label(out, ak->label);
+	if (ak->label)
+	    label = ak->label;
+	if (ak->table)
+	    trout_table(out, ak->key, ak->table);
+	for (unsigned int j = 0; j < ak->count; j++)
+	    trout_record(out, ak->key, &ak->rows[j]);
+    }
+}
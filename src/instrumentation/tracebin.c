@@ -0,0 +1,316 @@
+/*
+ *  r-instrumented : Various measurements for R
+ *  Copyright (C) 2014  TU Dortmund Informatik LS XII
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, a copy is available at
+ *  http://www.r-project.org/Licenses/
+ *
+ *  tracebin.c: binary trace summary ring file
+ *
+ *  The file consists of a header page followed by a ring of fixed-size
+ *  records. The whole file is mapped shared, so every record that was
+ *  appended survives even if the process is killed. Records are written
+ *  in checkpoints; the header only points to a checkpoint after its
+ *  last record was written, so a reader always finds a complete one.
+ */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "tracebin.h"
+
+struct tracebin {
+    int                fd;
+    int                writable;
+    size_t             maplen;
+    tracebin_header_t *hdr;
+    tracebin_record_t *ring;
+
+    /* writer state of the checkpoint in progress */
+    uint64_t           begin;
+    uint32_t           seq;
+    int                final;
+    int                overflow;
+};
+
+static tracebin_t *map_file(int fd, size_t len, int writable) {
+    tracebin_t *tb = calloc(1, sizeof(tracebin_t));
+    if (tb == NULL)
+	return NULL;
+
+    void *mem = mmap(NULL, len, writable ? PROT_READ | PROT_WRITE : PROT_READ,
+		     MAP_SHARED, fd, 0);
+    if (mem == MAP_FAILED) {
+	free(tb);
+	return NULL;
+    }
+
+    tb->fd       = fd;
+    tb->writable = writable;
+    tb->maplen   = len;
+    tb->hdr      = mem;
+    tb->ring     = (tracebin_record_t *)((char *)mem + TRACEBIN_HEADER_SIZE);
+    return tb;
+}
+
+/*
+ * writer
+ */
+
+tracebin_t *tracebin_create(const char *path, uint32_t capacity) {
+    if (capacity < 2)
+	capacity = TRACEBIN_RECORDS;
+
+    size_t len = TRACEBIN_HEADER_SIZE + (size_t)capacity * sizeof(tracebin_record_t);
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+	return NULL;
+
+    if (ftruncate(fd, len)) {
+	close(fd);
+	return NULL;
+    }
+
+    tracebin_t *tb = map_file(fd, len, 1);
+    if (tb == NULL) {
+	close(fd);
+	return NULL;
+    }
+
+    tb->hdr->magic       = TRACEBIN_MAGIC;
+    tb->hdr->version     = TRACEBIN_VERSION;
+    tb->hdr->record_size = sizeof(tracebin_record_t);
+    tb->hdr->capacity    = capacity;
+    return tb;
+}
+
+void tracebin_append(tracebin_t *tb, tracebin_record_t *rec) {
+    tracebin_header_t *hdr = tb->hdr;
+    uint64_t head = hdr->head;
+
+    /* about to overwrite the last complete checkpoint? */
+    if (hdr->last_seq && head - hdr->last_begin >= hdr->capacity) {
+	hdr->last_seq = 0;
+	__sync_synchronize();
+    }
+
+    /* the checkpoint in progress does not fit into the ring at all */
+    if (head - tb->begin >= hdr->capacity)
+	tb->overflow = 1;
+
+    rec->version = TRACEBIN_VERSION;
+    rec->seq     = tb->seq;
+    tb->ring[head % hdr->capacity] = *rec;
+    __sync_synchronize();
+    hdr->head = head + 1;
+}
+
+void tracebin_begin(tracebin_t *tb, int final) {
+    tracebin_record_t rec;
+
+    memset(&rec, 0, sizeof(rec));
+    tb->begin    = tb->hdr->head;
+    tb->seq++;
+    tb->final    = final;
+    tb->overflow = 0;
+
+    rec.kind = TRB_CHECKPOINT_BEGIN;
+    rec.nvals = 1;
+    rec.v.u[0] = final;
+    tracebin_append(tb, &rec);
+}
+
+void tracebin_end(tracebin_t *tb) {
+    tracebin_header_t *hdr = tb->hdr;
+    tracebin_record_t rec;
+
+    memset(&rec, 0, sizeof(rec));
+    rec.kind = TRB_CHECKPOINT_END;
+    tracebin_append(tb, &rec);
+
+    if (tb->overflow) {
+	fprintf(stderr, "WARNING: trace checkpoint %u does not fit into %u records, dropped\n",
+		tb->seq, hdr->capacity);
+	return;
+    }
+
+    /* publish: invalidate, move the pointers, then validate again */
+    hdr->last_seq = 0;
+    __sync_synchronize();
+    hdr->last_begin = tb->begin;
+    hdr->last_end   = hdr->head;
+    hdr->last_final = tb->final;
+    __sync_synchronize();
+    hdr->last_seq   = tb->seq;
+
+    msync(tb->hdr, tb->maplen, MS_ASYNC);
+}
+
+/*
+ * Enlarge the ring, e.g. before a checkpoint that includes the data of
+ * many children. Must not be called while a checkpoint is in progress.
+ * The last complete checkpoint is kept and moved to the start of the
+ * new ring.
+ */
+int tracebin_resize(tracebin_t *tb, uint32_t capacity) {
+    tracebin_header_t *hdr = tb->hdr;
+
+    if (capacity <= hdr->capacity)
+	return 0;
+
+    size_t len = TRACEBIN_HEADER_SIZE + (size_t)capacity * sizeof(tracebin_record_t);
+    if (ftruncate(tb->fd, len))
+	return -1;
+
+    /* until the header is updated the old ring stays valid for readers */
+    void *mem = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, tb->fd, 0);
+    if (mem == MAP_FAILED)
+	return -1;
+
+    uint32_t seq   = hdr->last_seq;
+    uint64_t count = seq ? hdr->last_end - hdr->last_begin : 0;
+    tracebin_record_t *keep = NULL;
+
+    if (count) {
+	keep = malloc(count * sizeof(tracebin_record_t));
+	if (keep == NULL) {
+	    munmap(mem, len);
+	    return -1;
+	}
+	for (uint64_t i = 0; i < count; i++)
+	    keep[i] = tb->ring[(hdr->last_begin + i) % hdr->capacity];
+    }
+
+    munmap(tb->hdr, tb->maplen);
+    tb->maplen = len;
+    tb->hdr    = hdr = mem;
+    tb->ring   = (tracebin_record_t *)((char *)mem + TRACEBIN_HEADER_SIZE);
+
+    hdr->last_seq = 0;
+    __sync_synchronize();
+    if (count)
+	memcpy(tb->ring, keep, count * sizeof(tracebin_record_t));
+    hdr->capacity   = capacity;
+    hdr->head       = count;
+    hdr->last_begin = 0;
+    hdr->last_end   = count;
+    __sync_synchronize();
+    hdr->last_seq   = seq;
+
+    free(keep);
+    return 0;
+}
+
+void tracebin_close(tracebin_t *tb) {
+    if (tb == NULL)
+	return;
+
+    if (tb->writable)
+	msync(tb->hdr, tb->maplen, MS_SYNC);
+    munmap(tb->hdr, tb->maplen);
+    close(tb->fd);
+    free(tb);
+}
+
+/* drop an inherited mapping (e.g. in a forked child) without touching the file */
+void tracebin_forget(tracebin_t *tb) {
+    if (tb == NULL)
+	return;
+
+    munmap(tb->hdr, tb->maplen);
+    close(tb->fd);
+    free(tb);
+}
+
+/*
+ * reader
+ */
+
+tracebin_t *tracebin_open(const char *path) {
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+	return NULL;
+
+    if (fstat(fd, &st) || (size_t)st.st_size < TRACEBIN_HEADER_SIZE) {
+	close(fd);
+	return NULL;
+    }
+
+    tracebin_t *tb = map_file(fd, st.st_size, 0);
+    if (tb == NULL) {
+	close(fd);
+	return NULL;
+    }
+
+    tracebin_header_t *hdr = tb->hdr;
+    if (hdr->magic != TRACEBIN_MAGIC ||
+	hdr->version != TRACEBIN_VERSION ||
+	hdr->record_size != sizeof(tracebin_record_t) ||
+	(size_t)st.st_size < TRACEBIN_HEADER_SIZE +
+	    (size_t)hdr->capacity * sizeof(tracebin_record_t)) {
+	tracebin_close(tb);
+	return NULL;
+    }
+
+    return tb;
+}
+
+const tracebin_header_t *tracebin_header(const tracebin_t *tb) {
+    return tb->hdr;
+}
+
+/* call fun for every record of the last complete checkpoint */
+int tracebin_foreach(const tracebin_t *tb, tracebin_fun_t fun, void *data) {
+    const tracebin_header_t *hdr = tb->hdr;
+    uint32_t seq = hdr->last_seq;
+
+    if (seq == 0)
+	return -1;
+
+    for (uint64_t i = hdr->last_begin; i < hdr->last_end; i++) {
+	const tracebin_record_t *rec = &tb->ring[i % hdr->capacity];
+
+	if (rec->seq != seq)
+	    return -1;
+
+	if (rec->kind == TRB_CHECKPOINT_BEGIN || rec->kind == TRB_CHECKPOINT_END)
+	    continue;
+
+	int res = fun(rec, data);
+	if (res)
+	    return res;
+    }
+
+    return 0;
+}
+
+int tracebin_is_binary(const char *path) {
+    uint32_t magic = 0;
+    FILE *fd = fopen(path, "rb");
+
+    if (fd == NULL)
+	return 0;
+
+    if (fread(&magic, sizeof(magic), 1, fd) != 1)
+	magic = 0;
+
+    fclose(fd);
+    return magic == TRACEBIN_MAGIC;
+}
@@ -0,0 +1,73 @@
+/*
+ *  r-instrumented : Various measurements for R
+ *  Copyright (C) 2014  TU Dortmund Informatik LS XII
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, a copy is available at
+ *  http://www.r-project.org/Licenses/
+ *
+ *  tracebin2text.c: convert a binary trace summary to the text format
+ *
+ *  Usage: tracebin2text trace_summary.bin [trace_summary]
+ *
+ *  This is a standalone program, it only links the output layer
+ *  (tracebin.c, traceout.c and traceagg.c), not R.
+ */
+
+#include <stdio.h>
+#include "traceout.h"
+
+int main(int argc, char **argv) {
+    if (argc < 2 || argc > 3) {
+	fprintf(stderr, "Usage: %s trace_summary.bin [output]\n", argv[0]);
+	return 2;
+    }
+
+    tracebin_t *tb = tracebin_open(argv[1]);
+    if (tb == NULL) {
+	fprintf(stderr, "%s: %s is not a binary trace file (version %d)\n",
+		argv[0], argv[1], TRACEBIN_VERSION);
+	return 1;
+    }
+
+    const tracebin_header_t *hdr = tracebin_header(tb);
+    if (hdr->last_seq == 0) {
+	fprintf(stderr, "%s: %s contains no complete checkpoint\n", argv[0], argv[1]);
+	tracebin_close(tb);
+	return 1;
+    }
+    if (!hdr->last_final)
+	fprintf(stderr, "%s: run did not finish, using checkpoint %u\n",
+		argv[0], hdr->last_seq);
+
+    FILE *fd = stdout;
+    if (argc == 3 && (fd = fopen(argv[2], "w")) == NULL) {
+	perror(argv[2]);
+	tracebin_close(tb);
+	return 1;
+    }
+
+    traceout_t *out = trout_open_text(fd);
+    unsigned int sections = 0;
+    int res = out ? trout_replay(out, tb, &sections) : -1;
+    if (res)
+	fprintf(stderr, "%s: checkpoint %u is damaged, output is incomplete\n",
+		argv[0], hdr->last_seq);
+
+    trout_close(out);
+    if (fd != stdout)
+	fclose(fd);
+    tracebin_close(tb);
+
+    return res ? 1 : 0;
+}
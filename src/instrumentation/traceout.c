@@ -0,0 +1,407 @@
+/*
+ *  r-instrumented : Various measurements for R
+ *  Copyright (C) 2014  TU Dortmund Informatik LS XII
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, a copy is available at
+ *  http://www.r-project.org/Licenses/
+ *
+ *  traceout.c: trace summary output in text or binary format
+ *
+ *  The text backend writes the tab separated trace_summary format
+ *  directly. The binary backend stores the same information as records
+ *  in a tracebin ring; keywords are replaced by small integer ids that
+ *  are defined once per checkpoint. Binary files of other processes are
+ *  copied by replaying their records through the same functions, so
+ *  they can end up in either format.
+ */
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "traceout.h"
+
+#define KEYSLOTS 1024  // must be a power of two
+
+typedef struct {
+    char    *name;
+    uint16_t id;
+} keyslot_t;
+
+struct traceout {
+    FILE       *fd;     // text backend
+    tracebin_t *tb;     // binary backend
+
+    keyslot_t   keys[KEYSLOTS];
+    uint16_t    nkeys;
+
+    traceagg_t *agg;
+};
+
+traceout_t *trout_open_text(FILE *fd) {
+    traceout_t *out = calloc(1, sizeof(traceout_t));
+    if (out)
+	out->fd = fd;
+    return out;
+}
+
+traceout_t *trout_open_binary(tracebin_t *tb) {
+    traceout_t *out = calloc(1, sizeof(traceout_t));
+    if (out)
+	out->tb = tb;
+    return out;
+}
+
+static void reset_keys(traceout_t *out) {
+    for (unsigned int i = 0; i < KEYSLOTS; i++) {
+	free(out->keys[i].name);
+	out->keys[i].name = NULL;
+    }
+    out->nkeys = 0;
+}
+
+void trout_close(traceout_t *out) {
+    if (out == NULL)
+	return;
+    reset_keys(out);
+    free(out);
+}
+
+void trout_begin(traceout_t *out, int final) {
+    if (out->tb) {
+	reset_keys(out);
+	tracebin_begin(out->tb, final);
+    }
+}
+
+void trout_end(traceout_t *out) {
+    if (out->tb)
+	tracebin_end(out->tb);
+}
+
+
+/*
+ * binary helpers
+ */
+
+static void append_string(traceout_t *out, tracebin_kind_t kind,
+			  uint16_t key, const char *str) {
+    tracebin_record_t rec;
+    size_t len = strlen(str);
+
+    /* an empty string still needs one record */
+    do {
+	size_t chunk = len > TRACEBIN_STRBYTES ? TRACEBIN_STRBYTES : len;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.kind  = kind;
+	rec.key   = key;
+	rec.nvals = chunk;
+	rec.more  = len > chunk;
+	memcpy(rec.v.s, str, chunk);
+	tracebin_append(out->tb, &rec);
+
+	str += chunk;
+	len -= chunk;
+    } while (len > 0);
+}
+
+static uint16_t key_id(traceout_t *out, const char *key) {
+    unsigned int h = 5381;
+
+    for (const char *p = key; *p; p++)
+	h = h * 33 + (unsigned char)*p;
+
+    for (unsigned int i = 0; i < KEYSLOTS; i++) {
+	keyslot_t *slot = &out->keys[(h + i) & (KEYSLOTS - 1)];
+
+	if (slot->name == NULL) {
+	    if (out->nkeys >= KEYSLOTS - 1)
+		break;
+
+	    slot->name = strdup(key);
+	    slot->id   = ++out->nkeys;
+	    append_string(out, TRB_KEYDEF, slot->id, key);
+	    return slot->id;
+	}
+
+	if (!strcmp(slot->name, key))
+	    return slot->id;
+    }
+
+    /* table full: id 0 makes the converter print "?" as keyword */
+    return 0;
+}
+
+
+/*
+ * output functions
+ */
+
+void trout_record(traceout_t *out, const char *key, const tracebin_record_t *rec) {
+    if (out->agg)
+	tragg_row(out->agg, key, rec);
+
+    if (out->fd) {
+	fputs(key, out->fd);
+	for (unsigned int i = 0; i < rec->nvals; i++) {
+	    if (rec->fmask & (1 << i))
+		fprintf(out->fd, "\t%f", rec->v.d[i]);
+	    else if (rec->smask & (1 << i))
+		fprintf(out->fd, "\t%ld", (long)rec->v.i[i]);
+	    else
+		fprintf(out->fd, "\t%lu", (unsigned long)rec->v.u[i]);
+	}
+	fputc('\n', out->fd);
+    } else {
+	tracebin_record_t copy = *rec;
+
+	copy.kind = TRB_ROW;
+	copy.key  = key_id(out, key);
+	tracebin_append(out->tb, &copy);
+    }
+}
+
+void trout_row(traceout_t *out, const char *key, const char *types, ...) {
+    tracebin_record_t rec;
+    va_list args;
+
+    va_start(args, types);
+
+    memset(&rec, 0, sizeof(rec));
+    for (const char *t = types; *t && rec.nvals < TRACEBIN_MAXVALS; t++) {
+	int i = rec.nvals++;
+
+	switch (*t) {
+	case 'd': rec.v.i[i] = va_arg(args, int);           rec.smask |= 1 << i; break;
+	case 'u': rec.v.u[i] = va_arg(args, unsigned int);                       break;
+	case 'l': rec.v.i[i] = va_arg(args, long);          rec.smask |= 1 << i; break;
+	case 'L': rec.v.u[i] = va_arg(args, unsigned long);                      break;
+	case 'z': rec.v.u[i] = va_arg(args, size_t);                             break;
+	case 'f': rec.v.d[i] = va_arg(args, double);        rec.fmask |= 1 << i; break;
+	}
+    }
+
+    va_end(args);
+
+    trout_record(out, key, &rec);
+}
+
+void trout_string(traceout_t *out, const char *key, const char *value) {
+    if (out->fd)
+	fprintf(out->fd, "%s\t%s\n", key, value);
+    else
+	append_string(out, TRB_STRING, key_id(out, key), value);
+}
+
+void trout_label(traceout_t *out, const char *labels) {
+    if (out->agg)
+	tragg_label(out->agg, labels);
+
+    if (out->fd)
+	fprintf(out->fd, "#!LABEL\t%s\n", labels);
+    else
+	append_string(out, TRB_LABEL, 0, labels);
+}
+
+void trout_table(traceout_t *out, const char *key, const char *name) {
+    if (out->agg)
+	tragg_table(out->agg, key, name);
+
+    if (out->fd)
+	fprintf(out->fd, "#!TABLE\t%s\t%s\n", key, name);
+    else
+	append_string(out, TRB_TABLE, key_id(out, key), name);
+}
+
+void trout_comment(traceout_t *out, const char *text) {
+    if (out->fd)
+	fprintf(out->fd, "# %s\n", text);
+    else
+	append_string(out, TRB_COMMENT, 0, text);
+}
+
+void trout_line(traceout_t *out, const char *line) {
+    if (out->fd)
+	fprintf(out->fd, "%s\n", line);
+    else
+	append_string(out, TRB_LINE, 0, line);
+}
+
+void trout_section(traceout_t *out, unsigned int child, long pid, long parent) {
+    if (out->fd) {
+	fprintf(out->fd, "#!CHILD\t%u\t%ld\t%ld\n", child, pid, parent);
+    } else {
+	tracebin_record_t rec;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.kind   = TRB_SECTION;
+	rec.nvals  = 3;
+	rec.smask  = 7;
+	rec.v.i[0] = child;
+	rec.v.i[1] = pid;
+	rec.v.i[2] = parent;
+	tracebin_append(out->tb, &rec);
+
+	/* the section brings its own keyword ids */
+	reset_keys(out);
+    }
+}
+
+void trout_aggregate(traceout_t *out, unsigned int processes) {
+    if (out->fd) {
+	fprintf(out->fd, "#!AGGREGATE\t%u\n", processes);
+    } else {
+	tracebin_record_t rec;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.kind   = TRB_AGGREGATE;
+	rec.nvals  = 1;
+	rec.v.u[0] = processes;
+	tracebin_append(out->tb, &rec);
+	reset_keys(out);
+    }
+}
+
+void trout_set_aggregate(traceout_t *out, traceagg_t *agg) {
+    out->agg = agg;
+}
+
+
+/*
+ * copying binary files
+ */
+
+#define REPLAY_KEYS 65536
+
+typedef struct {
+    traceout_t   *out;
+    unsigned int *sections;
+    char        **keys;   // keyword ids of the file being read
+
+    /* string assembled from continuation records */
+    char         *str;
+    size_t        len;
+    size_t        max;
+} replay_t;
+
+static const char *replay_key(replay_t *rp, uint16_t key) {
+    return rp->keys[key] ? rp->keys[key] : "?";
+}
+
+static void replay_reset_keys(replay_t *rp) {
+    for (unsigned int i = 0; i < REPLAY_KEYS; i++) {
+	free(rp->keys[i]);
+	rp->keys[i] = NULL;
+    }
+}
+
+static int replay_chunk(replay_t *rp, const tracebin_record_t *rec) {
+    if (rp->len + rec->nvals + 1 > rp->max) {
+	size_t newmax = 2 * (rp->len + rec->nvals + 1);
+	char *newstr = realloc(rp->str, newmax);
+
+	if (newstr == NULL)
+	    return -1;
+	rp->str = newstr;
+	rp->max = newmax;
+    }
+
+    memcpy(rp->str + rp->len, rec->v.s, rec->nvals);
+    rp->len += rec->nvals;
+    rp->str[rp->len] = 0;
+    return 0;
+}
+
+static int replay_record(const tracebin_record_t *rec, void *data) {
+    replay_t *rp = data;
+    traceout_t *out = rp->out;
+
+    switch (rec->kind) {
+    case TRB_ROW:
+	trout_record(out, replay_key(rp, rec->key), rec);
+	return 0;
+
+    case TRB_SECTION:
+	replay_reset_keys(rp);
+	trout_section(out, ++*rp->sections, rec->v.i[1], rec->v.i[2]);
+	return 0;
+
+    case TRB_AGGREGATE:
+	replay_reset_keys(rp);
+	trout_aggregate(out, rec->v.u[0]);
+	return 0;
+
+    case TRB_KEYDEF:
+    case TRB_STRING:
+    case TRB_LABEL:
+    case TRB_TABLE:
+    case TRB_COMMENT:
+    case TRB_LINE:
+	break;
+
+    default:
+	/* unknown kinds are left out */
+	return 0;
+    }
+
+    /* string records, wait for the last chunk */
+    if (replay_chunk(rp, rec))
+	return -1;
+    if (rec->more)
+	return 0;
+
+    switch (rec->kind) {
+    case TRB_KEYDEF:
+	free(rp->keys[rec->key]);
+	rp->keys[rec->key] = strdup(rp->str);
+	break;
+    case TRB_STRING:
+	trout_string(out, replay_key(rp, rec->key), rp->str);
+	break;
+    case TRB_LABEL:
+	trout_label(out, rp->str);
+	break;
+    case TRB_TABLE:
+	trout_table(out, replay_key(rp, rec->key), rp->str);
+	break;
+    case TRB_COMMENT:
+	trout_comment(out, rp->str);
+	break;
+    case TRB_LINE:
+	trout_line(out, rp->str);
+	break;
+    }
+
+    rp->len = 0;
+    return 0;
+}
+
+int trout_replay(traceout_t *out, const tracebin_t *tb, unsigned int *sections) {
+    replay_t rp;
+
+    memset(&rp, 0, sizeof(rp));
+    rp.out      = out;
+    rp.sections = sections;
+    rp.keys     = calloc(REPLAY_KEYS, sizeof(char *));
+    if (rp.keys == NULL)
+	return -1;
+
+    int res = tracebin_foreach(tb, replay_record, &rp);
+
+    replay_reset_keys(&rp);
+    free(rp.keys);
+    free(rp.str);
+    return res;
+}
@@ -82,19 +82,21 @@ do_commandArgs(SEXP call, SEXP op, SEXP args, SEXP env)
     return vals;
 }
 
-void write_commandArgs(FILE* out) { /* Trace instrumentation */
+void format_commandArgs(char *buf, size_t size) { /* Trace instrumentation */
     int i;
+    size_t len = 0;
     Rboolean args_seen = FALSE;
 
-    fprintf(out, "\"");
-    for (i = 0; i < NumCommandLineArgs; i++) {
+    len += snprintf(buf + len, size - len, "\"");
+    for (i = 0; i < NumCommandLineArgs && len < size; i++) {
         if (args_seen)
-            fprintf(out, "%s ", CommandLineArgs[i]);
+            len += snprintf(buf + len, size - len, "%s ", CommandLineArgs[i]);
 
         if (!strcmp (CommandLineArgs[i], "--args"))
             args_seen = TRUE;
     }
-    fprintf(out, "\"\n");
+    if (len < size)
+        snprintf(buf + len, size - len, "\"");
 }
 
 #ifdef Win32
@@ -217,6 +219,55 @@ R_common_command_line(int *pac, char **argv, Rstart Rp)
 	    else if (!strcmp(*av, "--trace-externalcalls")) {
 		Rp->TraceExternalCalls = TRUE;
 	    }
+	    else if (!strncmp(*av, "--trace-format=", 15)) {
+		p = &(*av)[15];
+		if (!strcmp(p, "text"))
+		    Rp->TraceFormat = TR_FORMAT_TEXT;
+		else if (!strcmp(p, "binary"))
+		    Rp->TraceFormat = TR_FORMAT_BINARY;
+		else {
+		    snprintf(msg, 1024,
+			     _("WARNING: unknown trace format '%s', using text"), p);
+		    R_ShowMessage(msg);
+		}
+	    }
+	    else if (!strncmp(*av, "--trace-checkpoint=", 19)) {
+		Rp->TraceCheckpoint = atoi(&(*av)[19]);
+		if (Rp->TraceCheckpoint < 0)
+		    Rp->TraceCheckpoint = 0;
+	    }
+	    else if (!strcmp(*av, "--trace-closures")) {
+		Rp->TraceClosures = 50;
+	    }
+	    else if (!strncmp(*av, "--trace-closures=", 17)) {
+		Rp->TraceClosures = atoi(&(*av)[17]);
+		if (Rp->TraceClosures < 0)
+		    Rp->TraceClosures = 0;
+	    }
+	    else if (!strcmp(*av, "--trace-allocsample")) {
+		Rp->TraceAllocSample = 512 * 1024;
+	    }
+	    else if (!strncmp(*av, "--trace-allocsample=", 20)) {
+		Rp->TraceAllocSample = atol(&(*av)[20]);
+		if (Rp->TraceAllocSample < 0)
+		    Rp->TraceAllocSample = 0;
+	    }
+	    else if (!strcmp(*av, "--trace-nativecalls")) {
+		Rp->TraceNativeCalls = TRUE;
+	    }
+	    else if (!strcmp(*av, "--trace-bcprof")) {
+		Rp->TraceBCProf = 100;
+	    }
+	    else if (!strncmp(*av, "--trace-bcprof=", 15)) {
+		Rp->TraceBCProf = atoi(&(*av)[15]);
+		if (Rp->TraceBCProf < 0)
+		    Rp->TraceBCProf = 0;
+	    }
+	    else if (!strncmp(*av, "--trace-meminterval=", 20)) {
+		Rp->TraceMemInterval = atoi(&(*av)[20]);
+		if (Rp->TraceMemInterval < 0)
+		    Rp->TraceMemInterval = 0;
+	    }
 	    else if (!strncmp(*av, "--encoding", 10)) {
 		if(strlen(*av) < 12) {
 		    if(ac > 1) {ac--; av++; p = *av;} else p = NULL;
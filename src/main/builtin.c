@@ -413,6 +413,9 @@ SEXP attribute_hidden do_parentenvgets(SEXP call, SEXP op, SEXP args, SEXP rho)
 	error(_("'parent' is not an environment"));
 
     SET_ENCLOS(env, parent);
+    /* method and function lookups may now find other bindings */
+    R_S3MethodsEpoch++;
+    R_FunCacheEpoch++;
 
     return( CAR(args) );
 }
@@ -1436,6 +1436,153 @@ SEXP attribute_hidden do_pipe(SEXP call, SEXP op, SEXP args, SEXP env)
 /* ------------------- [bgx]zipped file connections --------------------- */
 
 #include "gzio.h"
+#include <lzma.h>
+
+/* Block-parallel compression.  With more than one thread the output of
+   gzfile, xzfile and gzcon connections is collected in blocks of
+   BLOCKZ_SIZE bytes, and a batch of one block per thread is compressed
+   in parallel, each block into a gzip member or xz stream of its own.
+   Both formats allow concatenation, so readers see a single stream.
+   Blocks are written in order and do not depend on the number of
+   threads.  Indexed gzip members record their sizes for seeking (see
+   gzio.h). */
+
+#define BLOCKZ_SIZE (1024 * 1024)
+#define BLOCKZ_MAX_THREADS 64
+
+/* blocks compressed and their bytes, for the tracer */
+unsigned long blockz_blocks, blockz_bytes_in, blockz_bytes_out;
+
+typedef size_t (*blockz_sink_t)(const void *ptr, size_t n, void *data);
+
+typedef struct blockz {
+    Rboolean xz;	/* xz streams rather than gzip members */
+    int level, threads;
+    Rboolean index;
+    unsigned char *in, *out;
+    size_t nin, outbound;	/* bytes in, space for each output block */
+    size_t outlen[BLOCKZ_MAX_THREADS];
+    double total;	/* bytes written to the connection */
+    Rboolean written;
+    blockz_sink_t sink;
+    void *sinkdata;
+} *Rblockz;
+
+static size_t blockz_bound(Rboolean xz, size_t len)
+{
+    return xz ? lzma_stream_buffer_bound(len) : R_gzmember_bound(len);
+}
+
+static Rblockz blockz_new(Rboolean xz, int level, int threads,
+			  Rboolean index, blockz_sink_t sink, void *data)
+{
+    Rblockz bz = calloc(1, sizeof(struct blockz));
+    if (!bz) return NULL;
+    bz->xz = xz;
+    bz->level = level;
+    bz->threads = threads < 1 ? 1 :
+	(threads > BLOCKZ_MAX_THREADS ? BLOCKZ_MAX_THREADS : threads);
+    bz->index = index;
+    bz->outbound = blockz_bound(xz, BLOCKZ_SIZE);
+    bz->in = malloc((size_t) bz->threads * BLOCKZ_SIZE);
+    bz->out = malloc((size_t) bz->threads * bz->outbound);
+    if (!bz->in || !bz->out) {
+	free(bz->in); free(bz->out); free(bz);
+	return NULL;
+    }
+    bz->sink = sink;
+    bz->sinkdata = data;
+    return bz;
+}
+
+static size_t blockz_compress(Rblockz bz, unsigned char *out,
+			      const unsigned char *in, size_t len)
+{
+    if (bz->xz) {
+	uint32_t preset = abs(bz->level);
+	size_t pos = 0;
+	if (bz->level < 0) preset |= LZMA_PRESET_EXTREME;
+	if (lzma_easy_buffer_encode(preset, LZMA_CHECK_CRC32, NULL, in, len,
+				    out, &pos, bz->outbound) != LZMA_OK)
+	    return 0;
+	return pos;
+    }
+    return R_gzmember(out, bz->outbound, in, len, bz->level, bz->index);
+}
+
+/* compresses and writes the collected input, FALSE on failure */
+static Rboolean blockz_flush(Rblockz bz)
+{
+    int i, nblocks = (int) ((bz->nin + BLOCKZ_SIZE - 1) / BLOCKZ_SIZE);
+
+    if (nblocks == 0) return TRUE;
+#ifdef _OPENMP
+    int nthreads = nblocks < bz->threads ? nblocks : bz->threads;
+# pragma omp parallel for num_threads(nthreads) schedule(static, 1)
+#endif
+    for (i = 0; i < nblocks; i++) {
+	size_t off = (size_t) i * BLOCKZ_SIZE;
+	size_t len = bz->nin - off < BLOCKZ_SIZE ? bz->nin - off : BLOCKZ_SIZE;
+	bz->outlen[i] = blockz_compress(bz, bz->out + i * bz->outbound,
+					bz->in + off, len);
+    }
+    for (i = 0; i < nblocks; i++) {
+	if (bz->outlen[i] == 0 ||
+	    bz->sink(bz->out + i * bz->outbound, bz->outlen[i], bz->sinkdata)
+	    != bz->outlen[i])
+	    return FALSE;
+	blockz_bytes_out += bz->outlen[i];
+    }
+    blockz_blocks += nblocks;
+    blockz_bytes_in += bz->nin;
+    bz->nin = 0;
+    bz->written = TRUE;
+    return TRUE;
+}
+
+static size_t blockz_write(Rblockz bz, const void *ptr, size_t n)
+{
+    size_t size = (size_t) bz->threads * BLOCKZ_SIZE, done = 0;
+
+    while (done < n) {
+	size_t this = size - bz->nin;
+	if (this > n - done) this = n - done;
+	memcpy(bz->in + bz->nin, (const char *) ptr + done, this);
+	bz->nin += this;
+	done += this;
+	if (bz->nin == size && !blockz_flush(bz))
+	    break;
+    }
+    bz->total += done;
+    return done;
+}
+
+/* writes the rest and frees bz; an empty output is still one block */
+static Rboolean blockz_close(Rblockz bz)
+{
+    Rboolean ok;
+    if (!bz->written && bz->nin == 0) {
+	size_t len = blockz_compress(bz, bz->out, bz->in, 0);
+	ok = len > 0 && bz->sink(bz->out, len, bz->sinkdata) == len;
+    } else
+	ok = blockz_flush(bz);
+    free(bz->in); free(bz->out); free(bz);
+    return ok;
+}
+
+static size_t blockz_fwrite(const void *ptr, size_t n, void *data)
+{
+    return fwrite(ptr, 1, n, (FILE *) data);
+}
+
+/* the number of threads for block-parallel compression */
+static int asCompressThreads(SEXP s)
+{
+    int threads = asInteger(s);
+    if (threads == NA_INTEGER || threads < 1)
+	error(_("invalid '%s' argument"), "threads");
+    return threads;
+}
 
 /* needs to be declared before con_close1 */
 typedef struct gzconn {
@@ -1448,12 +1595,18 @@ typedef struct gzconn {
     int nsaved;
     char saved[2];
     Rboolean allow;
+    int threads;
+    Rblockz bz; /* block-parallel output, or NULL */
 } *Rgzconn;
 
 
 typedef struct gzfileconn {
     void *fp;
     int compress;
+    int threads;
+    Rboolean index;
+    FILE *bfp; /* file of block-parallel output */
+    Rblockz bz;
 } *Rgzfileconn;
 
 static Rboolean gzfile_open(Rconnection con)
@@ -1462,6 +1615,32 @@ static Rboolean gzfile_open(Rconnection con)
     char mode[6];
     Rgzfileconn gzcon = con->private;
 
+    if((con->mode[0] == 'w' || con->mode[0] == 'a') &&
+       (gzcon->threads > 1 || gzcon->index)) {
+	errno = 0; /* precaution */
+	gzcon->bfp = R_fopen(R_ExpandFileName(con->description),
+			     con->mode[0] == 'w' ? "wb" : "ab");
+	if(!gzcon->bfp) {
+	    warning(_("cannot open compressed file '%s', probable reason '%s'"),
+		    R_ExpandFileName(con->description), strerror(errno));
+	    return FALSE;
+	}
+	gzcon->bz = blockz_new(FALSE, gzcon->compress, gzcon->threads,
+			       gzcon->index, blockz_fwrite, gzcon->bfp);
+	if(!gzcon->bz) {
+	    fclose(gzcon->bfp);
+	    warning(_("allocation of gzfile connection failed"));
+	    return FALSE;
+	}
+	con->isopen = TRUE;
+	con->canwrite = TRUE;
+	con->canread = FALSE;
+	con->text = strchr(con->mode, 'b') ? FALSE : TRUE;
+	set_iconv(con);
+	con->save = -1000;
+	return TRUE;
+    }
+
     strcpy(mode, con->mode);
     /* Must open as binary */
     if(strchr(con->mode, 'w')) snprintf(mode, 6, "wb%1d", gzcon->compress);
@@ -1486,7 +1665,16 @@ static Rboolean gzfile_open(Rconnection con)
 
 static void gzfile_close(Rconnection con)
 {
-    R_gzclose(((Rgzfileconn)(con->private))->fp);
+    Rgzfileconn gzcon = con->private;
+    if(gzcon->bz) {
+	Rboolean ok = blockz_close(gzcon->bz);
+	gzcon->bz = NULL;
+	if(fclose(gzcon->bfp) != 0) ok = FALSE;
+	con->isopen = FALSE;
+	if(!ok) warning(_("problem writing to connection"));
+	return;
+    }
+    R_gzclose(gzcon->fp);
     con->isopen = FALSE;
 }
 
@@ -1502,7 +1690,13 @@ static int gzfile_fgetc_internal(Rconnection con)
    When reading, it either seeks forwards of rewinds and reads again */
 static double gzfile_seek(Rconnection con, double where, int origin, int rw)
 {
-    gzFile  fp = ((Rgzfileconn)(con->private))->fp;
+    Rgzfileconn gzcon = con->private;
+    if(gzcon->bz) {
+	if(!ISNA(where))
+	    error(_("seek is not supported for block-compressed output"));
+	return gzcon->bz->total;
+    }
+    gzFile  fp = gzcon->fp;
     Rz_off_t pos = R_gztell(fp);
     int res, whence = SEEK_SET;
 
@@ -1537,7 +1731,10 @@ static size_t gzfile_read(void *ptr, size_t size, size_t nitems,
 static size_t gzfile_write(const void *ptr, size_t size, size_t nitems,
 			   Rconnection con)
 {
-    gzFile fp = ((Rgzfileconn)(con->private))->fp;
+    Rgzfileconn gzcon = con->private;
+    gzFile fp = gzcon->fp;
+    if (gzcon->bz)
+	return blockz_write(gzcon->bz, ptr, size*nitems)/size;
     /* uses 'unsigned' for len */
     if ((double) size * (double) nitems > UINT_MAX)
 	error(_("too large a block specified"));
@@ -1582,6 +1779,9 @@ static Rconnection newgzfile(const char *description, const char *mode,
 	/* for Solaris 12.5 */ new = NULL;
     }
     ((Rgzfileconn)new->private)->compress = compress;
+    ((Rgzfileconn)new->private)->threads = 1;
+    ((Rgzfileconn)new->private)->index = FALSE;
+    ((Rgzfileconn)new->private)->bz = NULL;
     return new;
 }
 
@@ -1777,6 +1977,8 @@ typedef struct xzfileconn {
     lzma_action action;
     int compress;
     int type;
+    int threads;
+    Rblockz bz; /* block-parallel output, or NULL */
     lzma_filter filters[2];
     lzma_options_lzma opt_lzma;
     unsigned char buf[BUFSIZE];
@@ -1813,6 +2015,14 @@ static Rboolean xzfile_open(Rconnection con)
 	    return FALSE;
 	}
 	xz->stream.avail_in = 0;
+    } else if (xz->threads > 1) {
+	xz->bz = blockz_new(TRUE, xz->compress, xz->threads, FALSE,
+			    blockz_fwrite, xz->fp);
+	if (!xz->bz) {
+	    fclose(xz->fp);
+	    warning(_("allocation of xzfile connection failed"));
+	    return FALSE;
+	}
     } else {
 	lzma_stream *strm = &xz->stream;
 	uint32_t preset_number = abs(xz->compress);
@@ -1840,6 +2050,14 @@ static void xzfile_close(Rconnection con)
 {
     Rxzfileconn xz = con->private;
 
+    if(xz->bz) {
+	Rboolean ok = blockz_close(xz->bz);
+	xz->bz = NULL;
+	if(fclose(xz->fp) != 0) ok = FALSE;
+	con->isopen = FALSE;
+	if(!ok) warning(_("problem writing to connection"));
+	return;
+    }
     if(con->canwrite) {
 	lzma_ret ret;
 	lzma_stream *strm = &(xz->stream);
@@ -1925,6 +2143,7 @@ static size_t xzfile_write(const void *ptr, size_t size, size_t nitems,
     unsigned char buf[BUFSIZE];
 
     if (!s) return 0;
+    if (xz->bz) return blockz_write(xz->bz, ptr, s)/size;
 
     strm->avail_in = s;
     strm->next_in = p;
@@ -1988,6 +2207,7 @@ newxzfile(const char *description, const char *mode, int type, int compress)
     }
     ((Rxzfileconn) new->private)->type = type;
     ((Rxzfileconn) new->private)->compress = compress;
+    ((Rxzfileconn) new->private)->threads = 1;
     return new;
 }
 
@@ -1996,7 +2216,8 @@ SEXP attribute_hidden do_gzfile(SEXP call, SEXP op, SEXP args, SEXP env)
 {
     SEXP sfile, sopen, ans, class, enc;
     const char *file, *open;
-    int ncon, compress = 9;
+    int ncon, compress = 9, threads = 1;
+    Rboolean index = FALSE;
     Rconnection con = NULL;
     int type = PRIMVAL(op);
     int subtype = 0;
@@ -2025,6 +2246,13 @@ SEXP attribute_hidden do_gzfile(SEXP call, SEXP op, SEXP args, SEXP env)
 	if(compress == NA_LOGICAL || abs(compress) > 9)
 	    error(_("invalid '%s' argument"), "compress");
     }
+    if(type != 1)
+	threads = asCompressThreads(CAR(nthcdr(args, 4)));
+    if(type == 0) {
+	index = asLogical(CAR(nthcdr(args, 5)));
+	if(index == NA_LOGICAL)
+	    error(_("invalid '%s' argument"), "index");
+    }
     open = CHAR(STRING_ELT(sopen, 0)); /* ASCII */
     if (type == 0 && (!open[0] || open[0] == 'r')) {
 	/* check magic no */
@@ -2050,12 +2278,15 @@ SEXP attribute_hidden do_gzfile(SEXP call, SEXP op, SEXP args, SEXP env)
     switch(type) {
     case 0:
 	con = newgzfile(file, strlen(open) ? open : "rb", compress);
+	((Rgzfileconn) con->private)->threads = threads;
+	((Rgzfileconn) con->private)->index = index;
 	break;
     case 1:
 	con = newbzfile(file, strlen(open) ? open : "rb", compress);
 	break;
     case 2:
 	con = newxzfile(file, strlen(open) ? open : "rb", subtype, compress);
+	((Rxzfileconn) con->private)->threads = threads;
 	break;
     }
     ncon = NextConnection();
@@ -3500,6 +3731,72 @@ int Rconn_fgetc(Rconnection con)
     return c;
 }
 
+#ifdef HAVE_SYS_STAT_H
+# include <sys/stat.h>
+#endif
+
+/* Whether Rconn_readBlock can read ahead on con in large blocks, which
+   gives the bytes Rconn_fgetc would but without mapping CR and CRLF.
+   Only regular files and compressed files, so reading a pipe, fifo or
+   terminal does not wait for more input than was asked for, and only
+   without re-encoding.  If the caller keeps using con (wasopen), the
+   bytes read ahead have to go back by Rconn_unreadBlock, so that
+   readBin, readChar and seek carry on at the right place: only a
+   regular file can do that cheaply. */
+attribute_hidden
+Rboolean Rconn_canReadBlocks(Rconnection con, Rboolean wasopen)
+{
+    if (!con->isopen || !con->canread || !con->blocking || con->inconv ||
+	con->save != -1000 || con->save2 != -1000)
+	return FALSE;
+    if (streql(con->class, "file")) {
+#ifdef HAVE_SYS_STAT_H
+	Rfileconn this = con->private;
+	struct stat sb;
+# ifdef Win32
+	/* text mode offsets are not byte counts */
+	if (wasopen && con->text) return FALSE;
+# endif
+	return fstat(fileno(this->fp), &sb) == 0 && S_ISREG(sb.st_mode);
+#else
+	return FALSE;
+#endif
+    }
+    if (wasopen) return FALSE;
+    return streql(con->class, "gzfile") || streql(con->class, "bzfile") ||
+	streql(con->class, "xzfile");
+}
+
+/* read up to n bytes from con into buf, taking pushed back lines first;
+   returns the number of bytes read, 0 on EOF */
+attribute_hidden
+size_t Rconn_readBlock(Rconnection con, char *buf, size_t n)
+{
+    while (con->nPushBack > 0) {
+	char *curLine = con->PushBack[con->nPushBack-1];
+	size_t len = strlen(curLine + con->posPushBack);
+	if (len > n) len = n;
+	memcpy(buf, curLine + con->posPushBack, len);
+	con->posPushBack += (int) len;
+	if (con->posPushBack >= strlen(curLine)) {
+	    /* the line is used up, so pop it */
+	    free(curLine);
+	    con->nPushBack--;
+	    con->posPushBack = 0;
+	    if(con->nPushBack == 0) free(con->PushBack);
+	}
+	if (len > 0) return len;
+    }
+    return con->read(buf, 1, n, con);
+}
+
+/* give back the last n bytes Rconn_readBlock read from a regular file */
+attribute_hidden
+void Rconn_unreadBlock(Rconnection con, size_t n)
+{
+    con->seek(con, -(double) n, 2, 1);
+}
+
 #ifdef UNUSED
 int Rconn_ungetc(int c, Rconnection con)
 {
@@ -5258,6 +5555,12 @@ Rconnection R_GetConnection(SEXP sConn) {
 
 #define get_byte() (icon->read(&ccc, 1, 1, icon), ccc)
 
+static size_t gzcon_sink(const void *ptr, size_t n, void *data)
+{
+    Rconnection icon = data;
+    return icon->write(ptr, 1, n, icon);
+}
+
 static Rboolean gzcon_open(Rconnection con)
 {
     Rgzconn priv = con->private;
@@ -5320,6 +5623,13 @@ static Rboolean gzcon_open(Rconnection con)
 	}
 	priv->s.next_in  = priv->buffer;
 	inflateInit2(&(priv->s), -MAX_WBITS);
+    } else if(priv->threads > 1) {
+	priv->bz = blockz_new(FALSE, priv->cp, priv->threads, FALSE,
+			      gzcon_sink, icon);
+	if(!priv->bz) {
+	    warning(_("allocation of 'gzcon' connection failed"));
+	    return FALSE;
+	}
     } else {
 	/* write a header */
 	char head[11];
@@ -5354,7 +5664,11 @@ static void gzcon_close(Rconnection con)
     Rgzconn priv = con->private;
     Rconnection icon = priv->con;
 
-    if(icon->canwrite) {
+    if(priv->bz) {
+	Rboolean ok = blockz_close(priv->bz);
+	priv->bz = NULL;
+	if(!ok) error(_("writing error whilst flushing 'gzcon' connection"));
+    } else if(icon->canwrite) {
 	uInt len;
 	int done = 0;
 	priv->s.avail_in = 0; /* should be zero already anyway */
@@ -5407,6 +5721,32 @@ static int gzcon_byte(Rgzconn priv)
 }
 
 
+/* skips the header of a further gzip member, FALSE at the end */
+static Rboolean gzcon_member(Rgzconn priv)
+{
+    int c, flags, n;
+    uInt len;
+
+    if (gzcon_byte(priv) != gz_magic[0] || gzcon_byte(priv) != gz_magic[1]
+	|| gzcon_byte(priv) != Z_DEFLATED)
+	return FALSE;
+    flags = gzcon_byte(priv);
+    if (flags == EOF || (flags & RESERVED) != 0) return FALSE;
+    for (n = 0; n < 6; n++) gzcon_byte(priv);
+    if ((flags & EXTRA_FIELD) != 0) {
+	len  =  (uInt) gzcon_byte(priv);
+	len += ((uInt) gzcon_byte(priv)) << 8;
+	while (len-- != 0 && gzcon_byte(priv) != EOF) ;
+    }
+    if ((flags & ORIG_NAME) != 0)
+	while ((c = gzcon_byte(priv)) != 0 && c != EOF) ;
+    if ((flags & COMMENT) != 0)
+	while ((c = gzcon_byte(priv)) != 0 && c != EOF) ;
+    if ((flags & HEAD_CRC) != 0)
+	for (n = 0; n < 2; n++) gzcon_byte(priv);
+    return !priv->z_eof;
+}
+
 static size_t gzcon_read(void *ptr, size_t size, size_t nitems,
 			 Rconnection con)
 {
@@ -5470,6 +5810,12 @@ static size_t gzcon_read(void *ptr, size_t size, size_t nitems,
 	    }
 	    /* finally, get (and ignore) length */
 	    for (n = 0; n < 4; n++) gzcon_byte(priv);
+	    /* and continue with a concatenated member */
+	    if (priv->z_err == Z_STREAM_END && gzcon_member(priv)) {
+		inflateReset(&(priv->s));
+		priv->crc = crc32(0L, Z_NULL, 0);
+		priv->z_err = Z_OK;
+	    }
 	}
 	if (priv->z_err != Z_OK || priv->z_eof) break;
     }
@@ -5483,6 +5829,8 @@ static size_t gzcon_write(const void *ptr, size_t size, size_t nitems,
     Rgzconn priv = con->private;
     Rconnection icon = priv->con;
 
+    if (priv->bz)
+	return blockz_write(priv->bz, ptr, size*nitems)/size;
     if ((double) size * (double) nitems > INT_MAX)
 	error(_("too large a block specified"));
     priv->s.next_in = (Bytef*) ptr;
@@ -5513,11 +5861,11 @@ static int gzcon_fgetc(Rconnection con)
 }
 
 
-/* gzcon(con, level, allowNonCompressed) */
+/* gzcon(con, level, allowNonCompressed, text, threads) */
 SEXP attribute_hidden do_gzcon(SEXP call, SEXP op, SEXP args, SEXP rho)
 {
     SEXP ans, class;
-    int icon, level, allow;
+    int icon, level, allow, threads;
     Rconnection incon = NULL, new = NULL;
     char *m, *mode = NULL /* -Wall */,  description[1000];
     Rboolean text;
@@ -5535,6 +5883,7 @@ SEXP attribute_hidden do_gzcon(SEXP call, SEXP op, SEXP args, SEXP rho)
     text = asLogical(CADDDR(args));
     if(text == NA_INTEGER)
         error(_("'text' must be TRUE or FALSE"));
+    threads = asCompressThreads(CAR(nthcdr(args, 4)));
 
     if(incon->isGzcon) {
 	warning(_("this is already a 'gzcon' connection"));
@@ -5586,6 +5935,8 @@ SEXP attribute_hidden do_gzcon(SEXP call, SEXP op, SEXP args, SEXP rho)
     ((Rgzconn)(new->private))->cp = level;
     ((Rgzconn)(new->private))->nsaved = -1;
     ((Rgzconn)(new->private))->allow = allow;
+    ((Rgzconn)(new->private))->threads = threads;
+    ((Rgzconn)(new->private))->bz = NULL;
 
     /* as there might not be an R-level reference to the wrapped connection */
     R_PreserveObject(incon->ex_ptr);
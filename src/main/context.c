@@ -169,6 +169,7 @@ static void R_restore_globals(RCNTXT *cptr)
     R_BCIntActive = cptr->bcintactive;
     R_BCpc = cptr->bcpc;
     R_BCbody = cptr->bcbody;
+    R_BCFrames = cptr->bcframes;
     R_EvalDepth = cptr->evaldepth;
     vmaxset(cptr->vmax);
     R_interrupts_suspended = cptr->intsusp;
@@ -250,6 +251,7 @@ void begincontext(RCNTXT * cptr, int flags,
     cptr->gcenabled = R_GCEnabled;
     cptr->bcpc = R_BCpc;
     cptr->bcbody = R_BCbody;
+    cptr->bcframes = R_BCFrames;
     cptr->bcintactive = R_BCIntActive;
     cptr->evaldepth = R_EvalDepth;
     cptr->callflag = flags;
@@ -179,7 +179,14 @@ attribute_hidden
 DL_FUNC R_dotCallFn(SEXP op, SEXP call, int nargs) {
     R_RegisteredNativeSymbol symbol = {R_CALL_SYM, {NULL}, NULL};
     DL_FUNC fun = NULL;
-    checkValidSymbolId(op, call, &fun, &symbol, NULL);
+    if (traceR_extcalls_active) {
+	char buf[MaxSymbolBytes];
+	buf[0] = 0;
+	checkValidSymbolId(op, call, &fun, &symbol, buf);
+	if (fun)
+	    traceR_extcall_name(symbol.type, buf, fun);
+    } else
+	checkValidSymbolId(op, call, &fun, &symbol, NULL);
     /* should check arg count here as well */
     return fun;
 }
@@ -232,7 +239,7 @@ resolveNativeRoutine(SEXP args, DL_FUNC *fun,
 
     /* We were given a symbol (or an address), so we are done. */
     if (*fun) {
-	traceR_report_external(symbol->type, buf, fun);
+	traceR_extcall_name(symbol->type, buf, *fun);
 	return args;
     }
 
@@ -276,7 +283,7 @@ resolveNativeRoutine(SEXP args, DL_FUNC *fun,
 	   from the namespace defining the function */
 	*fun = R_FindNativeSymbolFromDLL(buf, &dll, symbol, env2);
 	if (*fun) {
-	    traceR_report_external(symbol->type, buf, fun);
+	    traceR_extcall_name(symbol->type, buf, *fun);
 	    return args;
 	}
 	errorcall(call, "\"%s\" not resolved from current namespace (%s)", 
@@ -290,7 +297,7 @@ resolveNativeRoutine(SEXP args, DL_FUNC *fun,
 
     *fun = R_FindSymbol(buf, dll.DLLname, symbol);
     if (*fun) {
-	traceR_report_external(symbol->type, buf, fun);
+	traceR_extcall_name(symbol->type, buf, *fun);
 	return args;
     }
 
@@ -550,6 +557,8 @@ SEXP attribute_hidden do_External(SEXP call, SEXP op, SEXP args, SEXP env)
 		      nargs, symbol.symbol.external->numArgs, buf);
     }
 
+    traceR_extcall_t tcall;
+    traceR_extcall_begin(&tcall, symbol.type, ofun);
     if (PRIMVAL(op) == 1) {
 	R_ExternalRoutine2 fun = (R_ExternalRoutine2) ofun;
 	retval = fun(call, op, args, env);
@@ -557,6 +566,7 @@ SEXP attribute_hidden do_External(SEXP call, SEXP op, SEXP args, SEXP env)
 	R_ExternalRoutine fun = (R_ExternalRoutine) ofun;
 	retval = fun(args);
     }
+    traceR_extcall_end(&tcall);
     vmaxset(vmax);
     return retval;
 }
@@ -571,7 +581,9 @@ SEXP attribute_hidden R_doDotCall(DL_FUNC ofun, int nargs, SEXP *cargs,
 				  SEXP call) {
     VarFun fun = NULL;
     SEXP retval = R_NilValue;	/* -Wall */
+    traceR_extcall_t tcall;
     fun = (VarFun) ofun;
+    traceR_extcall_begin(&tcall, R_CALL_SYM, ofun);
     switch (nargs) {
     case 0:
 	retval = (SEXP)ofun();
@@ -1225,6 +1237,7 @@ SEXP attribute_hidden R_doDotCall(DL_FUNC ofun, int nargs, SEXP *cargs,
     default:
 	errorcall(call, _("too many arguments, sorry"));
     }
+    traceR_extcall_end(&tcall);
     return retval;
 }
 
@@ -1451,6 +1464,23 @@ R_FindNativeSymbolFromDLL(char *name, DllReference *dll,
 #define FILL 0xee
 #define NG 64
 
+/* bytes of an atomic vector argument that .C/.Fortran copied, 0 if it
+   was passed in place (carg is its data pointer) */
+static size_t copiedBytes(SEXP s, void *carg)
+{
+    size_t size;
+
+    switch (TYPEOF(s)) {
+    case RAWSXP:  size = sizeof(Rbyte); break;
+    case LGLSXP:
+    case INTSXP:  size = sizeof(int); break;
+    case REALSXP: size = sizeof(double); break;
+    case CPLXSXP: size = sizeof(Rcomplex); break;
+    default:      return 0;
+    }
+    return carg == DATAPTR(s) ? 0 : size * XLENGTH(s);
+}
+
 SEXP attribute_hidden do_dotCode(SEXP call, SEXP op, SEXP args, SEXP env)
 {
     void **cargs, **cargs0 = NULL /* -Wall */;
@@ -1463,6 +1493,8 @@ SEXP attribute_hidden do_dotCode(SEXP call, SEXP op, SEXP args, SEXP env)
     R_NativePrimitiveArgType *checkTypes = NULL;
     const void *vmax;
     char symName[MaxSymbolBytes];
+    traceR_extcall_t tcall;
+    size_t bytes_in = 0, bytes_out = 0;
 
     if (length(args) < 1) errorcall(call, _("'.NAME' is missing"));
     check1arg2(args, call, ".NAME");
@@ -1738,9 +1770,12 @@ SEXP attribute_hidden do_dotCode(SEXP call, SEXP op, SEXP args, SEXP env)
 	    cargs[na] =  (void*) s;
 	    break;
 	}
+	if (traceR_extcalls_active)
+	    bytes_in += copiedBytes(s, s == CAR(pa) ? cargs[na] : NULL);
 	if (nprotect) UNPROTECT(nprotect);
     }
 
+    traceR_extcall_begin(&tcall, symbol.type, ofun);
     switch (nargs) {
     case 0:
 	/* Silicon graphics C chokes here */
@@ -2335,6 +2370,7 @@ SEXP attribute_hidden do_dotCode(SEXP call, SEXP op, SEXP args, SEXP env)
     default:
 	errorcall(call, _("too many arguments, sorry"));
     }
+    traceR_extcall_end(&tcall);
 
     for (na = 0, pa = args ; pa != R_NilValue ; pa = CDR(pa), na++) {
 	void *p = cargs[na];
@@ -2512,6 +2548,8 @@ SEXP attribute_hidden do_dotCode(SEXP call, SEXP op, SEXP args, SEXP env)
 	default:
 	    break;
 	}
+	if (tcall.id >= 0 && s != VECTOR_ELT(ans, na))
+	    bytes_out += copiedBytes(s, NULL);
 	if (s != arg) {
 	    PROTECT(s);
 	    SHALLOW_DUPLICATE_ATTRIB(s, arg);
@@ -2519,6 +2557,7 @@ SEXP attribute_hidden do_dotCode(SEXP call, SEXP op, SEXP args, SEXP env)
 	    UNPROTECT(1);
 	}
     }
+    traceR_extcall_copied(&tcall, bytes_in, bytes_out);
     UNPROTECT(1);
     vmaxset(vmax);
     return ans;
@@ -137,11 +137,14 @@ void attribute_hidden reset_duplicate_counter(void)
 SEXP duplicate(SEXP s){
     SEXP t;
 
+    unsigned long elts = duplicate_elts;
+
     duplicate_object++;
 #ifdef R_PROFILING
     duplicate_counter++;
 #endif
     t = duplicate1(s, TRUE);
+    traceR_count_closure_duplicate(duplicate_elts - elts);
 #ifdef R_MEMORY_PROFILING
     if (RTRACE(s) && !(TYPEOF(s) == CLOSXP || TYPEOF(s) == BUILTINSXP ||
 		      TYPEOF(s) == SPECIALSXP || TYPEOF(s) == PROMSXP ||
@@ -156,11 +159,13 @@ SEXP duplicate(SEXP s){
 SEXP shallow_duplicate(SEXP s)
 {
     SEXP t;
+    unsigned long elts = duplicate_elts;
 
 #ifdef R_PROFILING
     duplicate_counter++;
 #endif
     t = duplicate1(s, FALSE);
+    traceR_count_closure_duplicate(duplicate_elts - elts);
 #ifdef R_MEMORY_PROFILING
     if (RTRACE(s) && !(TYPEOF(s) == CLOSXP || TYPEOF(s) == BUILTINSXP ||
 		      TYPEOF(s) == SPECIALSXP || TYPEOF(s) == PROMSXP ||
@@ -120,6 +120,7 @@
   if (BINDING_IS_LOCKED(__b__)) \
     error(_("cannot change value of locked binding for '%s'"), \
 	  CHAR(PRINTNAME(TAG(__b__)))); \
+  R_CachedSymbolChanged(TAG(__b__)); \
   if (IS_ACTIVE_BINDING(__b__)) \
     setActiveValue(CAR(__b__), __val__); \
   else \
@@ -132,6 +133,7 @@
   if (BINDING_IS_LOCKED(__sym__)) \
     error(_("cannot change value of locked binding for '%s'"), \
 	  CHAR(PRINTNAME(__sym__))); \
+  R_CachedSymbolChanged(__sym__); \
   if (IS_ACTIVE_BINDING(__sym__)) \
     setActiveValue(SYMVALUE(__sym__), __val__); \
   else \
@@ -525,6 +527,38 @@ static SEXP R_HashFrame(SEXP rho)
 }
 
 
+/*----------------------------------------------------------------------
+
+  R_HashClosureFrame
+
+  NewEnvironment builds the frames of closure calls as pairlists, so
+  every lookup that misses the frame (e.g. of a base function) scans all
+  of its bindings. applyClosure hashes the frames of functions with many
+  formals once they are complete, defineVar hashes frames that grow
+  large through local assignments. R_HashFrame keeps the binding cells,
+  so cells cached by the byte code interpreter stay valid.
+*/
+
+#define FRAME_HASH_FORMALS 20	/* formals for a hashed call frame */
+#define FRAME_HASH_BINDINGS 32	/* bindings before defineVar hashes a frame */
+
+unsigned long hashed_frames_call, hashed_frames_grown; /* trace counters */
+
+static void R_HashLargeFrame(SEXP rho, int size)
+{
+    SET_HASHTAB(rho, R_NewHashTable(size < HASHMINSIZE ? HASHMINSIZE : size));
+    R_HashFrame(rho);
+}
+
+void attribute_hidden R_HashClosureFrame(SEXP rho, int nformals)
+{
+    if (nformals >= FRAME_HASH_FORMALS && HASHTAB(rho) == R_NilValue) {
+	R_HashLargeFrame(rho, nformals);
+	hashed_frames_call++;
+    }
+}
+
+
 /* ---------------------------------------------------------------------
 
    R_HashProfile
@@ -850,6 +884,7 @@ void attribute_hidden unbindVar(SEXP symbol, SEXP rho)
 	if (found) {
 	    if (rho == R_GlobalEnv) R_DirtyImage = 1;
 	    SET_FRAME(rho, list);
+	    R_CachedSymbolChanged(symbol);
 	}
     }
     else {
@@ -1481,6 +1516,165 @@ SEXP findFun(SEXP symbol, SEXP rho)
     return findFun3(symbol, rho, R_CurrentExpression);
 }
 
+/*----------------------------------------------------------------------
+
+  Function lookup cache
+
+  The GETFUN and GETGLOBFUN instructions of the byte code interpreter
+  look up functions with findFunCached. It remembers the function
+  findFun found for a symbol starting from an environment, so that
+  calling the same base or package function again only compares a few
+  pointers. Function call frames are new on every call, so unhashed
+  frames (other than base) at the start of the search are searched
+  directly, and the cache is keyed by the first environment after
+  them; a lookup finding the symbol in one of those frames is left to
+  findFun. Only the global environment, the environments on the
+  search path and registered namespaces are used as keys, so that
+  short-lived environments do not take up entries.
+
+  Every symbol a cached lookup used is marked. Changing a binding of a
+  marked symbol in any environment, attach, detach, parent.env<- and
+  unregistering a namespace bump R_FunCacheEpoch, which invalidates
+  all entries. The entries do not keep their environments and
+  functions alive: a key can only be collected after it was detached
+  or unregistered, and a function only after its binding changed.
+  Lookups passing user databases or active bindings, or finding
+  unforced promises, are not cached.
+*/
+
+#define FUNCACHE_SETS 512
+#define FUNCACHE_WAYS 2
+
+typedef struct {
+    unsigned int epoch;	/* R_FunCacheEpoch when added, 0 when empty */
+    SEXP symbol, rho, value;
+} funcache_entry_t;
+
+static funcache_entry_t funcache[FUNCACHE_SETS][FUNCACHE_WAYS];
+static unsigned int funcache_next[FUNCACHE_SETS];
+
+/* function lookup cache, for the tracer */
+unsigned long fun_cache_hits, fun_cache_misses, fun_cache_uncached;
+
+static R_INLINE unsigned int funcacheSet(SEXP symbol, SEXP rho)
+{
+    size_t h = (size_t) symbol / sizeof(SEXPREC) * 31 +
+	(size_t) rho / sizeof(SEXPREC);
+    return h % FUNCACHE_SETS;
+}
+
+static R_INLINE int funcacheFrame(SEXP rho)
+{
+    return HASHTAB(rho) == R_NilValue &&
+	rho != R_BaseEnv && rho != R_BaseNamespace && rho != R_EmptyEnv;
+}
+
+/* Whether rho lives until it is detached or unregistered, which bump
+   the epochs of the function lookup and S3 dispatch caches, so that
+   the caches can use it as a key without keeping it alive */
+attribute_hidden
+Rboolean R_EnvIsCacheKey(SEXP rho)
+{
+    if (rho == R_BaseEnv || rho == R_BaseNamespace)
+	return TRUE;
+    for (SEXP t = R_GlobalEnv; t != R_BaseEnv && t != R_EmptyEnv;
+	 t = ENCLOS(t))
+	if (t == rho)
+	    return TRUE;
+    SEXP spec = R_NamespaceEnvSpec(rho);
+    return spec != R_NilValue &&
+	findVarInFrame(R_NamespaceRegistry,
+		       installTrChar(STRING_ELT(spec, 0))) == rho;
+}
+
+/* The function findFun would find without evaluating anything, or NULL
+   if the lookup cannot be cached. */
+static SEXP findFunNoEval(SEXP symbol, SEXP rho)
+{
+    for (; rho != R_EmptyEnv; rho = ENCLOS(rho)) {
+	SEXP vl;
+	if (IS_USER_DATABASE(rho))
+	    return NULL;
+	if (rho == R_BaseEnv || rho == R_BaseNamespace) {
+	    if (IS_ACTIVE_BINDING(symbol))
+		return NULL;
+	    vl = SYMVALUE(symbol);
+	}
+	else {
+	    SEXP cell = findVarLocInFrame(rho, symbol, NULL);
+	    if (cell == R_NilValue)
+		continue;
+	    if (IS_ACTIVE_BINDING(cell))
+		return NULL;
+	    vl = CAR(cell);
+	}
+	if (TYPEOF(vl) == PROMSXP) {
+	    if (PRVALUE(vl) == R_UnboundValue)
+		return NULL;
+	    vl = PRVALUE(vl);
+	}
+	if (TYPEOF(vl) == CLOSXP || TYPEOF(vl) == BUILTINSXP ||
+	    TYPEOF(vl) == SPECIALSXP)
+	    return vl;
+	if (vl == R_MissingArg)
+	    return NULL;
+    }
+    return NULL;
+}
+
+attribute_hidden
+SEXP findFunCached(SEXP symbol, SEXP rho)
+{
+    /* skip the frames of function calls that do not bind the symbol */
+    SEXP start = rho;
+    for (; funcacheFrame(rho); rho = ENCLOS(rho)) {
+	for (SEXP frame = FRAME(rho); frame != R_NilValue; frame = CDR(frame))
+	    if (TAG(frame) == symbol) {
+		fun_cache_uncached++;
+		return findFun(symbol, start);
+	    }
+    }
+    if (rho == R_EmptyEnv) {
+	fun_cache_uncached++;
+	return findFun(symbol, start);
+    }
+
+    unsigned int nset = funcacheSet(symbol, rho);
+    funcache_entry_t *set = funcache[nset], *e = NULL;
+    int w;
+
+    for (w = 0; w < FUNCACHE_WAYS; w++) {
+	e = &set[w];
+	if (e->epoch == R_FunCacheEpoch && e->symbol == symbol &&
+	    e->rho == rho) {
+	    fun_cache_hits++;
+	    return e->value;
+	}
+    }
+
+    SEXP value = findFunNoEval(symbol, rho);
+    if (value == NULL || ! R_EnvIsCacheKey(rho)) {
+	fun_cache_uncached++;
+	return findFun(symbol, start);
+    }
+    fun_cache_misses++;
+
+    /* replace a stale entry, or the oldest one */
+    for (w = 0; w < FUNCACHE_WAYS; w++)
+	if (set[w].epoch != R_FunCacheEpoch)
+	    break;
+    if (w == FUNCACHE_WAYS)
+	w = funcache_next[nset]++ % FUNCACHE_WAYS;
+    e = &set[w];
+
+    SET_FUN_CACHE_SYMBOL(symbol);
+    e->epoch  = R_FunCacheEpoch;
+    e->symbol = symbol;
+    e->rho    = rho;
+    e->value  = value;
+    return value;
+}
+
 /*----------------------------------------------------------------------
 
   defineVar
@@ -1500,6 +1694,8 @@ void defineVar(SEXP symbol, SEXP value, SEXP rho)
     if (rho == R_EmptyEnv)
 	error(_("cannot assign values in the empty environment"));
 
+    R_CachedSymbolChanged(symbol);
+
     if(IS_USER_DATABASE(rho)) {
 	R_ObjectTable *table;
 	table = (R_ObjectTable *) R_ExternalPtrAddr(HASHTAB(rho));
@@ -1526,6 +1722,7 @@ void defineVar(SEXP symbol, SEXP value, SEXP rho)
 
 	if (HASHTAB(rho) == R_NilValue) {
 	    /* First check for an existing binding */
+	    int nframe = 0;
 	    frame = FRAME(rho);
 	    while (frame != R_NilValue) {
 		if (TAG(frame) == symbol) {
@@ -1534,11 +1731,16 @@ void defineVar(SEXP symbol, SEXP value, SEXP rho)
 		    return;
 		}
 		frame = CDR(frame);
+		nframe++;
 	    }
 	    if (FRAME_IS_LOCKED(rho))
 		error(_("cannot add bindings to a locked environment"));
 	    SET_FRAME(rho, CONS(value, FRAME(rho)));
 	    SET_TAG(FRAME(rho), symbol);
+	    if (nframe >= FRAME_HASH_BINDINGS) {
+		R_HashLargeFrame(rho, 2 * nframe);
+		hashed_frames_grown++;
+	    }
 	}
 	else {
 	    c = PRINTNAME(symbol);
@@ -1638,6 +1840,7 @@ static SEXP setVarInFrame(SEXP rho, SEXP symbol, SEXP value)
 	PROTECT(value);
 	SEXP result = table->assign(CHAR(PRINTNAME(symbol)), value, table);
 	UNPROTECT(1);
+	R_CachedSymbolChanged(symbol);
 	return(result);
     }
 
@@ -1841,6 +2044,7 @@ static int RemoveVariable(SEXP name, int hashcode, SEXP env)
 	    if (list == R_NilValue)
 		SET_HASHPRI(hashtab, HASHPRI(hashtab) - 1);
 	    SET_VECTOR_ELT(hashtab, idx, list);
+	    R_CachedSymbolChanged(name);
 #ifdef USE_GLOBAL_CACHE
 	    if (IS_GLOBAL_FRAME(env))
 		R_FlushGlobalCache(name);
@@ -1852,6 +2056,7 @@ static int RemoveVariable(SEXP name, int hashcode, SEXP env)
 	if (found) {
 	    if(env == R_GlobalEnv) R_DirtyImage = 1;
 	    SET_FRAME(env, list);
+	    R_CachedSymbolChanged(name);
 #ifdef USE_GLOBAL_CACHE
 	    if (IS_GLOBAL_FRAME(env))
 		R_FlushGlobalCache(name);
@@ -2416,6 +2621,8 @@ SEXP attribute_hidden do_attach(SEXP call, SEXP op, SEXP args, SEXP env)
 	SET_ENCLOS(t, s);
 	SET_ENCLOS(s, x);
     }
+    R_S3MethodsEpoch++;
+    R_FunCacheEpoch++;
 
     if(!isSpecial) { /* Temporary: need to remove the elements identified by objects(CAR(args)) */
 #ifdef USE_GLOBAL_CACHE
@@ -2477,6 +2684,8 @@ SEXP attribute_hidden do_detach(SEXP call, SEXP op, SEXP args, SEXP env)
 
 	SET_ENCLOS(s, R_BaseEnv);
     }
+    R_S3MethodsEpoch++;
+    R_FunCacheEpoch++;
 #ifdef USE_GLOBAL_CACHE
     if(!isSpecial) {
 	R_FlushGlobalCacheFromTable(HASHTAB(s));
@@ -3258,6 +3467,7 @@ void R_MakeActiveBinding(SEXP sym, SEXP fun, SEXP env)
     if (TYPEOF(env) != ENVSXP &&
 	TYPEOF((env = simple_as_environment(env))) != ENVSXP)
 	error(_("not an environment"));
+    R_CachedSymbolChanged(sym);
     if (env == R_BaseEnv || env == R_BaseNamespace) {
 	if (SYMVALUE(sym) != R_UnboundValue && ! IS_ACTIVE_BINDING(sym))
 	    error(_("symbol already has a regular binding"));
@@ -3415,6 +3625,7 @@ SEXP attribute_hidden do_mkUnbound(SEXP call, SEXP op, SEXP args, SEXP rho)
     if (R_BindingIsActive(sym, R_BaseEnv))
 	error(_("cannot unbind an active binding"));
     SET_SYMVALUE(sym, R_UnboundValue);
+    R_CachedSymbolChanged(sym);
 #ifdef USE_GLOBAL_CACHE
     R_FlushGlobalCache(sym);
 #endif
@@ -3584,6 +3795,8 @@ SEXP attribute_hidden do_unregNS(SEXP call, SEXP op, SEXP args, SEXP rho)
     else
 	hashcode = HASHVALUE(PRINTNAME(name));
     RemoveVariable(name, hashcode, R_NamespaceRegistry);
+    R_S3MethodsEpoch++;
+    R_FunCacheEpoch++;
     return R_NilValue;
 }
 
@@ -915,9 +915,18 @@ static SEXP R_ForSymbol = NULL;
 static SEXP R_WhileSymbol = NULL;
 static SEXP R_RepeatSymbol = NULL;
 
-#define JIT_CACHE_SIZE 1024
+/* The JIT cache is set associative: an expression hash selects a set
+   of JIT_CACHE_WAYS entries, kept in most recently used order. When a
+   full set takes a new entry the least recently used one is evicted.
+   Once the evictions since the last resize reach half the capacity the
+   number of sets is doubled, up to JIT_CACHE_MAXSETS. */
+#define JIT_CACHE_WAYS 4
+#define JIT_CACHE_MINSETS 256
+#define JIT_CACHE_MAXSETS 16384
 static SEXP JIT_cache = NULL;
-static R_exprhash_t JIT_cache_hashes[JIT_CACHE_SIZE];
+static R_exprhash_t *JIT_cache_hashes = NULL;
+static int JIT_cache_sets = 0;
+static unsigned long JIT_cache_evicted = 0; /* since the last resize */
 
 /**** allow MIN_JIT_SCORE, or both, to be changed by environment variables? */
 static int MIN_JIT_SCORE = 50;
@@ -925,6 +934,10 @@ static int MIN_JIT_SCORE = 50;
 
 static struct { unsigned long count, envcount, bdcount; } jit_info = {0, 0, 0};
 
+/* trace counters */
+unsigned long jit_compiled, jit_cache_hits, jit_env_mismatch, jit_cache_evictions;
+unsigned long jit_cache_size;
+
 void attribute_hidden R_init_jit_enabled(void)
 {
     /* Need to force the lazy loading promise to avoid recursive
@@ -984,7 +997,13 @@ void attribute_hidden R_init_jit_enabled(void)
     R_WhileSymbol = install("while");
     R_RepeatSymbol = install("repeat");
 
-    R_PreserveObject(JIT_cache = allocVector(VECSXP, JIT_CACHE_SIZE));
+    JIT_cache_sets = JIT_CACHE_MINSETS;
+    jit_cache_size = JIT_CACHE_MINSETS * JIT_CACHE_WAYS;
+    R_PreserveObject(JIT_cache = allocVector(VECSXP, jit_cache_size));
+    JIT_cache_hashes = (R_exprhash_t *) calloc(jit_cache_size,
+					       sizeof(R_exprhash_t));
+    if (JIT_cache_hashes == NULL)
+	R_Suicide("couldn't allocate the JIT cache");
 }
 
 static int JIT_score(SEXP e)
@@ -1179,19 +1198,100 @@ static R_INLINE SEXP make_cached_cmpenv(SEXP fun)
     }
 }
 
+/* Index of the first entry of the set for hash. */
+static R_INLINE int jit_cache_set(R_exprhash_t hash)
+{
+    return (int) (hash & (JIT_cache_sets - 1)) * JIT_CACHE_WAYS;
+}
+
+/* Move the entry at index from to the front of its set starting at
+   base, shifting the more recently used entries down by one. */
+static R_INLINE void jit_cache_to_front(int base, int from)
+{
+    if (from == base)
+	return;
+    R_exprhash_t hash = JIT_cache_hashes[from];
+    SEXP entry = VECTOR_ELT(JIT_cache, from);
+    for (int i = from; i > base; i--) {
+	JIT_cache_hashes[i] = JIT_cache_hashes[i - 1];
+	SET_VECTOR_ELT(JIT_cache, i, VECTOR_ELT(JIT_cache, i - 1));
+    }
+    JIT_cache_hashes[base] = hash;
+    SET_VECTOR_ELT(JIT_cache, base, entry);
+}
+
+/* Double the number of sets and re-enter the live entries, most
+   recently used ones first so they keep their order within a set. If
+   there is not enough memory the cache keeps its current size. */
+static void grow_jit_cache(void)
+{
+    int nsets = JIT_cache_sets * 2;
+    int size = nsets * JIT_CACHE_WAYS;
+    R_exprhash_t *hashes = (R_exprhash_t *) calloc(size, sizeof(R_exprhash_t));
+    if (hashes == NULL)
+	return;
+
+    SEXP old = JIT_cache;
+    R_exprhash_t *oldhashes = JIT_cache_hashes;
+    int oldsize = JIT_cache_sets * JIT_CACHE_WAYS;
+    SEXP cache = PROTECT(allocVector(VECSXP, size));
+
+    for (int way = 0; way < JIT_CACHE_WAYS; way++)
+	for (int i = way; i < oldsize; i += JIT_CACHE_WAYS) {
+	    SEXP entry = VECTOR_ELT(old, i);
+	    if (entry == R_NilValue)
+		continue;
+	    int base = (int) (oldhashes[i] & (nsets - 1)) * JIT_CACHE_WAYS;
+	    for (int j = base; j < base + JIT_CACHE_WAYS; j++)
+		if (VECTOR_ELT(cache, j) == R_NilValue) {
+		    SET_VECTOR_ELT(cache, j, entry);
+		    hashes[j] = oldhashes[i];
+		    break;
+		}
+	}
+
+    R_PreserveObject(cache);
+    R_ReleaseObject(old);
+    UNPROTECT(1); /* cache */
+    free(oldhashes);
+    JIT_cache = cache;
+    JIT_cache_hashes = hashes;
+    JIT_cache_sets = nsets;
+    JIT_cache_evicted = 0;
+    jit_cache_size = size;
+}
+
 /* Cache entries are CONS cells with the body in CAR, the environment
-   in CDR, and the Srcref in the TAG. */
+   in CDR, and the Srcref in the TAG. An existing entry for the same
+   hash is replaced, otherwise the new entry goes to the front of its
+   set. */
 static R_INLINE void set_jit_cache_entry(R_exprhash_t hash, SEXP val)
 {
-    int hashidx = hash % JIT_CACHE_SIZE;
-
     PROTECT(val);
     SEXP entry = CONS(BODY(val), make_cached_cmpenv(val));
-    SET_VECTOR_ELT(JIT_cache, hashidx, entry);
+    PROTECT(entry);
     SET_TAG(entry, getAttrib(val, R_SrcrefSymbol));
-    UNPROTECT(1); /* val */
 
-    JIT_cache_hashes[hashidx] = hash;
+    if (JIT_cache_evicted >= jit_cache_size / 2 &&
+	JIT_cache_sets < JIT_CACHE_MAXSETS)
+	grow_jit_cache();
+
+    int base = jit_cache_set(hash);
+    int last = base + JIT_CACHE_WAYS - 1;
+    int i;
+    for (i = base; i < last; i++)
+	if (VECTOR_ELT(JIT_cache, i) == R_NilValue ||
+	    JIT_cache_hashes[i] == hash)
+	    break;
+    if (i == last && VECTOR_ELT(JIT_cache, i) != R_NilValue &&
+	JIT_cache_hashes[i] != hash) {
+	jit_cache_evictions++;
+	JIT_cache_evicted++;
+    }
+    SET_VECTOR_ELT(JIT_cache, i, entry);
+    JIT_cache_hashes[i] = hash;
+    jit_cache_to_front(base, i);
+    UNPROTECT(2); /* entry, val */
 }
 
 static R_INLINE SEXP jit_cache_code(SEXP entry)
@@ -1219,14 +1319,25 @@ static R_INLINE SEXP jit_cache_expr(SEXP entry)
 
 static R_INLINE SEXP get_jit_cache_entry(R_exprhash_t hash)
 {
-    int hashidx = hash % JIT_CACHE_SIZE;
-    if (JIT_cache_hashes[hashidx] == hash) {
-	SEXP entry = VECTOR_ELT(JIT_cache, hashidx);
-	if (TYPEOF(jit_cache_code(entry)) == BCODESXP)
-	    return entry;
-	else
-	    /* function has been de-compiled; clear the cache entry */
-	    SET_VECTOR_ELT(JIT_cache, hashidx, R_NilValue);
+    int base = jit_cache_set(hash);
+    for (int i = base; i < base + JIT_CACHE_WAYS; i++) {
+	SEXP entry = VECTOR_ELT(JIT_cache, i);
+	if (entry == R_NilValue)
+	    break;
+	if (JIT_cache_hashes[i] == hash) {
+	    if (TYPEOF(jit_cache_code(entry)) == BCODESXP) {
+		jit_cache_to_front(base, i);
+		return entry;
+	    }
+	    /* function has been de-compiled; clear the cache entry and
+	       close the gap so the empty ways stay at the end */
+	    for (int j = i; j < base + JIT_CACHE_WAYS - 1; j++) {
+		JIT_cache_hashes[j] = JIT_cache_hashes[j + 1];
+		SET_VECTOR_ELT(JIT_cache, j, VECTOR_ELT(JIT_cache, j + 1));
+	    }
+	    SET_VECTOR_ELT(JIT_cache, base + JIT_CACHE_WAYS - 1, R_NilValue);
+	    break;
+	}
     }
     return R_NilValue;
 }
@@ -1244,15 +1355,28 @@ static R_INLINE SEXP cmpenv_topenv(SEXP cmpenv)
 
 static R_INLINE Rboolean cmpenv_exists_local(SEXP sym, SEXP cmpenv, SEXP top)
 {
-    if (cmpenv != top)
+    if (cmpenv != top) {
+	/* defineVar hashes compile environments of many variables */
+	if (HASHTAB(cmpenv) != R_NilValue)
+	    return findVarInFrame3(cmpenv, sym, FALSE) != R_UnboundValue;
 	for (SEXP frame = FRAME(cmpenv);
 	     frame != R_NilValue;
 	     frame = CDR(frame))
 	    if (TAG(frame) == sym)
 		return TRUE;
+    }
     return FALSE;
 }
 
+static R_INLINE Rboolean cmpenv_frame_match(SEXP frame, SEXP cmpenv,
+					    SEXP top)
+{
+    for (; frame != R_NilValue; frame = CDR(frame))
+	if (! cmpenv_exists_local(TAG(frame), cmpenv, top))
+	    return FALSE;
+    return TRUE;
+}
+
 static R_INLINE Rboolean jit_env_match(SEXP cmpenv, SEXP fun)
 {
     /* Can code compiled for environment cmpenv be used as compiled
@@ -1273,14 +1397,18 @@ static R_INLINE Rboolean jit_env_match(SEXP cmpenv, SEXP fun)
 	    if (! cmpenv_exists_local(TAG(frmls), cmpenv, top))
 		return FALSE;
 	for (; env != top; env = ENCLOS(env)) {
+	    /* To keep things simple, for a match this code requires
+	       that the local frames be standard frames; wide call
+	       frames and frames that grew large are hashed. */
 	    if (IS_STANDARD_UNHASHED_FRAME(env)) {
-		/* To keep things simple, for a match this code
-		   requires that the local frames be standard unhashed
-		   frames. */
-		for (SEXP frame = FRAME(env);
-		     frame != R_NilValue;
-		     frame = CDR(frame))
-		    if (! cmpenv_exists_local(TAG(frame), cmpenv, top))
+		if (! cmpenv_frame_match(FRAME(env), cmpenv, top))
+		    return FALSE;
+	    }
+	    else if (IS_STANDARD_HASHED_FRAME(env)) {
+		SEXP h = HASHTAB(env);
+		int n = length(h);
+		for (int i = 0; i < n; i++)
+		    if (! cmpenv_frame_match(VECTOR_ELT(h, i), cmpenv, top))
 			return FALSE;
 	    }
 	    else return FALSE;
@@ -1333,6 +1461,7 @@ SEXP attribute_hidden R_cmpfun(SEXP fun)
 			jit_srcref_match(jit_cache_srcref(entry),
 					 getAttrib(fun, R_SrcrefSymbol))) {
 			PRINT_JIT_INFO;
+			jit_cache_hits++;
 			SET_BODY(fun, jit_cache_code(entry));
 			/**** reset the cache here?*/
 			return fun;
@@ -1351,6 +1480,7 @@ SEXP attribute_hidden R_cmpfun(SEXP fun)
 		/* FIXME: revisit this when deep comparison of environments
 			  (and srcrefs) is available */
 	    } else {
+		jit_env_mismatch++;
 		SET_NOJIT(fun);
 		/**** also mark the cache entry as NOJIT, or as need to see
 		      many times? */
@@ -1361,6 +1491,7 @@ SEXP attribute_hidden R_cmpfun(SEXP fun)
     }
 
     SEXP val = R_cmpfun1(fun);
+    jit_compiled++;
 
     if (TYPEOF(BODY(val)) != BCODESXP)
 	SET_NOJIT(fun);
@@ -1483,6 +1614,7 @@ SEXP applyClosure(SEXP call, SEXP op, SEXP arglist, SEXP rho, SEXP suppliedvars)
 {
     SEXP formals, actuals, savedrho, newrho;
     SEXP f, a;
+    int nformals;
 
     /* formals = list of formal parameters */
     /* actuals = values to be bound to formals */
@@ -1508,7 +1640,7 @@ SEXP applyClosure(SEXP call, SEXP op, SEXP arglist, SEXP rho, SEXP suppliedvars)
     actuals = matchArgs(formals, arglist, call);
     PROTECT(newrho = NewEnvironment(formals, actuals, savedrho));
 
-    trcR_count_closure_args(op); // note: counters are in globals
+    trcR_count_closure_args(op, call); // note: counters are in globals
 
     /* Turn on reference counting for the binding cells so local
        assignments arguments increment REFCNT values */
@@ -1529,6 +1661,7 @@ SEXP applyClosure(SEXP call, SEXP op, SEXP arglist, SEXP rho, SEXP suppliedvars)
 
     f = formals;
     a = actuals;
+    nformals = 0;
     while (f != R_NilValue) {
 	if (CAR(a) == R_MissingArg && CAR(f) != R_MissingArg) {
 	    SETCAR(a, mkPROMISE(CAR(f), newrho));
@@ -1536,6 +1669,7 @@ SEXP applyClosure(SEXP call, SEXP op, SEXP arglist, SEXP rho, SEXP suppliedvars)
 	}
 	f = CDR(f);
 	a = CDR(a);
+	nformals++;
     }
 
     /*  Fix up any extras that were supplied by usemethod. */
@@ -1546,6 +1680,9 @@ SEXP applyClosure(SEXP call, SEXP op, SEXP arglist, SEXP rho, SEXP suppliedvars)
     if (R_envHasNoSpecialSymbols(newrho))
 	SET_NO_SPECIAL_SYMBOLS(newrho);
 
+    /* wide frames are hashed now that they are complete */
+    R_HashClosureFrame(newrho, nformals);
+
     UNPROTECT(1); /* newrho - below protected via context */
 
     /*  If we have a generic function we need to use the sysparent of
@@ -1573,6 +1710,7 @@ static R_INLINE SEXP R_execClosure(SEXP call, SEXP newrho, SEXP sysparent,
 	SEXP newop;
 	R_jit_enabled = 0;
 	newop = R_cmpfun(op);
+	traceR_count_closure_compiled(body, BODY_EXPR(newop));
 	body = BODY(newop);
 	SET_BODY(op, body);
 	R_jit_enabled = old_enabled;
@@ -1952,6 +2090,7 @@ static R_INLINE Rboolean SET_BINDING_VALUE(SEXP loc, SEXP value) {
 	    SETCAR(loc, value);
 	    if (MISSING(loc))
 		SET_MISSING(loc, 0);
+	    R_CachedSymbolChanged(TAG(loc));
 	}
 	return TRUE;
     }
@@ -3459,7 +3598,7 @@ int DispatchGroup(const char* group, SEXP call, SEXP op, SEXP args, SEXP rho,
 }
 
 /* start of bytecode section */
-static int R_bcVersion = 10;
+static int R_bcVersion = 11;
 static int R_bcMinVersion = 9;
 
 static SEXP R_AddSym = NULL;
@@ -3666,9 +3805,20 @@ enum {
   SEQALONG_OP,
   SEQLEN_OP,
   BASEGUARD_OP,
+  SETVAR_POP_OP,
+  GETVAR_PUSHARG_OP,
+  GETVAR_GETVAR_OP,
+  LDCONST_ADD_OP,
+  LDCONST_SUB_OP,
+  LDCONST_MUL_OP,
+  GETVAR_MISSOK_VECSUBSET_OP,
+  GETVAR_MISSOK_VECSUBASSIGN_OP,
   OPCOUNT
 };
 
+/* the opcode profiler of the tracer has statically sized tables */
+typedef char trace_bcprof_size_check[OPCOUNT <= TRACER_BC_MAXOPS ? 1 : -1];
+
 
 SEXP R_unary(SEXP, SEXP, SEXP);
 SEXP R_binary(SEXP, SEXP, SEXP, SEXP);
@@ -3780,6 +3930,67 @@ static R_INLINE SEXP GETSTACK_PTR_TAG(R_bcstack_t *s)
     } while (0)
 
 #define IS_STACKVAL_BOXED(idx)	(R_BCNodeStackTop[idx].tag == 0)
+
+/* The operands of each active bcEval lie between its binding cache and
+   the binding cache of the next bcEval, if any. */
+typedef struct R_bcframe {
+    R_bcstack_t *base;		/* node stack top on entry */
+    R_bcstack_t *ops;		/* first operand, above the binding cache */
+    struct R_bcframe *prev;	/* enclosing bcEval */
+} R_bcframe_t;
+
+#define BC_REFSCAN_MAX 256	/* entries and list cells to scan */
+
+/* Is x referenced by a boxed operand, or by an argument list of a
+   pending call, of this or an enclosing bcEval? Such an operand may
+   have been pushed before an assignment to the variable bound to x,
+   e.g. the first operand of y + { y <- y + 1; y }, or of y + g(y <- 5)
+   when g forces the assignment in a promise, so x must not be modified
+   in place. The binding cell loc of x itself is reached from the cell
+   of a for loop variable. A stack too deep to scan counts as a
+   reference. */
+static Rboolean bcStackRefersTo(SEXP x, SEXP loc)
+{
+    int budget = BC_REFSCAN_MAX;
+    R_bcstack_t *top = R_BCNodeStackTop - 1;
+    for (R_bcframe_t *f = R_BCFrames; f != NULL; f = f->prev) {
+	for (R_bcstack_t *s = f->ops; s < top; s++) {
+	    if (--budget < 0)
+		return TRUE;
+	    if (s->tag == RAWMEM_TAG)
+		s += s->u.ival;
+	    else if (s->tag == 0) {
+		SEXP v = s->u.sxpval;
+		if (v == x)
+		    return TRUE;
+		/* the argument list of a call being built */
+		for (; TYPEOF(v) == LISTSXP; v = CDR(v)) {
+		    if ((CAR(v) == x && v != loc) || --budget < 0)
+			return TRUE;
+		}
+	    }
+	}
+	top = f->base;
+    }
+    return FALSE;
+}
+
+/* Scalars that SETVAR keeps in a private vector per variable. */
+#define IS_LOCAL_SCALAR(x)						\
+    ((TYPEOF(x) == REALSXP || TYPEOF(x) == INTSXP ||			\
+      TYPEOF(x) == LGLSXP) && IS_SIMPLE_SCALAR(x, TYPEOF(x)))
+
+/* Is value bound to a variable of the unhashed frame of rho? Other
+   values, e.g. those returned by closures, can be bound as they are. */
+static R_INLINE Rboolean bcFrameBinds(SEXP rho, SEXP value)
+{
+    if (HASHTAB(rho) != R_NilValue)
+	return FALSE;
+    for (SEXP frame = FRAME(rho); frame != R_NilValue; frame = CDR(frame))
+	if (CAR(frame) == value)
+	    return TRUE;
+    return FALSE;
+}
 #else
 #define GETSTACK_PTR(s) (*(s))
 
@@ -3799,6 +4010,9 @@ static R_INLINE SEXP GETSTACK_PTR_TAG(R_bcstack_t *s)
 #define IS_STACKVAL_BOXED(idx)	(TRUE)
 #endif
 
+/* trace counters of the scalar stores done by SETVAR */
+unsigned long bc_scalar_inplace, bc_scalar_copied, bc_scalar_boxed;
+
 #if defined(TYPED_STACK) && defined(COMPACT_INTSEQ)
 #define SETSTACK_INTSEQ(idx, rn1, rn2) do {	\
 	SEXP info = allocVector(INTSXP, 2);	\
@@ -3888,6 +4102,7 @@ static R_INLINE int bcStackScalarEx(R_bcstack_t *s, scalar_value_t *v,
 	if (pv && NO_REFERENCES(x)) *pv = x;
 #endif
 	v->dval = REAL(x)[0];
+	traceR_count_bc_boxed();
 	return REALSXP;
     }
     else if (IS_SIMPLE_SCALAR(x, INTSXP)) {
@@ -3895,10 +4110,12 @@ static R_INLINE int bcStackScalarEx(R_bcstack_t *s, scalar_value_t *v,
 	if (pv && NO_REFERENCES(x)) *pv = x;
 #endif
 	v->ival = INTEGER(x)[0];
+	traceR_count_bc_boxed();
 	return INTSXP;
     }
     else if (IS_SIMPLE_SCALAR(x, LGLSXP)) {
 	v->ival = LOGICAL(x)[0];
+	traceR_count_bc_boxed();
 	return LGLSXP;
     }
     else return 0;
@@ -3948,6 +4165,7 @@ static R_INLINE int bcStackScalarRealEx(R_bcstack_t *s, scalar_value_t *px,
 	    DO_FAST_RELOP2(op, vx.ival, vy.ival); \
 	} \
     } \
+    traceR_count_bc_fallback(); \
     Relop2(opval, opsym); \
 } while (0)
 
@@ -4090,6 +4308,7 @@ static SEXP cmp_arith2(SEXP call, int opval, SEXP opsym, SEXP x, SEXP y,
 	    SETSTACK_REAL_EX(-1, fun(vx.ival), NULL);			\
 	    NEXT();							\
 	}								\
+	traceR_count_bc_fallback();					\
 	Builtin1(do_math1,sym,rho);					\
     } while (0)
 
@@ -4148,6 +4367,7 @@ static SEXP cmp_arith2(SEXP call, int opval, SEXP opsym, SEXP x, SEXP y,
 	    SETSTACK_INTEGER_EX(-1, op vx.ival, sa);			\
 	    NEXT();							\
 	}								\
+	traceR_count_bc_fallback();					\
 	Arith1(opsym);							\
     } while (0)
 
@@ -4174,6 +4394,7 @@ static SEXP cmp_arith2(SEXP call, int opval, SEXP opsym, SEXP x, SEXP y,
 		DO_FAST_BINOP_INT(op, vx.ival, vy.ival, sa ? sa : sb);	\
 	} \
     } \
+    traceR_count_bc_fallback(); \
     Arith2(opval, opsym); \
 } while (0)
 
@@ -4553,13 +4774,21 @@ typedef union { void *v; int i; } BCODE;
    in bcEval stack frames and thus increasing stack usage
    dramatically */
 volatile
-static struct { void *addr; int argc; char *instname; } opinfo[OPCOUNT];
+static struct {
+    void *addr;
+    void *profaddr;	/* entry counting the instruction, see bcProfiledBody */
+    int argc;
+    char *instname;
+} opinfo[OPCOUNT];
 
 #define OP(name,n) \
   case name##_OP: opinfo[name##_OP].addr = (__extension__ &&op_##name); \
+    opinfo[name##_OP].profaddr = (__extension__ &&opprof_##name); \
     opinfo[name##_OP].argc = (n); \
     opinfo[name##_OP].instname = #name; \
     goto loop; \
+    opprof_##name: \
+    bcprof_prev = traceR_count_opcode(bcprof_prev, name##_OP); \
     op_##name
 
 #define BEGIN_MACHINE  NEXT(); init: { loop: switch(which++)
@@ -4574,12 +4803,15 @@ static struct { void *addr; int argc; char *instname; } opinfo[OPCOUNT];
 #else
 typedef int BCODE;
 
-#define OP(name,argc) case name##_OP
+#define OP(name,argc) case name##_OP: op_##name
 
 #ifdef BC_PROFILING
 #define BEGIN_MACHINE  loop: currentpc = pc; current_opcode = *pc; switch(*pc++)
 #else
-#define BEGIN_MACHINE  loop: currentpc = pc; switch(*pc++)
+#define BEGIN_MACHINE  loop: currentpc = pc; \
+    if (traceR_bcprof_active) \
+	bcprof_prev = traceR_count_opcode(bcprof_prev, *pc); \
+    switch(*pc++)
 #endif
 #define LASTOP  default: error(_("bad opcode"))
 #define INITIALIZE_MACHINE()
@@ -4766,6 +4998,70 @@ static R_INLINE SEXP getvar(SEXP symbol, SEXP rho,
     return value;
 }
 
+/* the body of SETVAR; the value stays on the stack */
+static R_INLINE void bcSetVar(SEXP constants, SEXP rho,
+			      R_binding_cache_t vcache, Rboolean smallcache,
+			      int sidx)
+{
+    SEXP loc;
+    if (smallcache) {
+	loc = GET_SMALLCACHE_BINDING_CELL(vcache, sidx);
+	/* variables that are assigned but not read are only cached
+	   here, so their stores can be done in place as well */
+	if (loc == R_NilValue && vcache != NULL) {
+	    SEXP symbol = VECTOR_ELT(constants, sidx);
+	    loc = GET_BINDING_CELL_CACHE(symbol, rho, vcache, sidx);
+	}
+    }
+    else {
+	SEXP symbol = VECTOR_ELT(constants, sidx);
+	loc = GET_BINDING_CELL_CACHE(symbol, rho, vcache, sidx);
+    }
+#ifdef TYPED_STACK
+    R_bcstack_t *s = R_BCNodeStackTop - 1;
+    /* reading the locked bit is OK even if cell is R_NilValue */
+    if (! BINDING_IS_LOCKED(loc)) {
+	/* if cell is R_NilValue or an active binding, or if the value
+	   is R_UnboundValue, then TYPEOF(CAR(cell)) will not match the
+	   immediate value tag. */
+	SEXP x = CAR(loc);  /* fast, but assumes binding is a CONS */
+	if (s->tag) {
+	    if (NOT_SHARED(x) && IS_SIMPLE_SCALAR(x, s->tag) &&
+		! bcStackRefersTo(x, loc)) {
+		/* if the binding value is not shared and is a simple
+		   scaler of the same type as the immediate value,
+		   then we can copy the stack value into the binding
+		   value */
+		if (traceR_is_active) bc_scalar_inplace++;
+		switch (s->tag) {
+		case REALSXP: REAL(x)[0] = s->u.dval; return;
+		case INTSXP: INTEGER(x)[0] = s->u.ival; return;
+		case LGLSXP: LOGICAL(x)[0] = s->u.ival; return;
+		}
+	    }
+	    if (traceR_is_active) bc_scalar_boxed++;
+	}
+	else if (NAMED(s->u.sxpval) == 1 && s->u.sxpval != x &&
+		 IS_LOCAL_SCALAR(s->u.sxpval) &&
+		 bcFrameBinds(rho, s->u.sxpval)) {
+	    /* the vector of another variable: binding it would make
+	       it shared, and the next store into either variable
+	       would need a new vector; bind a private copy */
+	    if (traceR_is_active) bc_scalar_copied++;
+	    SETSTACK(-1, duplicate(s->u.sxpval));
+	}
+    }
+#endif
+    SEXP value = GETSTACK(-1);
+    INCREMENT_NAMED(value);
+    if (! SET_BINDING_VALUE(loc, value)) {
+	SEXP symbol = VECTOR_ELT(constants, sidx);
+	PROTECT(value);
+	defineVar(symbol, value, rho);
+	UNPROTECT(1);
+    }
+}
+
 #define INLINE_GETVAR
 #ifdef INLINE_GETVAR
 /* Try to handle the most common case as efficiently as possible.  If
@@ -4776,7 +5072,7 @@ static R_INLINE SEXP getvar(SEXP symbol, SEXP rho,
    and R_UnboundValue as these are implemented s symbols.  It also
    rules other symbols, but as those are rare they are handled by the
    getvar() call. */
-#define DO_GETVAR(dd,keepmiss) do { \
+#define DO_GETVAR_THEN(dd,keepmiss,cont) do { \
     int sidx = GETOP(); \
     if (!dd && smallcache) { \
 	SEXP cell = GET_SMALLCACHE_BINDING_CELL(vcache, sidx); \
@@ -4793,7 +5089,7 @@ static R_INLINE SEXP getvar(SEXP symbol, SEXP rho,
 		SET_NAMED(value, 1); \
 	    R_Visible = TRUE; \
 	    BCNPUSH(value); \
-	    NEXT(); \
+	    cont; \
 	} \
 	if (cell != R_NilValue && ! IS_ACTIVE_BINDING(cell)) { \
 	    value = CAR(cell); \
@@ -4810,25 +5106,44 @@ static R_INLINE SEXP getvar(SEXP symbol, SEXP rho,
 		    SET_NAMED(value, 1);				\
 		R_Visible = TRUE;					\
 		BCNPUSH(value);						\
-		NEXT();							\
+		cont;							\
 	    }								\
 	}								\
     }									\
+    traceR_count_bc_fallback();						\
     SEXP symbol = VECTOR_ELT(constants, sidx);				\
     R_Visible = TRUE;							\
     BCNPUSH(getvar(symbol, rho, dd, keepmiss, vcache, sidx));		\
-    NEXT();								\
+    cont;								\
 } while (0)
 #else
-#define DO_GETVAR(dd,keepmiss) do { \
+#define DO_GETVAR_THEN(dd,keepmiss,cont) do { \
   int sidx = GETOP(); \
   SEXP symbol = VECTOR_ELT(constants, sidx); \
   R_Visible = TRUE; \
   BCNPUSH(getvar(symbol, rho, dd, keepmiss, vcache, sidx));	\
-  NEXT(); \
+  cont; \
 } while (0)
 #endif
 
+#define DO_GETVAR(dd,keepmiss) DO_GETVAR_THEN(dd, keepmiss, NEXT())
+
+#define DO_LDCONST() do { \
+    R_Visible = TRUE; \
+    SEXP value = VECTOR_ELT(constants, GETOP()); \
+    if (R_check_constants < 0) \
+	value = duplicate(value); \
+    MARK_NOT_MUTABLE(value); \
+    BCNPUSH(value); \
+} while (0)
+
+/* Superinstructions are emitted by the compiler for common pairs of
+   instructions (see the Superinstructions table in the compiler).
+   After the first instruction is done the second one continues at its
+   body, without dispatch; moving currentpc to its operands makes errors
+   in the second instruction report the second instruction's call. */
+#define CONTINUE_AT(name) do { currentpc = pc; goto op_##name; } while (0)
+
 /* call frame accessors */
 #define CALL_FRAME_FUN() GETSTACK(-3)
 #define CALL_FRAME_ARGS() GETSTACK(-2)
@@ -5171,6 +5486,7 @@ static R_INLINE void VECSUBSET_PTR(R_bcstack_t *sx, R_bcstack_t *si,
 	DO_FAST_VECELT(sv, vec, i, subset2);
 
     /* fall through to the standard default handler */
+    traceR_count_bc_fallback();
     idx = GETSTACK_PTR(si);
     args = CONS_NR(idx, R_NilValue);
     args = CONS_NR(vec, args);
@@ -5262,6 +5578,7 @@ static R_INLINE void MATSUBSET_PTR(R_bcstack_t *sx,
     }
 
     /* fall through to the standard default handler */
+    traceR_count_bc_fallback();
     idx = GETSTACK_PTR(si);
     jdx = GETSTACK_PTR(sj);
     args = CONS_NR(jdx, R_NilValue);
@@ -5321,6 +5638,7 @@ static R_INLINE void SUBSET_N_PTR(R_bcstack_t *sx, int rank,
     }
 
     /* fall through to the standard default handler */
+    traceR_count_bc_fallback();
     PROTECT(args = CONS(x, getStackArgsList(rank, si)));
     SEXP call = callidx < 0 ? consts : VECTOR_ELT(consts, callidx);
     if (subset2)
@@ -5406,6 +5724,7 @@ static R_INLINE void VECSUBASSIGN_PTR(R_bcstack_t *sx, R_bcstack_t *srhs,
 	DO_FAST_SETVECELT(sv, srhs, vec,  i, subset2);
 
     /* fall through to the standard default handler */
+    traceR_count_bc_fallback();
     value = GETSTACK_PTR(srhs);
     idx = GETSTACK_PTR(si);
     args = CONS_NR(value, R_NilValue);
@@ -5460,6 +5779,7 @@ static R_INLINE void MATSUBASSIGN_PTR(R_bcstack_t *sx, R_bcstack_t *srhs,
     }
 
     /* fall through to the standard default handler */
+    traceR_count_bc_fallback();
     value = GETSTACK_PTR(srhs);
     idx = GETSTACK_PTR(si);
     jdx = GETSTACK_PTR(sj);
@@ -5512,6 +5832,7 @@ static R_INLINE void SUBASSIGN_N_PTR(R_bcstack_t *sx, int rank,
     }
 
     /* fall through to the standard default handler */
+    traceR_count_bc_fallback();
     value = GETSTACK_PTR(srhs);
     args = CONS_NR(value, R_NilValue);
     SET_TAG(args, R_valueSym);
@@ -5718,6 +6039,26 @@ SEXP attribute_hidden R_findBCInterpreterSrcref(RCNTXT *cptr)
     return R_findBCInterpreterLocation(cptr, "srcrefsIndex");
 }
 
+/* opcode names for the trace summary, only known to the threaded code */
+attribute_hidden const char *R_bcOpName(int op)
+{
+#ifdef THREADED_CODE
+    if (op >= 0 && op < OPCOUNT)
+	return opinfo[op].instname;
+#endif
+    return NULL;
+}
+
+/* offset of the current instruction in its byte code object, or -1 */
+int attribute_hidden R_findBCInterpreterPC(RCNTXT *cptr)
+{
+    SEXP body = cptr ? cptr->bcbody : R_BCbody;
+    void *bcpc = cptr ? cptr->bcpc : R_BCpc;
+    if (body == NULL || bcpc == NULL)
+	return -1;
+    return (int) ((*((BCODE **) bcpc)) - BCCODE(body));
+}
+
 static SEXP R_findBCInterpreterExpression()
 {
     return R_findBCInterpreterLocation(NULL, "expressionsIndex");
@@ -5875,17 +6216,52 @@ Rboolean attribute_hidden R_BCVersionOK(SEXP s)
 	(version >= R_bcMinVersion && version <= R_bcVersion);
 }
 
+#ifdef THREADED_CODE
+/* While the opcode profiler of the tracer is on, bcEval runs a copy of
+   the code whose instructions jump to their counting entries instead,
+   so the plain code does not test for the profiler on every dispatch.
+   The copy is made on first use and kept in the otherwise unused TAG
+   of the byte code object; its own TAG points to itself.  It has the
+   same layout and constants, so pc offsets, labels and the location
+   tables apply to it as well. */
+static int findOp(void *addr);
+
+static SEXP bcProfiledBody(SEXP body)
+{
+    if (TAG(body) != R_NilValue)
+	return TAG(body);
+
+    int m = (sizeof(BCODE) + sizeof(int) - 1) / sizeof(int);
+    SEXP code = PROTECT(duplicate(BCODE_CODE(body)));
+    BCODE *pc = (BCODE *) INTEGER(code);
+    int n = LENGTH(code) / m;
+    for (int i = 1; i < n;) {
+	int op = findOp(pc[i].v);
+	pc[i].v = opinfo[op].profaddr;
+	i += opinfo[op].argc + 1;
+    }
+    SEXP prof = CONS(code, BCODE_CONSTS(body));
+    SET_TYPEOF(prof, BCODESXP);
+    SET_TAG(prof, prof);
+    SET_TAG(body, prof);
+    UNPROTECT(1); /* code */
+    return prof;
+}
+#endif
+
 static SEXP bcEval(SEXP body, SEXP rho, Rboolean useCache)
 {
   SEXP retvalue = R_NilValue, constants;
   BCODE *pc, *codebase;
   R_bcstack_t *oldntop = R_BCNodeStackTop;
+  R_bcframe_t bcframe = { NULL, NULL, R_BCFrames };
   static int evalcount = 0;
   SEXP oldsrcref = R_Srcref;
   int oldbcintactive = R_BCIntActive;
   SEXP oldbcbody = R_BCbody;
   void *oldbcpc = R_BCpc;
   BCODE *currentpc = NULL;
+  int bcprof_prev = -1;  /* previous opcode for the tracer's pair counts */
 
 #ifdef BC_INT_STACK
   IStackval *olditop = R_BCIntStackTop;
@@ -5900,6 +6276,10 @@ static SEXP bcEval(SEXP body, SEXP rho, Rboolean useCache)
   BC_CHECK_SIGINT();
 
   INITIALIZE_MACHINE();
+#ifdef THREADED_CODE
+  if (traceR_bcprof_active)
+      body = bcProfiledBody(body);
+#endif
   codebase = pc = BCCODE(body);
   constants = BCCONSTS(body);
 
@@ -5960,6 +6340,10 @@ static SEXP bcEval(SEXP body, SEXP rho, Rboolean useCache)
 # endif
   }
 #endif
+  /* operands start above the binding cache, see bcStackRefersTo */
+  bcframe.base = oldntop;
+  bcframe.ops = R_BCNodeStackTop;
+  R_BCFrames = &bcframe;
 
   BEGIN_MACHINE {
     OP(BCMISMATCH, 0): error(_("byte code version mismatch"));
@@ -6179,67 +6563,20 @@ static SEXP bcEval(SEXP body, SEXP rho, Rboolean useCache)
     OP(SETLOOPVAL, 0):
       BCNPOP_IGNORE_VALUE(); SETSTACK(-1, R_NilValue); NEXT();
     OP(INVISIBLE,0): R_Visible = FALSE; NEXT();
-    OP(LDCONST, 1):
-      {
-	R_Visible = TRUE;
-	SEXP value = VECTOR_ELT(constants, GETOP());
-	if (R_check_constants < 0)
-	    value = duplicate(value);
-	MARK_NOT_MUTABLE(value);
-	BCNPUSH(value);
-	NEXT();
-      }
+    OP(LDCONST, 1): DO_LDCONST(); NEXT();
     OP(LDNULL, 0): R_Visible = TRUE; BCNPUSH(R_NilValue); NEXT();
     OP(LDTRUE, 0): R_Visible = TRUE; BCNPUSH(R_TrueValue); NEXT();
     OP(LDFALSE, 0): R_Visible = TRUE; BCNPUSH(R_FalseValue); NEXT();
     OP(GETVAR, 1): DO_GETVAR(FALSE, FALSE);
     OP(DDVAL, 1): DO_GETVAR(TRUE, FALSE);
     OP(SETVAR, 1):
-      {
-	int sidx = GETOP();
-	SEXP loc;
-	if (smallcache)
-	    loc = GET_SMALLCACHE_BINDING_CELL(vcache, sidx);
-	else {
-	    SEXP symbol = VECTOR_ELT(constants, sidx);
-	    loc = GET_BINDING_CELL_CACHE(symbol, rho, vcache, sidx);
-	}
-#ifdef TYPED_STACK
-	R_bcstack_t *s = R_BCNodeStackTop - 1;
-	/* reading the locked bit is OK even if cell is R_NilValue */
-	if (s->tag && ! BINDING_IS_LOCKED(loc)) {
-	    /* if cell is R_NilValue or an active binding, or if the value
-	       is R_UnboundValue, then TYPEOF(CAR(cell)) will not match the
-	       immediate value tag. */
-	    SEXP x = CAR(loc);  /* fast, but assumes binding is a CONS */
-	    if (NOT_SHARED(x) && IS_SIMPLE_SCALAR(x, s->tag)) {
-		/* if the binding value is not shared and is a simple
-		   scaler of the same type as the immediate value,
-		   then we can copy the stack value into the binding
-		   value */
-		switch (s->tag) {
-		case REALSXP: REAL(x)[0] = s->u.dval; NEXT();
-		case INTSXP: INTEGER(x)[0] = s->u.ival; NEXT();
-		case LGLSXP: LOGICAL(x)[0] = s->u.ival; NEXT();
-		}
-	    }
-	}
-#endif
-	SEXP value = GETSTACK(-1);
-	INCREMENT_NAMED(value);
-	if (! SET_BINDING_VALUE(loc, value)) {
-	    SEXP symbol = VECTOR_ELT(constants, sidx);
-	    PROTECT(value);
-	    defineVar(symbol, value, rho);
-	    UNPROTECT(1);
-	}
-	NEXT();
-      }
+      bcSetVar(constants, rho, vcache, smallcache, GETOP());
+      NEXT();
     OP(GETFUN, 1):
       {
 	/* get the function */
 	SEXP symbol = VECTOR_ELT(constants, GETOP());
-	SEXP value = findFun(symbol, rho);
+	SEXP value = findFunCached(symbol, rho);
 	INIT_CALL_FRAME(value);
 	if(RTRACE(value)) {
 	  Rprintf("trace: ");
@@ -6251,7 +6588,7 @@ static SEXP bcEval(SEXP body, SEXP rho, Rboolean useCache)
       {
 	/* get the function */
 	SEXP symbol = VECTOR_ELT(constants, GETOP());
-	SEXP value = findFun(symbol, R_GlobalEnv);
+	SEXP value = findFunCached(symbol, R_GlobalEnv);
 	INIT_CALL_FRAME(value);
 	if(RTRACE(value)) {
 	  Rprintf("trace: ");
@@ -6920,6 +7257,21 @@ static SEXP bcEval(SEXP body, SEXP rho, Rboolean useCache)
     OP(SEQALONG, 1): DO_SEQ_ALONG(); NEXT();
     OP(SEQLEN, 1): DO_SEQ_LEN(); NEXT();
     OP(BASEGUARD, 2): DO_BASEGUARD(); NEXT();
+    OP(SETVAR_POP, 1):
+      bcSetVar(constants, rho, vcache, smallcache, GETOP());
+      BCNPOP_IGNORE_VALUE();
+      NEXT();
+    OP(GETVAR_PUSHARG, 1):
+      DO_GETVAR_THEN(FALSE, FALSE, CONTINUE_AT(PUSHARG));
+    OP(GETVAR_GETVAR, 2):
+      DO_GETVAR_THEN(FALSE, FALSE, CONTINUE_AT(GETVAR));
+    OP(LDCONST_ADD, 2): DO_LDCONST(); CONTINUE_AT(ADD);
+    OP(LDCONST_SUB, 2): DO_LDCONST(); CONTINUE_AT(SUB);
+    OP(LDCONST_MUL, 2): DO_LDCONST(); CONTINUE_AT(MUL);
+    OP(GETVAR_MISSOK_VECSUBSET, 2):
+      DO_GETVAR_THEN(FALSE, TRUE, CONTINUE_AT(VECSUBSET));
+    OP(GETVAR_MISSOK_VECSUBASSIGN, 2):
+      DO_GETVAR_THEN(FALSE, TRUE, CONTINUE_AT(VECSUBASSIGN));
     LASTOP;
   }
 
@@ -6927,6 +7279,7 @@ static SEXP bcEval(SEXP body, SEXP rho, Rboolean useCache)
   R_BCIntActive = oldbcintactive;
   R_BCbody = oldbcbody;
   R_BCpc = oldbcpc;
+  R_BCFrames = bcframe.prev;
   R_Srcref = oldsrcref;
   R_BCNodeStackTop = oldntop;
 #ifdef BC_INT_STACK
@@ -6992,7 +7345,7 @@ static int findOp(void *addr)
     int i;
 
     for (i = 0; i < OPCOUNT; i++)
-	if (opinfo[i].addr == addr)
+	if (opinfo[i].addr == addr || opinfo[i].profaddr == addr)
 	    return i;
     error(_("cannot find index for threaded code address"));
     return 0; /* not reached */
@@ -181,6 +181,91 @@ static void check_header(gz_stream *s)
     s->z_err = s->z_eof ? Z_DATA_ERROR : Z_OK;
 }
 
+/* R ADDITION: block-parallel gzfile and gzcon output (see
+   connections.c) writes each block as a gzip member of its own.  With
+   an index the header of a member has an extra field with an 'RZ'
+   subfield of the compressed size of the member and the uncompressed
+   size of its data, both as 4 bytes little-endian, so a seek can skip
+   whole members instead of inflating them. */
+
+#define GZ_INDEX_HEADER 24	/* header with the 'RZ' subfield */
+#define GZ_MEMBER_OVERHEAD (GZ_INDEX_HEADER + 8)
+
+static void gz_putLong(unsigned char *buf, uLong x)
+{
+    int n;
+    for (n = 0; n < 4; n++) {
+	buf[n] = (unsigned char) (x & 0xff);
+	x >>= 8;
+    }
+}
+
+static uLong gz_getLong(const unsigned char *buf)
+{
+    return (uLong) buf[0] | ((uLong) buf[1] << 8) |
+	((uLong) buf[2] << 16) | ((uLong) buf[3] << 24);
+}
+
+/* space needed for a member of len bytes */
+static size_t R_gzmember_bound(size_t len)
+{
+    return compressBound((uLong) len) + GZ_MEMBER_OVERHEAD;
+}
+
+/* Compresses len bytes of in into a complete gzip member in out, which
+   has outsize bytes (see R_gzmember_bound).  Returns the size of the
+   member, or 0 on failure.  Uses no R API, so it can run on threads. */
+static size_t R_gzmember(unsigned char *out, size_t outsize,
+			 const unsigned char *in, size_t len,
+			 int level, int index)
+{
+    z_stream zs;
+    size_t head = index ? GZ_INDEX_HEADER : 10, size;
+
+    if (outsize < head + 8) return 0;
+    memset(&zs, 0, sizeof(zs));
+    if (deflateInit2(&zs, level, Z_DEFLATED, -MAX_WBITS, MAX_MEM_LEVEL,
+		     Z_DEFAULT_STRATEGY) != Z_OK)
+	return 0;
+    zs.next_in = (Bytef *) in;
+    zs.avail_in = (uInt) len;
+    zs.next_out = out + head;
+    zs.avail_out = (uInt) (outsize - head - 8);
+    if (deflate(&zs, Z_FINISH) != Z_STREAM_END) {
+	deflateEnd(&zs);
+	return 0;
+    }
+    size = head + zs.total_out + 8;
+    deflateEnd(&zs);
+
+    out[0] = gz_magic[0]; out[1] = gz_magic[1];
+    out[2] = Z_DEFLATED; out[3] = index ? EXTRA_FIELD : 0;
+    memset(out + 4, 0, 5); /* time, xflags */
+    out[9] = OS_CODE;
+    if (index) {
+	out[10] = 12; out[11] = 0; /* XLEN */
+	out[12] = 'R'; out[13] = 'Z';
+	out[14] = 8; out[15] = 0;  /* LEN */
+	gz_putLong(out + 16, (uLong) size);
+	gz_putLong(out + 20, (uLong) len);
+    }
+    gz_putLong(out + size - 8, crc32(crc32(0L, Z_NULL, 0), in, (uInt) len));
+    gz_putLong(out + size - 4, (uLong) (len & 0xffffffff));
+    return size;
+}
+
+/* the sizes in the header of an indexed member, or FALSE */
+static int gz_index_header(const unsigned char *h, uLong *csize, uLong *usize)
+{
+    if (h[0] != gz_magic[0] || h[1] != gz_magic[1] || h[2] != Z_DEFLATED ||
+	h[3] != EXTRA_FIELD || h[10] != 12 || h[11] != 0 ||
+	h[12] != 'R' || h[13] != 'Z' || h[14] != 8 || h[15] != 0)
+	return 0;
+    *csize = gz_getLong(h + 16);
+    *usize = gz_getLong(h + 20);
+    return *csize >= GZ_MEMBER_OVERHEAD;
+}
+
 gzFile R_gzopen (const char *path, const char *mode)
 {
     int err;
@@ -481,6 +566,48 @@ static Rz_off_t R_gztell (gzFile file)
     if (s->mode == 'w') return s->in; else return s->out;
 }
 
+/* Moves a reading stream to the member of an indexed file that holds
+   uncompressed offset 'offset', following the sizes in the headers
+   from the start.  Returns the uncompressed offset of the member, or
+   -1 if the file has no index, in which case the stream is untouched. */
+static Rz_off_t gz_index_seek(gz_stream *s, Rz_off_t offset)
+{
+    unsigned char h[GZ_INDEX_HEADER];
+    Rz_off_t pos = 0, out = 0, here = f_tell(s->file);
+    uLong csize, usize;
+    int atend = 0;
+
+    for (;;) {
+	if (f_seek(s->file, pos, SEEK_SET) < 0 ||
+	    fread(h, 1, GZ_INDEX_HEADER, s->file) != GZ_INDEX_HEADER ||
+	    !gz_index_header(h, &csize, &usize)) {
+	    if (pos == 0 || out != offset) {
+		f_seek(s->file, here, SEEK_SET);
+		return -1;
+	    }
+	    atend = 1;
+	    break;
+	}
+	if (out + (Rz_off_t) usize > offset) break;
+	pos += csize;
+	out += usize;
+    }
+
+    /* restart inflating at the member */
+    if (f_seek(s->file, pos, SEEK_SET) < 0) return -1;
+    s->z_err = Z_OK;
+    s->z_eof = 0;
+    s->stream.avail_in = 0;
+    s->stream.next_in = s->buffer;
+    s->crc = crc32(0L, Z_NULL, 0);
+    (void) inflateReset(&s->stream);
+    if (atend) s->z_err = Z_STREAM_END;
+    else check_header(s);
+    s->in = pos;
+    s->out = out;
+    return out;
+}
+
 /* NB: return value is in line with fseeko, not gzseek */
 static int R_gzseek (gzFile file, Rz_off_t offset, int whence)
 {
@@ -519,15 +646,21 @@ static int R_gzseek (gzFile file, Rz_off_t offset, int whence)
         return 0;
     }
 
-    /* For a negative seek, rewind and use positive seek */
-    if (offset >= s->out) offset -= s->out;
+    /* Skip whole members of an indexed file, otherwise for a negative
+       seek, rewind and use positive seek */
+    if ((offset < s->out || offset - s->out > Z_BUFSIZE) &&
+	gz_index_seek(s, offset) >= 0)
+	offset -= s->out;
+    else if (offset >= s->out) offset -= s->out;
     else if (int_gzrewind(file) < 0) return -1;
 
-    /* offset is now the number of bytes to skip. */
+    /* offset is now the number of bytes to skip.  R ADDITION: inflate
+       into a buffer of its own, s->buffer holds the input. */
     while (offset > 0)  {
+        Byte skip[Z_BUFSIZE];
         int size = Z_BUFSIZE;
         if (offset < Z_BUFSIZE) size = (int) offset;
-        size = R_gzread(file, s->buffer, (uInt) size);
+        size = R_gzread(file, skip, (uInt) size);
         if (size <= 0) return -1;
         offset -= size;
     }
@@ -34,6 +34,26 @@
 #endif
 
 #include <stdarg.h>
+#include <time.h> /* clock_gettime for the tracer */
+#ifdef _OPENMP
+# include <omp.h> /* parallel marking */
+#endif
+#ifdef HAVE_SCHED_H
+# include <sched.h> /* sched_yield */
+#endif
+#if defined(HAVE_MMAP) && !defined(Win32)
+# define LARGE_BLOCK_MAPPING
+# include <sys/mman.h> /* mapped large vectors */
+# ifdef HAVE_UNISTD_H
+#  include <unistd.h> /* sysconf */
+# endif
+# if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#  define MAP_ANONYMOUS MAP_ANON
+# endif
+# ifndef MAP_ANONYMOUS
+#  undef LARGE_BLOCK_MAPPING
+# endif
+#endif
 
 #include <R_ext/RS.h> /* for S4 allocation */
 #include <R_ext/Print.h>
@@ -89,6 +109,7 @@
 #include <R_ext/Rallocators.h> /* for R_allocator_t structure */
 #include <Rmath.h> // R_pow_di
 #include <Print.h> // R_print
+#include <mallocmeasure.h> // mallocmeasure_count_mapped
 
 #define ADD_ALLOC(type) allocated_##type += sizeof(SEXPREC)
 #define ADD_ALLOC_BY(type, val) allocated_##type += val
@@ -261,9 +282,6 @@ static void mem_err_heap(R_size_t size);
 static void mem_err_malloc(R_size_t size);
 
 static SEXPREC UnmarkedNodeTemplate;
-#define NODE_IS_MARKED(s) (MARK(s)==1)
-#define MARK_NODE(s) (MARK(s)=1)
-#define UNMARK_NODE(s) (MARK(s)=0)
 
 
 /* Tuning Constants. Most of these could be made settable from R,
@@ -349,6 +367,17 @@ static double R_VGrowIncrFrac = 0.2, R_VShrinkIncrFrac = 0.2;
 static int R_VGrowIncrMin = 80000, R_VShrinkIncrMin = 0;
 #endif
 
+/* number of threads marking in collections of old generations, see
+   Parallel Marking below */
+#define MAX_MARK_THREADS 64
+static int R_GCMarkThreads = 1;
+
+/* bytes of released large vector blocks kept for reuse, and when the
+   memory of the kept blocks is given back, see Large Vector Blocks
+   below */
+static R_size_t R_LargeBlockCacheMax = 64 * 1024 * 1024;
+static int R_LargeBlockRelease = 1;
+
 static void init_gc_grow_settings()
 {
     char *arg;
@@ -403,6 +432,24 @@ static void init_gc_grow_settings()
 	if (0.05 <= frac && frac <= 0.80)
 	    R_VGrowIncrFrac = frac;
     }
+    arg = getenv("R_GC_MARK_THREADS");
+    if (arg != NULL) {
+	int threads = atoi(arg);
+	if (1 <= threads && threads <= MAX_MARK_THREADS)
+	    R_GCMarkThreads = threads;
+    }
+    arg = getenv("R_GC_LARGE_CACHE");
+    if (arg != NULL) {
+	double mb = atof(arg);
+	if (0 <= mb && mb <= 1024 * 1024)
+	    R_LargeBlockCacheMax = (R_size_t) (mb * 1024 * 1024);
+    }
+    arg = getenv("R_GC_LARGE_RELEASE");
+    if (arg != NULL) {
+	int which = atoi(arg);
+	if (0 <= which && which <= 2)
+	    R_LargeBlockRelease = which;
+    }
 }
 
 /* Maximal Heap Limits.  These variables contain upper limits on the
@@ -499,6 +546,9 @@ unsigned long allocated_list, allocated_list_elts;
 /* Node Generations. */
 
 #define NUM_OLD_GENERATIONS 2
+#if NUM_OLD_GENERATIONS + 1 != TRACER_GC_LEVELS
+# error "TRACER_GC_LEVELS in trace.h must match NUM_OLD_GENERATIONS"
+#endif
 
 /* sxpinfo allocates one bit for the old generation count, so only 1
    or 2 is allowed */
@@ -509,6 +559,34 @@ unsigned long allocated_list, allocated_list_elts;
 #define NODE_GENERATION(s) ((s)->sxpinfo.gcgen)
 #define SET_NODE_GENERATION(s,g) ((s)->sxpinfo.gcgen=(g))
 
+/* Mark Epochs.  A node is marked if its mark bit is set and its epoch
+   is the current one of its generation.  Collecting an old generation
+   starts a new epoch for it, which unmarks all its nodes at once
+   instead of visiting each of them before marking.  A node reached by
+   the collector that has its mark bit set but an out of date epoch was
+   in a collected generation, and marking it moves it up a generation
+   like the unmarking did before.  The nodes that are not reached keep
+   their stale mark bit until they are allocated again, which resets
+   the header; they are swept lazily by allocation.  Before an epoch
+   can come round again ScrubMarks clears the stale bits left on the
+   pages. */
+#define MARK_EPOCH_BITS 12
+#define MAX_MARK_EPOCHS ((1 << MARK_EPOCH_BITS) - 1)
+static unsigned int R_GenEpoch[NUM_OLD_GENERATIONS];
+static int mark_epochs_since_scrub = 0;
+
+#define NODE_EPOCH(s) ((s)->sxpinfo.gcepoch)
+#define NODE_IS_MARKED(s) \
+  (MARK(s) && NODE_EPOCH(s) == R_GenEpoch[NODE_GENERATION(s)])
+#define MARK_NODE(s) \
+  (MARK(s) = 1, NODE_EPOCH(s) = R_GenEpoch[NODE_GENERATION(s)])
+#define UNMARK_NODE(s) (MARK(s)=0)
+#define AGE_AND_MARK_NODE(s) do { \
+  if (MARK(s) && NODE_GENERATION(s) < NUM_OLD_GENERATIONS - 1) \
+    SET_NODE_GENERATION(s, NODE_GENERATION(s) + 1); \
+  MARK_NODE(s); \
+} while (0)
+
 #define NODE_GEN_IS_YOUNGER(s,g) \
   (! NODE_IS_MARKED(s) || NODE_GENERATION(s) < (g))
 #define NODE_IS_OLDER(x, y) \
@@ -578,6 +656,8 @@ static struct {
 #endif
     int OldCount[NUM_OLD_GENERATIONS], AllocCount, PageCount;
     PAGE_HEADER *pages;
+    PAGE_HEADER *EmptyPages;	/* pages kept for bump allocation */
+    char *BumpNext, *BumpEnd;	/* the part of the bump page not carved */
 } R_GenHeap[NUM_NODE_CLASSES];
 
 static R_size_t R_NodesInUse = 0;
@@ -713,7 +793,7 @@ static R_size_t R_NodesInUse = 0;
   SEXP fn__n__ = (s); \
   if (fn__n__ && ! NODE_IS_MARKED(fn__n__)) { \
     CHECK_FOR_FREE_NODE(fn__n__) \
-    MARK_NODE(fn__n__); \
+    AGE_AND_MARK_NODE(fn__n__); \
     UNSNAP_NODE(fn__n__); \
     SET_NEXT_NODE(fn__n__, forwarded_nodes); \
     forwarded_nodes = fn__n__; \
@@ -749,6 +829,18 @@ static R_size_t R_NodesInUse = 0;
   (s) = __n__; \
 } while (0)
 
+/* small vector nodes come from the bump page once the free list is used
+   up (see Bump Allocation below) */
+#define CLASS_GET_FREE_VEC_NODE(c,s) do { \
+  SEXP __n__ = R_GenHeap[c].Free; \
+  if (__n__ != R_GenHeap[c].New) \
+    R_GenHeap[c].Free = NEXT_NODE(__n__); \
+  else \
+    __n__ = BumpAllocNode(c); \
+  R_NodesInUse++; \
+  (s) = __n__; \
+} while (0)
+
 #define NO_FREE_NODES() (R_NodesInUse >= R_NSize)
 #define GET_FREE_NODE(s) CLASS_GET_FREE_NODE(0,s)
 
@@ -885,17 +977,9 @@ static void DEBUG_RELEASE_PRINT(int rel_pages, int maxrel_pages, int i)
 
 /* Page Allocation and Release. */
 
-static void GetNewPage(int node_class)
+static PAGE_HEADER *AllocPage(void)
 {
-    SEXP s, base;
-    char *data;
-    PAGE_HEADER *page;
-    int node_size, page_count, i;  // FIXME: longer type?
-
-    node_size = NODE_SIZE(node_class);
-    page_count = (R_PAGE_SIZE - sizeof(PAGE_HEADER)) / node_size;
-
-    page = malloc(R_PAGE_SIZE);
+    PAGE_HEADER *page = malloc(R_PAGE_SIZE);
     if (page == NULL) {
 	R_gc_full(0);
 	page = malloc(R_PAGE_SIZE);
@@ -905,6 +989,20 @@ static void GetNewPage(int node_class)
 #ifdef R_MEMORY_PROFILING
     R_ReportNewPage();
 #endif
+    return page;
+}
+
+static void GetNewPage(int node_class)
+{
+    SEXP s, base;
+    char *data;
+    PAGE_HEADER *page;
+    int node_size, page_count, i;  // FIXME: longer type?
+
+    node_size = NODE_SIZE(node_class);
+    page_count = (R_PAGE_SIZE - sizeof(PAGE_HEADER)) / node_size;
+
+    page = AllocPage();
     page->next = R_GenHeap[node_class].pages;
     R_GenHeap[node_class].pages = page;
     R_GenHeap[node_class].PageCount++;
@@ -949,6 +1047,103 @@ static void ReleasePage(PAGE_HEADER *page, int node_class)
     free(page);
 }
 
+/* Bump Allocation.  Once the free list of a small vector class is used
+   up, its nodes are carved one after the other from a page without
+   live nodes: allocation is a pointer increment, the node is linked at
+   the end of the allocated nodes, and vectors allocated together end up
+   next to each other.  The pages are the empty ones TryToReleasePages
+   keeps, or new ones.  Until they are used they are on the EmptyPages
+   list instead of the page list, and their nodes are in no node list.
+   The nodes of the current page that are not carved yet are put on the
+   free list at the start of each collection, so the collector and the
+   functions walking the page lists see every page as before.  Pages in
+   use are added at the head of the page list, so after the pages it
+   has to look at for releasing TryToReleasePages only looks for empty
+   pages to keep among the next BUMP_SCAN_PAGES, the most recently
+   used ones. */
+
+#define BUMP_SCAN_PAGES 64
+
+// bump allocated nodes and the pages they came from, for the tracer
+unsigned long bump_alloc_nodes, bump_alloc_new_pages, bump_alloc_reused_pages;
+
+static void GetBumpPage(int node_class)
+{
+    PAGE_HEADER *page = R_GenHeap[node_class].EmptyPages;
+    int node_size = NODE_SIZE(node_class);
+    int page_count = (R_PAGE_SIZE - sizeof(PAGE_HEADER)) / node_size;
+
+    if (page != NULL) {
+	R_GenHeap[node_class].EmptyPages = page->next;
+	bump_alloc_reused_pages++;
+    }
+    else {
+	page = AllocPage();
+	R_GenHeap[node_class].PageCount++;
+	R_GenHeap[node_class].AllocCount += page_count;
+	bump_alloc_new_pages++;
+    }
+    page->next = R_GenHeap[node_class].pages;
+    R_GenHeap[node_class].pages = page;
+    R_GenHeap[node_class].BumpNext = PAGE_DATA(page);
+    R_GenHeap[node_class].BumpEnd =
+	R_GenHeap[node_class].BumpNext + page_count * node_size;
+}
+
+/* the caller initializes the header like for nodes from the free list */
+static R_INLINE SEXP BumpAllocNode(int node_class)
+{
+    if (R_GenHeap[node_class].BumpNext == R_GenHeap[node_class].BumpEnd)
+	GetBumpPage(node_class);
+    SEXP s = (SEXP) R_GenHeap[node_class].BumpNext;
+    R_GenHeap[node_class].BumpNext += NODE_SIZE(node_class);
+    SNAP_NODE(s, R_GenHeap[node_class].Free);
+    bump_alloc_nodes++;
+    return s;
+}
+
+/* put the nodes not carved from the bump pages on the free lists */
+static void RetireBumpPages(void)
+{
+    for (int i = 1; i < NUM_SMALL_NODE_CLASSES; i++) {
+	char *data = R_GenHeap[i].BumpNext;
+	int node_size = NODE_SIZE(i);
+	SEXP free_nodes = R_GenHeap[i].Free, first = NULL;
+
+	for (; data < R_GenHeap[i].BumpEnd; data += node_size) {
+	    SEXP s = (SEXP) data;
+	    SNAP_NODE(s, free_nodes);
+#if  VALGRIND_LEVEL > 1
+	    VALGRIND_MAKE_MEM_NOACCESS(DATAPTR(s), NodeClassSize[i]*sizeof(VECREC));
+#endif
+	    s->sxpinfo = UnmarkedNodeTemplate.sxpinfo;
+	    INIT_REFCNT(s);
+	    SET_NODE_CLASS(s, i);
+#ifdef PROTECTCHECK
+	    TYPEOF(s) = NEWSXP;
+#endif
+	    if (first == NULL)
+		first = s;
+	}
+	if (first != NULL)
+	    R_GenHeap[i].Free = first;
+	R_GenHeap[i].BumpNext = R_GenHeap[i].BumpEnd = NULL;
+    }
+}
+
+/* take an empty page off the node lists for bump allocation */
+static void KeepEmptyPage(PAGE_HEADER *page, int node_class)
+{
+    int node_size = NODE_SIZE(node_class);
+    int page_count = (R_PAGE_SIZE - sizeof(PAGE_HEADER)) / node_size;
+    char *data = PAGE_DATA(page);
+
+    for (int i = 0; i < page_count; i++, data += node_size)
+	UNSNAP_NODE((SEXP) data);
+    page->next = R_GenHeap[node_class].EmptyPages;
+    R_GenHeap[node_class].EmptyPages = page;
+}
+
 static void TryToReleasePages(void)
 {
     SEXP s;
@@ -969,9 +1164,25 @@ static void TryToReleasePages(void)
 		maxrel -= (1.0 + R_MaxKeepFrac) * R_GenHeap[i].OldCount[gen];
 	    maxrel_pages = maxrel > 0 ? maxrel / page_count : 0;
 
-	    /* all nodes in New space should be both free and unmarked */
-	    for (page = R_GenHeap[i].pages, rel_pages = 0, last = NULL;
-		 rel_pages < maxrel_pages && page != NULL;) {
+	    /* pages kept for bump allocation are released first */
+	    for (rel_pages = 0;
+		 rel_pages < maxrel_pages && R_GenHeap[i].EmptyPages != NULL;
+		 rel_pages++) {
+		page = R_GenHeap[i].EmptyPages;
+		R_GenHeap[i].EmptyPages = page->next;
+		R_GenHeap[i].AllocCount -= page_count;
+		R_GenHeap[i].PageCount--;
+		free(page);
+		pages_free++;
+	    }
+
+	    /* all nodes in New space should be both free and unmarked;
+	       the empty vector pages that are not released are kept for
+	       bump allocation, so those classes look at a few more pages */
+	    int scan_pages = i > 0 ? BUMP_SCAN_PAGES : 0;
+	    for (page = R_GenHeap[i].pages, last = NULL;
+		 page != NULL &&
+		     (rel_pages < maxrel_pages || scan_pages-- > 0);) {
 		int j, in_use;
 		char *data = PAGE_DATA(page);
 
@@ -985,13 +1196,16 @@ static void TryToReleasePages(void)
 		    }
 		}
 		if (! in_use) {
-		    ReleasePage(page, i);
+		    if (rel_pages < maxrel_pages) {
+			ReleasePage(page, i);
+			pages_free++;
+			rel_pages++;
+		    }
+		    else KeepEmptyPage(page, i);
 		    if (last == NULL)
 			R_GenHeap[i].pages = next;
 		    else
 			last->next = next;
-		    pages_free++;
-		    rel_pages++;
 		}
 		else last = page;
 		page = next;
@@ -1003,6 +1217,39 @@ static void TryToReleasePages(void)
     else release_count--;
 }
 
+/* clear the stale mark bits of the free nodes on the pages */
+static void ScrubMarks(void)
+{
+    for (int i = 0; i < NUM_SMALL_NODE_CLASSES; i++) {
+	int node_size = NODE_SIZE(i);
+	int page_count = (R_PAGE_SIZE - sizeof(PAGE_HEADER)) / node_size;
+
+	for (PAGE_HEADER *page = R_GenHeap[i].pages; page != NULL;
+	     page = page->next) {
+	    char *data = PAGE_DATA(page);
+	    for (int j = 0; j < page_count; j++, data += node_size) {
+		SEXP s = (SEXP) data;
+		if (MARK(s) && ! NODE_IS_MARKED(s))
+		    UNMARK_NODE(s);
+	    }
+	}
+    }
+}
+
+/* unmark the nodes of an old generation to be collected */
+static void NewMarkEpoch(int gen)
+{
+    /* a free node with a stale mark bit would look marked again once
+       the epoch of its generation wraps around; the empty pages kept
+       for bump allocation are not on the page lists, but their nodes
+       are reset when they are carved */
+    if (++mark_epochs_since_scrub == MAX_MARK_EPOCHS) {
+	ScrubMarks();
+	mark_epochs_since_scrub = 0;
+    }
+    R_GenEpoch[gen] = (R_GenEpoch[gen] + 1) & MAX_MARK_EPOCHS;
+}
+
 /* compute size in VEC units so result will fit in LENGTH field for FREESXPs */
 static R_INLINE R_size_t getVecSizeInVEC(SEXP s)
 {
@@ -1039,6 +1286,214 @@ static R_INLINE R_size_t getVecSizeInVEC(SEXP s)
     return BYTE2VEC(size);
 }
 
+/* Large Vector Blocks.  Large vectors of at least LARGE_MAP_THRESHOLD
+   bytes get an anonymous mapping of their own instead of a malloc
+   block.  Mappings of at least HUGE_MAP_THRESHOLD bytes are aligned to
+   and rounded up to huge pages and advised to be backed by them, which
+   saves TLB misses when the vector is traversed.  A released block is
+   kept in a cache, with one list per power of two of the mapping size,
+   as long as the cache holds at most R_LargeBlockCacheMax bytes (set by
+   R_GC_LARGE_CACHE in megabytes), so that the next large vector of a
+   similar size reuses it without a system call and without faulting in
+   its pages again.  Otherwise the block is unmapped.  R_LargeBlockRelease
+   (set by R_GC_LARGE_RELEASE) controls when the pages of the cached
+   blocks are given back to the system with MADV_DONTNEED while keeping
+   the mapping: 0 never, 1 at a full collection for the blocks cached
+   since before the previous one, 2 as soon as a block is cached.  The
+   first page of a block holds its header and stays resident.
+
+   Whether a large vector is in a mapped block is recorded in its node,
+   since SETLENGTH can move its size across LARGE_MAP_THRESHOLD.  The
+   blocks in use are counted by mallocmeasure like malloc blocks. */
+
+#ifdef LARGE_BLOCK_MAPPING
+#define LARGE_MAP_THRESHOLD (128 * 1024)
+#define HUGE_MAP_THRESHOLD (8 * 1024 * 1024)
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+#define NUM_LARGE_BLOCK_CLASSES (8 * (int) sizeof(size_t))
+
+/* the header is padded to keep the vector data aligned */
+typedef union large_block {
+    struct {
+	size_t size;			/* of the mapping */
+	union large_block *next;	/* in the cache */
+	unsigned int epoch;		/* full collections when cached */
+	Rboolean resident;		/* not advised since cached */
+    } h;
+    double align[4];
+} LARGE_BLOCK;
+
+static LARGE_BLOCK *LargeBlockCache[NUM_LARGE_BLOCK_CLASSES];
+static R_size_t LargeBlockCacheSize = 0;
+static unsigned int LargeBlockEpoch = 0;
+static size_t LargeBlockPageSize = 0;
+
+// large vector blocks mapped, reused from the cache, unmapped and
+// advised to give back their pages, for the tracer
+unsigned long large_blocks_mapped, large_blocks_reused;
+unsigned long large_blocks_unmapped, large_blocks_advised;
+
+static int LargeBlockClass(size_t size)
+{
+    int c = 0;
+    while (size >>= 1) c++;
+    return c;
+}
+
+/* the mapping size for a block with 'bytes' of vector, 0 on overflow */
+static size_t LargeBlockSize(size_t bytes)
+{
+    if (LargeBlockPageSize == 0) {
+	long page = sysconf(_SC_PAGESIZE);
+	LargeBlockPageSize = page > 0 ? (size_t) page : 4096;
+    }
+    if (bytes > R_SIZE_T_MAX - sizeof(LARGE_BLOCK) - HUGE_PAGE_SIZE)
+	return 0;
+    size_t size = bytes + sizeof(LARGE_BLOCK);
+    size_t unit = size >= HUGE_MAP_THRESHOLD ?
+	HUGE_PAGE_SIZE : LargeBlockPageSize;
+    return (size + unit - 1) / unit * unit;
+}
+
+static LARGE_BLOCK *MapLargeBlock(size_t size)
+{
+    size_t extra = size >= HUGE_MAP_THRESHOLD ? HUGE_PAGE_SIZE : 0;
+    char *mem = mmap(NULL, size + extra, PROT_READ | PROT_WRITE,
+		     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+	return NULL;
+    if (extra) {
+	/* trim the mapping to start at a huge page boundary */
+	size_t lead = (HUGE_PAGE_SIZE - (size_t) mem % HUGE_PAGE_SIZE)
+	    % HUGE_PAGE_SIZE;
+	if (lead)
+	    munmap(mem, lead);
+	if (extra - lead)
+	    munmap(mem + lead + size, extra - lead);
+	mem += lead;
+#ifdef MADV_HUGEPAGE
+	madvise(mem, size, MADV_HUGEPAGE);
+#endif
+    }
+    LARGE_BLOCK *b = (LARGE_BLOCK *) mem;
+    b->h.size = size;
+    large_blocks_mapped++;
+    return b;
+}
+
+static void AdviseLargeBlock(LARGE_BLOCK *b)
+{
+#ifdef MADV_DONTNEED
+    size_t keep = LargeBlockPageSize;
+    if (b->h.size > keep &&
+	madvise((char *) b + keep, b->h.size - keep, MADV_DONTNEED) == 0)
+	large_blocks_advised++;
+#endif
+    b->h.resident = FALSE;
+}
+
+static void FlushLargeBlockCache(void)
+{
+    for (int c = 0; c < NUM_LARGE_BLOCK_CLASSES; c++)
+	while (LargeBlockCache[c] != NULL) {
+	    LARGE_BLOCK *b = LargeBlockCache[c];
+	    LargeBlockCache[c] = b->h.next;
+	    munmap(b, b->h.size);
+	    large_blocks_unmapped++;
+	}
+    LargeBlockCacheSize = 0;
+}
+
+/* called after full collections */
+static void AgeLargeBlockCache(void)
+{
+    if (R_LargeBlockRelease == 1)
+	for (int c = 0; c < NUM_LARGE_BLOCK_CLASSES; c++)
+	    for (LARGE_BLOCK *b = LargeBlockCache[c]; b != NULL; b = b->h.next)
+		if (b->h.resident && b->h.epoch != LargeBlockEpoch)
+		    AdviseLargeBlock(b);
+    LargeBlockEpoch++;
+}
+
+static void *LargeBlockAlloc(size_t bytes)
+{
+    size_t size = LargeBlockSize(bytes);
+    if (size == 0)
+	return NULL;
+
+    /* take the first cached block that is big enough without wasting
+       more than half of it */
+    LARGE_BLOCK *b = NULL;
+    int c = LargeBlockClass(size);
+    for (int i = c; b == NULL && i <= c + 1 && i < NUM_LARGE_BLOCK_CLASSES; i++)
+	for (LARGE_BLOCK **p = &LargeBlockCache[i]; *p != NULL; p = &(*p)->h.next)
+	    if ((*p)->h.size >= size && (*p)->h.size / 2 <= size) {
+		b = *p;
+		*p = b->h.next;
+		LargeBlockCacheSize -= b->h.size;
+		large_blocks_reused++;
+		break;
+	    }
+
+    if (b == NULL) {
+	b = MapLargeBlock(size);
+	if (b == NULL && LargeBlockCacheSize > 0) {
+	    /* give the address space of the cache back and try again */
+	    FlushLargeBlockCache();
+	    b = MapLargeBlock(size);
+	}
+	if (b == NULL)
+	    return NULL;
+    }
+    b->h.next = NULL;
+    mallocmeasure_count_mapped((long) b->h.size);
+    return b + 1;
+}
+
+static void LargeBlockFree(void *mem)
+{
+    LARGE_BLOCK *b = (LARGE_BLOCK *) mem - 1;
+    mallocmeasure_count_mapped(-(long) b->h.size);
+    if (LargeBlockCacheSize + b->h.size > R_LargeBlockCacheMax) {
+	munmap(b, b->h.size);
+	large_blocks_unmapped++;
+	return;
+    }
+    int c = LargeBlockClass(b->h.size);
+    b->h.next = LargeBlockCache[c];
+    b->h.epoch = LargeBlockEpoch;
+    b->h.resident = TRUE;
+    LargeBlockCache[c] = b;
+    LargeBlockCacheSize += b->h.size;
+    if (R_LargeBlockRelease == 2)
+	AdviseLargeBlock(b);
+}
+
+/* 'size' is the vector size in VECREC units, 'bytes' includes the
+   header; *mapped is set to whether the block was mapped */
+static R_INLINE void *LargeVecAlloc(R_size_t size, size_t bytes,
+				    Rboolean *mapped)
+{
+    *mapped = size * sizeof(VECREC) >= LARGE_MAP_THRESHOLD;
+    return *mapped ? LargeBlockAlloc(bytes) : malloc(bytes);
+}
+
+static R_INLINE void LargeVecFree(SEXP s, void *mem)
+{
+    if (s->sxpinfo.mapped)
+	LargeBlockFree(mem);
+    else
+	free(mem);
+}
+#else
+unsigned long large_blocks_mapped, large_blocks_reused;
+unsigned long large_blocks_unmapped, large_blocks_advised;
+
+#define AgeLargeBlockCache()
+#define LargeVecAlloc(size, bytes, mapped) (*(mapped) = FALSE, malloc(bytes))
+#define LargeVecFree(s, mem) free(mem)
+#endif
+
 static void custom_node_free(void *ptr);
 
 static void ReleaseLargeFreeVectors()
@@ -1064,11 +1519,11 @@ static void ReleaseLargeFreeVectors()
 		    R_LargeVallocSize -= size;
 #ifdef LONG_VECTOR_SUPPORT
 		    if (IS_LONG_VEC(s))
-			free(((char *) s) - sizeof(R_long_vec_hdr_t));
+			LargeVecFree(s, ((char *) s) - sizeof(R_long_vec_hdr_t));
 		    else
-			free(s);
+			LargeVecFree(s, s);
 #else
-		    free(s);
+		    LargeVecFree(s, s);
 #endif
 		} else {
 #ifdef LONG_VECTOR_SUPPORT
@@ -1139,9 +1594,8 @@ static void AdjustHeapSize(R_size_t size_needed)
   if (an__n__ && NODE_GEN_IS_YOUNGER(an__n__, an__g__)) { \
     if (NODE_IS_MARKED(an__n__)) \
        R_GenHeap[NODE_CLASS(an__n__)].OldCount[NODE_GENERATION(an__n__)]--; \
-    else \
-      MARK_NODE(an__n__); \
     SET_NODE_GENERATION(an__n__, an__g__); \
+    MARK_NODE(an__n__); \
     UNSNAP_NODE(an__n__); \
     SET_NEXT_NODE(an__n__, forwarded_nodes); \
     forwarded_nodes = an__n__; \
@@ -1541,7 +1995,307 @@ SEXP attribute_hidden do_regFinaliz(SEXP call, SEXP op, SEXP args, SEXP rho)
     } \
 } while (0)
 
-static void RunGenCollect(R_size_t size_needed)
+/* Parallel Marking.  If R_GC_MARK_THREADS is set to more than one the
+   main processing loop of collections of the old generations runs on
+   that many OpenMP threads.  The node lists are not safe for
+   concurrent updates, so the threads only claim nodes by marking them
+   atomically and keep the claimed nodes on mark stacks; the
+   marked nodes are moved from the New lists to their Old lists one
+   class at a time afterwards.  Each thread works from a private stack
+   and moves half of it to its shared stack while other threads are out
+   of work; idle threads take work from the shared stacks.  The
+   old-to-new lists and all roots are still handled before, and weak
+   references and the CHARSXP cache after the parallel phase. */
+
+#if defined(_OPENMP) && ! defined(PROTECTCHECK)
+# define PARALLEL_MARK
+#endif
+
+/* work of the threads in the last parallel mark, reported by gcinfo */
+static int mark_threads_used = 0;
+static unsigned long mark_thread_nodes[MAX_MARK_THREADS];
+static unsigned long mark_steals;
+
+// parallel marks and their work, for the tracer
+unsigned long gc_parallel_marks, gc_parallel_mark_nodes;
+unsigned long gc_parallel_mark_steals, gc_parallel_mark_busiest;
+
+#ifdef PARALLEL_MARK
+typedef struct {
+    SEXP *stack;		/* private mark stack */
+    size_t n, size;
+    SEXP *shared;		/* work offered to other threads */
+    size_t nshared, sharedsize;
+    omp_lock_t lock;
+    unsigned long nodes, steals;
+    Rboolean overflow;
+} mark_thread_t;
+
+static mark_thread_t *mark_threads = NULL;
+static int mark_nstacks, mark_nthreads, mark_idle;
+
+/* the mark bit, epoch and generation of a node are updated together by
+   a compare-and-swap of the whole header */
+typedef union {
+    struct sxpinfo_struct sxpinfo;	/* so that the node macros apply */
+    unsigned long long word;
+} sxpinfo_word_t;
+
+#define SXPINFO_WORD(s) ((unsigned long long *) &(s)->sxpinfo)
+
+/* marks a node like FORWARD_NODE, returns TRUE if this thread marked it
+   and the previous header in *old */
+static R_INLINE Rboolean CLAIM_NODE(SEXP s, unsigned long long *old)
+{
+    sxpinfo_word_t u;
+    u.word = __atomic_load_n(SXPINFO_WORD(s), __ATOMIC_RELAXED);
+    for (;;) {
+	sxpinfo_word_t v = u;
+	if (NODE_IS_MARKED(&v))
+	    return FALSE;
+	AGE_AND_MARK_NODE(&v);
+	if (__atomic_compare_exchange_n(SXPINFO_WORD(s), &u.word, v.word, FALSE,
+					__ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+	    *old = u.word;
+	    return TRUE;
+	}
+    }
+}
+
+#define UNCLAIM_NODE(s, old) \
+    __atomic_store_n(SXPINFO_WORD(s), (old), __ATOMIC_RELAXED)
+
+static Rboolean grow_mark_stack(SEXP **stack, size_t *size, size_t needed)
+{
+    size_t newsize = *size ? *size : 4096;
+    while (newsize < needed)
+	newsize *= 2;
+    if (newsize == *size)
+	return TRUE;
+    SEXP *newstack = realloc(*stack, newsize * sizeof(SEXP));
+    if (newstack == NULL)
+	return FALSE;
+    *stack = newstack;
+    *size = newsize;
+    return TRUE;
+}
+
+/* a node that cannot be pushed gets its old header back; its parent is
+   marked and is scanned again after the parallel phase */
+static void mark_push(mark_thread_t *t, SEXP s, unsigned long long old)
+{
+    if (t->n == t->size && ! grow_mark_stack(&t->stack, &t->size, t->n + 1)) {
+	UNCLAIM_NODE(s, old);
+	t->overflow = TRUE;
+	return;
+    }
+    t->stack[t->n++] = s;
+}
+
+#define PAR_FORWARD_NODE(s, t) do { \
+  SEXP pf__n__ = (s); \
+  unsigned long long pf__old__; \
+  if (pf__n__ && CLAIM_NODE(pf__n__, &pf__old__)) \
+    mark_push(t, pf__n__, pf__old__); \
+} while (0)
+
+/* move the older half of the private stack to the shared one */
+static void share_mark_work(mark_thread_t *t)
+{
+    size_t half = t->n / 2;
+
+    omp_set_lock(&t->lock);
+    if (t->nshared == 0 &&
+	grow_mark_stack(&t->shared, &t->sharedsize, half)) {
+	memcpy(t->shared, t->stack, half * sizeof(SEXP));
+	memmove(t->stack, t->stack + half, (t->n - half) * sizeof(SEXP));
+	t->n -= half;
+	__atomic_store_n(&t->nshared, half, __ATOMIC_RELEASE);
+    }
+    omp_unset_lock(&t->lock);
+}
+
+/* take the shared work of thread 'from' into the private stack of t */
+static Rboolean take_mark_work(mark_thread_t *t, mark_thread_t *from)
+{
+    Rboolean taken = FALSE;
+
+    if (__atomic_load_n(&from->nshared, __ATOMIC_ACQUIRE) == 0)
+	return FALSE;
+    omp_set_lock(&from->lock);
+    size_t n = from->nshared;
+    if (n > 0 && grow_mark_stack(&t->stack, &t->size, t->n + n)) {
+	memcpy(t->stack + t->n, from->shared, n * sizeof(SEXP));
+	t->n += n;
+	__atomic_store_n(&from->nshared, 0, __ATOMIC_RELEASE);
+	taken = TRUE;
+    }
+    omp_unset_lock(&from->lock);
+    return taken;
+}
+
+static Rboolean find_mark_work(int me)
+{
+    mark_thread_t *t = mark_threads + me;
+
+    if (take_mark_work(t, t))
+	return TRUE;
+    for (int i = 1; i < mark_nstacks; i++)
+	if (take_mark_work(t, mark_threads + (me + i) % mark_nstacks)) {
+	    t->steals++;
+	    return TRUE;
+	}
+    return FALSE;
+}
+
+static void mark_worker(int me)
+{
+    mark_thread_t *t = mark_threads + me;
+
+    for (;;) {
+	while (t->n > 0) {
+	    SEXP s = t->stack[--t->n];
+	    t->nodes++;
+	    DO_CHILDREN(s, PAR_FORWARD_NODE, t);
+	    if (t->n > 1 && __atomic_load_n(&mark_idle, __ATOMIC_RELAXED) &&
+		__atomic_load_n(&t->nshared, __ATOMIC_RELAXED) == 0)
+		share_mark_work(t);
+	}
+	if (find_mark_work(me))
+	    continue;
+
+	/* wait until work is shared or all threads are idle */
+	__atomic_add_fetch(&mark_idle, 1, __ATOMIC_ACQ_REL);
+	for (;;) {
+	    if (__atomic_load_n(&mark_idle, __ATOMIC_ACQUIRE) == mark_nthreads)
+		return;
+	    Rboolean work = FALSE;
+	    for (int i = 0; i < mark_nstacks && ! work; i++)
+		if (__atomic_load_n(&mark_threads[i].nshared, __ATOMIC_ACQUIRE))
+		    work = TRUE;
+	    if (work) {
+		__atomic_sub_fetch(&mark_idle, 1, __ATOMIC_ACQ_REL);
+		break;
+	    }
+#ifdef HAVE_SCHED_H
+	    sched_yield();
+#endif
+	}
+    }
+}
+
+static Rboolean init_mark_threads(int n)
+{
+    static int allocated = 0;
+
+    if (sizeof(struct sxpinfo_struct) != sizeof(unsigned long long))
+	return FALSE;
+    if (allocated < n) {
+	mark_thread_t *threads = realloc(mark_threads, n * sizeof(mark_thread_t));
+	if (threads == NULL)
+	    return FALSE;
+	mark_threads = threads;
+	for (int i = allocated; i < n; i++) {
+	    memset(mark_threads + i, 0, sizeof(mark_thread_t));
+	    omp_init_lock(&mark_threads[i].lock);
+	}
+	allocated = n;
+    }
+    return TRUE;
+}
+
+/* Process the forwarded nodes in parallel. The nodes' children are
+   marked by the threads and left in the New lists, which are then
+   moved to the Old lists here. Returns the nodes that still have to be
+   processed by PROCESS_NODES: all of them if the threads could not be
+   set up, or the unmarked children of marked nodes if a mark stack
+   could not grow. */
+static SEXP ProcessNodesParallel(SEXP forwarded_nodes)
+{
+    int i, n = R_GCMarkThreads;
+    size_t count = 0;
+    SEXP s;
+
+    if (! init_mark_threads(n))
+	return forwarded_nodes;
+    for (s = forwarded_nodes; s != NULL; s = NEXT_NODE(s))
+	count++;
+    for (i = 0; i < n; i++) {
+	mark_thread_t *t = mark_threads + i;
+	if (! grow_mark_stack(&t->shared, &t->sharedsize, count / n + 1))
+	    return forwarded_nodes;
+	t->n = t->nshared = 0;
+	t->nodes = t->steals = 0;
+	t->overflow = FALSE;
+    }
+
+    /* the forwarded nodes go back to the New lists, so all nodes whose
+       children are marked in parallel are found there afterwards */
+    for (i = 0; forwarded_nodes != NULL; i = (i + 1) % n) {
+	s = forwarded_nodes;
+	forwarded_nodes = NEXT_NODE(forwarded_nodes);
+	SNAP_NODE(s, R_GenHeap[NODE_CLASS(s)].New);
+	mark_threads[i].shared[mark_threads[i].nshared++] = s;
+    }
+
+    mark_nstacks = n;
+    mark_idle = 0;
+#pragma omp parallel num_threads(n)
+    {
+#pragma omp single
+	mark_nthreads = omp_get_num_threads();
+	mark_worker(omp_get_thread_num());
+    }
+
+    Rboolean overflow = FALSE;
+    mark_threads_used = mark_nthreads;
+    mark_steals = 0;
+    unsigned long nodes = 0, busiest = 0;
+    for (i = 0; i < mark_nthreads; i++) {
+	mark_thread_t *t = mark_threads + i;
+	mark_thread_nodes[i] = t->nodes;
+	mark_steals += t->steals;
+	nodes += t->nodes;
+	if (t->nodes > busiest)
+	    busiest = t->nodes;
+	overflow |= t->overflow;
+    }
+    gc_parallel_marks++;
+    gc_parallel_mark_nodes += nodes;
+    gc_parallel_mark_steals += mark_steals;
+    gc_parallel_mark_busiest += busiest;
+
+    /* rescan marked nodes if children were dropped; the children are
+       unsnapped by FORWARD_CHILDREN, marked nodes stay in place */
+    if (overflow)
+	for (i = 0; i < NUM_NODE_CLASSES; i++)
+	    for (s = NEXT_NODE(R_GenHeap[i].New);
+		 s != R_GenHeap[i].New;
+		 s = NEXT_NODE(s))
+		if (NODE_IS_MARKED(s))
+		    FORWARD_CHILDREN(s);
+
+    /* the classes have separate lists, so they can be moved in parallel */
+#pragma omp parallel for num_threads(n) schedule(dynamic, 1) private(s)
+    for (i = 0; i < NUM_NODE_CLASSES; i++) {
+	s = NEXT_NODE(R_GenHeap[i].New);
+	while (s != R_GenHeap[i].New) {
+	    SEXP next = NEXT_NODE(s);
+	    if (NODE_IS_MARKED(s)) {
+		UNSNAP_NODE(s);
+		SNAP_NODE(s, R_GenHeap[i].Old[NODE_GENERATION(s)]);
+		R_GenHeap[i].OldCount[NODE_GENERATION(s)]++;
+	    }
+	    s = next;
+	}
+    }
+
+    return forwarded_nodes;
+}
+#endif
+
+/* returns the number of old generations collected */
+static int RunGenCollect(R_size_t size_needed)
 {
     int i, gen, gens_collected;
     RCNTXT *ctxt;
@@ -1549,6 +2303,8 @@ static void RunGenCollect(R_size_t size_needed)
     SEXP forwarded_nodes;
 
     bad_sexp_type_seen = 0;
+    mark_threads_used = 0;
+    RetireBumpPages();
 
     /* determine number of generations to collect */
     while (num_old_gens_to_collect < NUM_OLD_GENERATIONS) {
@@ -1589,18 +2345,12 @@ static void RunGenCollect(R_size_t size_needed)
     DEBUG_CHECK_NODE_COUNTS("at start");
 
     /* unmark all marked nodes in old generations to be collected and
-       move to New space */
+       move to New space; the survivors move up a generation when they
+       are marked again */
     for (gen = 0; gen < num_old_gens_to_collect; gen++) {
+	NewMarkEpoch(gen);
 	for (i = 0; i < NUM_NODE_CLASSES; i++) {
 	    R_GenHeap[i].OldCount[gen] = 0;
-	    s = NEXT_NODE(R_GenHeap[i].Old[gen]);
-	    while (s != R_GenHeap[i].Old[gen]) {
-		SEXP next = NEXT_NODE(s);
-		if (gen < NUM_OLD_GENERATIONS - 1)
-		    SET_NODE_GENERATION(s, gen + 1);
-		UNMARK_NODE(s);
-		s = next;
-	    }
 	    if (NEXT_NODE(R_GenHeap[i].Old[gen]) != R_GenHeap[i].Old[gen])
 		BULK_MOVE(R_GenHeap[i].Old[gen], R_GenHeap[i].New);
 	}
@@ -1700,6 +2450,10 @@ static void RunGenCollect(R_size_t size_needed)
     FORWARD_NODE(R_CachedScalarInteger);
 
     /* main processing loop */
+#ifdef PARALLEL_MARK
+    if (R_GCMarkThreads > 1 && gens_collected > 0)
+	forwarded_nodes = ProcessNodesParallel(forwarded_nodes);
+#endif
     PROCESS_NODES();
 
     /* identify weakly reachable nodes */
@@ -1875,6 +2629,7 @@ static void RunGenCollect(R_size_t size_needed)
 	/**** do some adjustment for intermediate collections? */
 	AdjustHeapSize(size_needed);
 	TryToReleasePages();
+	AgeLargeBlockCache();
 	DEBUG_CHECK_NODE_COUNTS("after heap adjustment");
     }
     else if (gens_collected > 0) {
@@ -1897,6 +2652,8 @@ static void RunGenCollect(R_size_t size_needed)
 	REprintf(" (level %d) ... ", gens_collected);
 	DEBUG_GC_SUMMARY(gens_collected == NUM_OLD_GENERATIONS);
     }
+
+    return gens_collected;
 }
 
 /* count all not-yet-counted promises */
@@ -2496,6 +3253,7 @@ SEXP attribute_hidden mkPROMISE(SEXP expr, SEXP rho)
 	QUICK_GET_FREE_NODE(s);
 
     traceR_promise_stats.created++;
+    traceR_count_closure_promise();
     ADD_ALLOC(prom);
 
     /* precaution to ensure code does not get modified via
@@ -2568,7 +3326,7 @@ static void custom_node_free(void *ptr) {
 #define intCHARSXP 73
 
 SEXP allocVector3(SEXPTYPE type, R_xlen_t length, R_allocator_t *allocator) {
-    return allocVector3Internal(type, length, NULL, TRUE);
+    return allocVector3Internal(type, length, allocator, TRUE);
 }
 
 static SEXP allocVector3Internal(SEXPTYPE type, R_xlen_t length,
@@ -2599,7 +3357,7 @@ static SEXP allocVector3Internal(SEXPTYPE type, R_xlen_t length,
 		    mem_err_heap(size);
 	    }
 
-	    CLASS_GET_FREE_NODE(node_class, s);
+	    CLASS_GET_FREE_VEC_NODE(node_class, s);
 #if VALGRIND_LEVEL > 1 || defined(TRACER_COMPILED_IN)
 	    switch(type) {
 	    case REALSXP: actual_size = sizeof(double); break;
@@ -2755,7 +3513,7 @@ static SEXP allocVector3Internal(SEXPTYPE type, R_xlen_t length,
 
     if (size > 0) {
 	if (node_class < NUM_SMALL_NODE_CLASSES) {
-	    CLASS_GET_FREE_NODE(node_class, s);
+	    CLASS_GET_FREE_VEC_NODE(node_class, s);
 #if VALGRIND_LEVEL > 1
 	    VALGRIND_MAKE_MEM_UNDEFINED(DATAPTR(s), actual_size);
 #endif
@@ -2776,10 +3534,12 @@ static SEXP allocVector3Internal(SEXPTYPE type, R_xlen_t length,
 		hdrsize = sizeof(SEXPREC_ALIGN) + sizeof(R_long_vec_hdr_t);
 #endif
 	    void *mem = NULL; /* initialize to suppress warning */
+	    Rboolean mapped = FALSE;
 	    if (size < (R_SIZE_T_MAX / sizeof(VECREC)) - hdrsize) { /*** not sure this test is quite right -- why subtract the header? LT */
 		mem = allocator ?
 		    custom_node_alloc(allocator, hdrsize + size * sizeof(VECREC)) :
-		    malloc(hdrsize + size * sizeof(VECREC));
+		    LargeVecAlloc(size, hdrsize + size * sizeof(VECREC),
+				  &mapped);
 		if (mem == NULL) {
 		    /* If we are near the address space limit, we
 		       might be short of address space.  So return
@@ -2787,7 +3547,8 @@ static SEXP allocVector3Internal(SEXPTYPE type, R_xlen_t length,
 		    R_gc_full(alloc_size);
 		    mem = allocator ?
 			custom_node_alloc(allocator, hdrsize + size * sizeof(VECREC)) :
-			malloc(hdrsize + size * sizeof(VECREC));
+			LargeVecAlloc(size, hdrsize + size * sizeof(VECREC),
+				      &mapped);
 		}
 		if (mem != NULL) {
 #ifdef LONG_VECTOR_SUPPORT
@@ -2834,6 +3595,7 @@ static SEXP allocVector3Internal(SEXPTYPE type, R_xlen_t length,
 					  size * sizeof(VECREC),
 					  sizeof(SEXPREC_ALIGN) + size * sizeof(VECREC));
 	    s->sxpinfo = UnmarkedNodeTemplate.sxpinfo;
+	    s->sxpinfo.mapped = mapped;
 	    INIT_REFCNT(s);
 	    SET_NODE_CLASS(s, node_class);
 	    if (!allocator) R_LargeVallocSize += size;
@@ -3072,14 +3834,32 @@ static void R_gc_internal(R_size_t size_needed)
     R_N_maxused = R_MAX(R_N_maxused, R_NodesInUse);
     R_V_maxused = R_MAX(R_V_maxused, R_VSize - VHEAP_FREE());
 
+    struct timespec gc_start;
+    R_size_t nodes_before = R_NodesInUse;
+    R_size_t vcells_before = R_SmallVallocSize + R_LargeVallocSize;
+    R_size_t large_before = R_LargeVallocSize;
+    int gens_collected;
+
+    if (traceR_is_active)
+	clock_gettime(CLOCK_MONOTONIC, &gc_start);
+
     BEGIN_SUSPEND_INTERRUPTS {
 	R_in_gc = TRUE;
 	gc_start_timing();
-	RunGenCollect(size_needed);
+	gens_collected = RunGenCollect(size_needed);
 	gc_end_timing();
 	R_in_gc = FALSE;
     } END_SUSPEND_INTERRUPTS;
 
+    if (traceR_is_active)
+	traceR_count_gc(gens_collected, &gc_start,
+			nodes_before * sizeof(SEXPREC) + vcells_before * vsfac,
+			R_NodesInUse * sizeof(SEXPREC) +
+			(R_SmallVallocSize + R_LargeVallocSize) * vsfac,
+			(large_before - R_LargeVallocSize) * vsfac);
+
+    traceR_checkpoint_poll();
+
     if (bad_sexp_type_seen != 0 && first_bad_sexp_type == 0) {
 	first_bad_sexp_type = bad_sexp_type_seen;
 #ifdef PROTECTCHECK
@@ -3101,6 +3881,12 @@ static void R_gc_internal(R_size_t size_needed)
 	vcells = 0.1*ceil(10*vcells * vsfac/Mega);
 	REprintf("%.1f Mbytes of vectors used (%d%%)\n",
 		 vcells, (int) (vfrac + 0.5));
+	if (mark_threads_used > 0) {
+	    REprintf("nodes marked by %d threads:", mark_threads_used);
+	    for (int i = 0; i < mark_threads_used; i++)
+		REprintf(" %lu", mark_thread_nodes[i]);
+	    REprintf(" (%lu steals)\n", mark_steals);
+	}
     }
 
 #ifdef IMMEDIATE_FINALIZERS
@@ -3922,6 +4708,16 @@ void (UNSET_NO_SPECIAL_SYMBOLS)(SEXP b) { UNSET_NO_SPECIAL_SYMBOLS(b); }
 attribute_hidden
 Rboolean (NO_SPECIAL_SYMBOLS)(SEXP b) { return NO_SPECIAL_SYMBOLS(b); }
 
+attribute_hidden
+void (SET_S3_METHOD_SYMBOL)(SEXP b) { SET_S3_METHOD_SYMBOL(b); }
+attribute_hidden
+Rboolean (IS_S3_METHOD_SYMBOL)(SEXP b) { return IS_S3_METHOD_SYMBOL(b); }
+
+attribute_hidden
+void (SET_FUN_CACHE_SYMBOL)(SEXP b) { SET_FUN_CACHE_SYMBOL(b); }
+attribute_hidden
+Rboolean (IS_FUN_CACHE_SYMBOL)(SEXP b) { return IS_FUN_CACHE_SYMBOL(b); }
+
 /* R_FunTab accessors, only needed when write barrier is on */
 /* Not hidden to allow experimentaiton without rebuilding R - LT */
 /* attribute_hidden */
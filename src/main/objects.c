@@ -306,20 +306,26 @@ SEXP dispatchMethod(SEXP op, SEXP sxp, SEXP dotClass, RCNTXT *cptr, SEXP method,
 
     if (TYPEOF(op) == CLOSXP) {
 	SEXP formals = FORMALS(op);
+	SEXP table = HASHTAB(cptr->cloenv); /* frames of wide generics */
+	int nchains = table == R_NilValue ? 1 : LENGTH(table);
 	SEXP s, t;
 	int matched;
 
-	for (s = FRAME(cptr->cloenv); s != R_NilValue; s = CDR(s)) {
-	    matched = 0;
-	    for (t = formals; t != R_NilValue; t = CDR(t))
-		if (TAG(t) == TAG(s)) {
-		    matched = 1;
-		    break;
+	for (int i = 0; i < nchains; i++) {
+	    SEXP chain = table == R_NilValue ? FRAME(cptr->cloenv) :
+		VECTOR_ELT(table, i);
+	    for (s = chain; s != R_NilValue; s = CDR(s)) {
+		matched = 0;
+		for (t = formals; t != R_NilValue; t = CDR(t))
+		    if (TAG(t) == TAG(s)) {
+			matched = 1;
+			break;
+		    }
+		if (!matched) {
+		    UNPROTECT(1); /* newvars */
+		    newvars = PROTECT(CONS(CAR(s), newvars));
+		    SET_TAG(newvars, TAG(s));
 		}
-	    if (!matched) {
-		UNPROTECT(1); /* newvars */
-		newvars = PROTECT(CONS(CAR(s), newvars));
-		SET_TAG(newvars, TAG(s));
 	    }
 	}
     }
@@ -339,6 +345,184 @@ SEXP dispatchMethod(SEXP op, SEXP sxp, SEXP dotClass, RCNTXT *cptr, SEXP method,
     return ans;
 }
 
+/*  S3 dispatch cache
+ *
+ *  usemethod remembers the method a call site dispatched to for a
+ *  class vector (or that there was none, the usual result for the
+ *  internal dispatch of primitives), so repeated dispatch does not
+ *  build the "generic.class" names and search the environments again. Entries are keyed by the
+ *  call, the generic, its definition environment, the environment the
+ *  generic was called from and the classes (the CHARSXPs are unique,
+ *  so they are compared by address). As the calling environment is
+ *  usually a fresh function frame, the enclosure of an unhashed frame
+ *  is used instead, and the frame itself must not bind any method.
+ *  Only dispatch from and of generics defined in the global
+ *  environment, one on the search path or a namespace is cached (see
+ *  R_EnvIsCacheKey), and the entries do not keep these environments
+ *  or the call alive.
+ *
+ *  Every symbol a lookup used is marked. Changing a binding of a marked
+ *  symbol in any environment, attach, detach, parent.env<- and
+ *  unregistering a namespace bump R_S3MethodsEpoch, which invalidates
+ *  all entries. Values of active bindings and arguments named like
+ *  methods in frames above the calling one are not noticed.
+ */
+
+#define USE_S3_DISPATCH_CACHE
+
+#ifdef USE_S3_DISPATCH_CACHE
+#define S3CACHE_SETS	 256
+#define S3CACHE_WAYS	 4
+#define S3CACHE_MAXCLASS 8
+
+typedef struct {
+    unsigned int epoch;	/* R_S3MethodsEpoch when added, 0 when empty */
+    int frame;		/* rho is the enclosure of the calling frame */
+    int nclass;
+    int which;		/* class the method is for, -1 for the default,
+			   -2 if there is no method */
+    SEXP call, generic, defrho, rho;
+    SEXP klass[S3CACHE_MAXCLASS];
+    SEXP method, sxp;
+} s3cache_entry_t;
+
+static s3cache_entry_t s3cache[S3CACHE_SETS][S3CACHE_WAYS];
+static unsigned int s3cache_next[S3CACHE_SETS];
+static SEXP s3cache_keep = NULL; /* the classes, generics and methods of
+				    the entries */
+
+static R_INLINE unsigned int s3cacheSet(SEXP call)
+{
+    return ((size_t) call / sizeof(SEXPREC)) % S3CACHE_SETS;
+}
+
+static R_INLINE int s3cacheFrame(SEXP rho)
+{
+    return HASHTAB(rho) == R_NilValue &&
+	rho != R_BaseEnv && rho != R_BaseNamespace;
+}
+
+static R_INLINE int frameHasMethods(SEXP rho)
+{
+    for (SEXP frame = FRAME(rho); frame != R_NilValue; frame = CDR(frame))
+	if (IS_S3_METHOD_SYMBOL(TAG(frame)))
+	    return 1;
+    return 0;
+}
+
+static s3cache_entry_t *s3cacheFind(const char *generic, SEXP klass,
+				    SEXP call, SEXP callrho, SEXP defrho)
+{
+    s3cache_entry_t *set = s3cache[s3cacheSet(call)];
+    int frame = s3cacheFrame(callrho);
+    int nclass = LENGTH(klass);
+    SEXP rho = frame ? ENCLOS(callrho) : callrho;
+
+    for (int w = 0; w < S3CACHE_WAYS; w++) {
+	s3cache_entry_t *e = &set[w];
+	int i;
+
+	if (e->epoch != R_S3MethodsEpoch || e->call != call ||
+	    e->rho != rho || e->frame != frame || e->defrho != defrho ||
+	    e->nclass != nclass)
+	    continue;
+	for (i = 0; i < nclass; i++)
+	    if (STRING_ELT(klass, i) != e->klass[i])
+		break;
+	if (i < nclass || strcmp(CHAR(e->generic), generic))
+	    continue;
+	if (frame && frameHasMethods(callrho))
+	    return NULL;
+	return e;
+    }
+    return NULL;
+}
+
+static void s3cacheAdd(unsigned int epoch, const char *generic, SEXP klass,
+		       int which, SEXP call, SEXP callrho, SEXP defrho,
+		       SEXP method, SEXP sxp)
+{
+    unsigned int nset = s3cacheSet(call);
+    s3cache_entry_t *set = s3cache[nset], *e = NULL;
+    int frame = s3cacheFrame(callrho);
+    int nclass = LENGTH(klass);
+    SEXP rho = frame ? ENCLOS(callrho) : callrho;
+    int w;
+
+    /* a lookup evaluated code that changed a method */
+    if (epoch != R_S3MethodsEpoch || nclass > S3CACHE_MAXCLASS)
+	return;
+    if (frame && frameHasMethods(callrho))
+	return;
+    if (! R_EnvIsCacheKey(rho) || ! R_EnvIsCacheKey(defrho))
+	return;
+
+    if (s3cache_keep == NULL) {
+	s3cache_keep = allocVector(VECSXP, S3CACHE_SETS * S3CACHE_WAYS);
+	R_PreserveObject(s3cache_keep);
+	SET_S3_METHOD_SYMBOL(install(".__S3MethodsTable__."));
+    }
+
+    /* replace a stale entry, or the oldest one */
+    for (w = 0; w < S3CACHE_WAYS; w++)
+	if (set[w].epoch != R_S3MethodsEpoch) {
+	    e = &set[w];
+	    break;
+	}
+    if (e == NULL) {
+	w = s3cache_next[nset]++ % S3CACHE_WAYS;
+	e = &set[w];
+    }
+
+    /* a stale call only costs a lookup: the method found depends on
+       the other keys */
+    SEXP keep = PROTECT(allocVector(VECSXP, 3));
+    SEXP kcopy = allocVector(STRSXP, nclass);
+    SET_VECTOR_ELT(keep, 0, kcopy);
+    for (int i = 0; i < nclass; i++)
+	SET_STRING_ELT(kcopy, i, STRING_ELT(klass, i));
+    SET_VECTOR_ELT(keep, 1, mkChar(generic));
+    SET_VECTOR_ELT(keep, 2, sxp);
+    SET_VECTOR_ELT(s3cache_keep, nset * S3CACHE_WAYS + w, keep);
+    UNPROTECT(1);
+
+    e->epoch   = epoch;
+    e->frame   = frame;
+    e->nclass  = nclass;
+    e->which   = which;
+    e->call    = call;
+    e->generic = VECTOR_ELT(keep, 1);
+    e->defrho  = defrho;
+    e->rho     = rho;
+    for (int i = 0; i < nclass; i++)
+	e->klass[i] = STRING_ELT(kcopy, i);
+    e->method  = method;
+    e->sxp     = sxp;
+}
+#endif
+
+/* dispatch to the method for class i of klass, or the default for -1 */
+static SEXP dispatchClass(SEXP op, SEXP sxp, SEXP klass, int i, RCNTXT *cptr,
+			  SEXP method, const char *generic, SEXP rho,
+			  SEXP callrho, SEXP defrho)
+{
+    SEXP ans;
+
+    if (i < 0)
+	return dispatchMethod(op, sxp, R_NilValue, cptr, method, generic,
+			      rho, callrho, defrho);
+    if (i == 0)
+	return dispatchMethod(op, sxp, klass, cptr, method, generic,
+			      rho, callrho, defrho);
+
+    SEXP dotClass = PROTECT(stringSuffix(klass, i));
+    setAttrib(dotClass, R_PreviousSymbol, klass);
+    ans = dispatchMethod(op, sxp, dotClass, cptr, method, generic,
+			 rho, callrho, defrho);
+    UNPROTECT(1); /* dotClass */
+    return ans;
+}
+
 attribute_hidden
 int usemethod(const char *generic, SEXP obj, SEXP call, SEXP args,
 	      SEXP rho, SEXP callrho, SEXP defrho, SEXP *ans)
@@ -354,39 +538,69 @@ int usemethod(const char *generic, SEXP obj, SEXP call, SEXP args,
     op = cptr->callfun;
     PROTECT(klass = R_data_class2(obj));
 
+#ifdef USE_S3_DISPATCH_CACHE
+    s3cache_entry_t *hit = s3cacheFind(generic, klass, cptr->call,
+				       callrho, defrho);
+    if (hit && hit->which == -2) {
+	UNPROTECT(1); /* klass */
+	cptr->callflag = CTXT_RETURN;
+	return 0;
+    }
+    if (hit) {
+	/* the entry may be replaced while the method runs */
+	PROTECT(sxp = hit->sxp);
+	*ans = dispatchClass(op, sxp, klass, hit->which, cptr, hit->method,
+			     generic, rho, callrho, defrho);
+	UNPROTECT(2); /* klass, sxp */
+	return 1;
+    }
+    unsigned int epoch = R_S3MethodsEpoch;
+#endif
+
     nclass = length(klass);
     for (i = 0; i < nclass; i++) {
 	const void *vmax = vmaxget();
 	const char *ss = translateChar(STRING_ELT(klass, i));
 	method = installS3Signature(generic, ss);
 	vmaxset(vmax);
+#ifdef USE_S3_DISPATCH_CACHE
+	SET_S3_METHOD_SYMBOL(method);
+#endif
 	sxp = R_LookupMethod(method, rho, callrho, defrho);
 	if (isFunction(sxp)) {
 	    if(method == R_SortListSymbol && CLOENV(sxp) == R_BaseNamespace)
 		continue; /* kludge because sort.list is not a method */
 	    PROTECT(sxp);
-	    if (i > 0) {
-		SEXP dotClass = PROTECT(stringSuffix(klass, i));
-		setAttrib(dotClass, R_PreviousSymbol, klass);
-		*ans = dispatchMethod(op, sxp, dotClass, cptr, method, generic,
-				      rho, callrho, defrho);
-		UNPROTECT(1); /* dotClass */
-	    } else {
-		*ans = dispatchMethod(op, sxp, klass, cptr, method, generic,
-				      rho, callrho, defrho);
-	    }
+#ifdef USE_S3_DISPATCH_CACHE
+	    s3cacheAdd(epoch, generic, klass, i, cptr->call, callrho, defrho,
+		       method, sxp);
+#endif
+	    *ans = dispatchClass(op, sxp, klass, i, cptr, method, generic,
+				 rho, callrho, defrho);
 	    UNPROTECT(2); /* klass, sxp */
 	    return 1;
 	}
     }
     method = installS3Signature(generic, "default");
+#ifdef USE_S3_DISPATCH_CACHE
+    SET_S3_METHOD_SYMBOL(method);
+#endif
     PROTECT(sxp = R_LookupMethod(method, rho, callrho, defrho));
     if (isFunction(sxp)) {
-	*ans = dispatchMethod(op, sxp, R_NilValue, cptr, method, generic,
-			      rho, callrho, defrho);
+#ifdef USE_S3_DISPATCH_CACHE
+	s3cacheAdd(epoch, generic, klass, -1, cptr->call, callrho, defrho,
+		   method, sxp);
+#endif
+	*ans = dispatchClass(op, sxp, klass, -1, cptr, method, generic,
+			     rho, callrho, defrho);
 	UNPROTECT(2); /* klass, sxp */
 	return 1;
     }
+#ifdef USE_S3_DISPATCH_CACHE
+    /* internal dispatch of primitives mostly finds no method */
+    s3cacheAdd(epoch, generic, klass, -2, cptr->call, callrho, defrho,
+	       method, R_NilValue);
+#endif
     UNPROTECT(2); /* klass, sxp */
     cptr->callflag = CTXT_RETURN;
     return 0;
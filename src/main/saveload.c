@@ -768,7 +768,7 @@ static SEXP DataLoad(FILE *fp, int startup, InputRoutines *m,
 #endif /* NDEBUG */
 
 
-static void NewWriteItem (SEXP s, SEXP sym_list, SEXP env_list, FILE *fp, OutputRoutines *, SaveLoadData *);
+static void NewWriteItem (SEXP s, R_ptrhash_t *sym_list, R_ptrhash_t *env_list, FILE *fp, OutputRoutines *, SaveLoadData *);
 static SEXP NewReadItem (SEXP sym_table, SEXP env_table, FILE *fp, InputRoutines *, SaveLoadData *);
 
 
@@ -807,76 +807,41 @@ static SEXP NewLoadSpecialHook (SEXPTYPE type)
  *   Otherwise, a value of zero is returned.
  *
  *  The "list" is managed with a hash table.  This results in
- *  significant speedups for saving large amounts of code.  A fixed
- *  hash table size is used; this is not ideal but seems adequate for
- *  now.  The hash table representation consists of a (list . vector)
- *  pair.  The hash buckets are in the vector.  The list holds the
- *  list of keys.  This list is in reverse order to the way the keys
- *  were added (i.e. the most recently added key is first).  The
- *  indices produced by HashAdd are in order.  Since the list is
- *  written out in order, we either have to reverse the list or
- *  reverse the indices; to retain byte for byte compatibility the
- *  function FixHashEntries reverses the indices.  FixHashEntries must
- *  be called after filling the tables and before using them to find
- *  indices.  LT */
-
-#define HASHSIZE 1099
-
-#define PTRHASH(obj) (((R_size_t) (obj)) >> 2)
-
-#define HASH_TABLE_KEYS_LIST(ht) CAR(ht)
-#define SET_HASH_TABLE_KEYS_LIST(ht, v) SETCAR(ht, v)
-
-#define HASH_TABLE_COUNT(ht) TRUELENGTH(CDR(ht))
-#define SET_HASH_TABLE_COUNT(ht, val) SET_TRUELENGTH(CDR(ht), val)
-
-#define HASH_TABLE_SIZE(ht) LENGTH(CDR(ht))
-
-#define HASH_BUCKET(ht, pos) VECTOR_ELT(CDR(ht), pos)
-#define SET_HASH_BUCKET(ht, pos, val) SET_VECTOR_ELT(CDR(ht), pos, val)
-
-static SEXP MakeHashTable(void)
-{
-    SEXP val = CONS(R_NilValue, allocVector(VECSXP, HASHSIZE));
-    SET_HASH_TABLE_COUNT(val, 0);
-    return val;
-}
-
-static void FixHashEntries(SEXP ht)
-{
-    SEXP cell;
-    int count;
-    for (cell = HASH_TABLE_KEYS_LIST(ht), count = 1;
-	 cell != R_NilValue;
-	 cell = CDR(cell), count++)
-	INTEGER(TAG(cell))[0] = count;
+ *  significant speedups for saving large amounts of code.  The table
+ *  is the open addressing pointer table of serialize.c.  The indices
+ *  produced by HashAdd are in the order the keys were added, but the
+ *  keys are written out most recently added first; to retain byte for
+ *  byte compatibility the function FixHashEntries reverses the
+ *  indices and returns a vector of the keys in the order they are
+ *  written.  FixHashEntries must be called after filling the tables
+ *  and before using them to find indices.  LT */
+
+#define HASHSIZE 1024
+
+static SEXP FixHashEntries(R_ptrhash_t *ht)
+{
+    SEXP keys = allocVector(VECSXP, ht->count);
+    R_size_t i;
+    for (i = 0; i < ht->size; i++)
+	if (ht->tab[i].key != NULL) {
+	    ht->tab[i].val = (int) ht->count + 1 - ht->tab[i].val;
+	    SET_VECTOR_ELT(keys, ht->tab[i].val - 1, ht->tab[i].key);
+	}
+    return keys;
 }
 
-static void HashAdd(SEXP obj, SEXP ht)
+static void HashAdd(SEXP obj, R_ptrhash_t *ht)
 {
-    R_size_t pos = PTRHASH(obj) % HASH_TABLE_SIZE(ht);
-    int count = HASH_TABLE_COUNT(ht) + 1;
-    SEXP val = ScalarInteger(count);
-    SEXP cell = CONS(val, HASH_BUCKET(ht, pos));
-
-    SET_HASH_TABLE_COUNT(ht, count);
-    SET_HASH_BUCKET(ht, pos, cell);
-    SET_TAG(cell, obj);
-    SET_HASH_TABLE_KEYS_LIST(ht, CONS(obj, HASH_TABLE_KEYS_LIST(ht)));
-    SET_TAG(HASH_TABLE_KEYS_LIST(ht), val);
+    R_PtrHashLookup(ht, obj, TRUE);
 }
 
-static int HashGet(SEXP item, SEXP ht)
+static int HashGet(SEXP item, R_ptrhash_t *ht)
 {
-    R_size_t pos = PTRHASH(item) % HASH_TABLE_SIZE(ht);
-    SEXP cell;
-    for (cell = HASH_BUCKET(ht, pos); cell != R_NilValue; cell = CDR(cell))
-	if (item == TAG(cell))
-	    return INTEGER(CAR(cell))[0];
-    return 0;
+    int *val = R_PtrHashLookup(ht, item, FALSE);
+    return val ? *val : 0;
 }
 
-static int NewLookup (SEXP item, SEXP ht)
+static int NewLookup (SEXP item, R_ptrhash_t *ht)
 {
     int count = NewSaveSpecialHook(item);
 
@@ -898,7 +863,7 @@ static int NewLookup (SEXP item, SEXP ht)
  *  method used here somehow shoots functional programming in the
  *  head --- sorry.  */
 
-static void NewMakeLists (SEXP obj, SEXP sym_list, SEXP env_list)
+static void NewMakeLists (SEXP obj, R_ptrhash_t *sym_list, R_ptrhash_t *env_list)
 {
     int count, length;
 
@@ -976,7 +941,7 @@ static void OutCHARSXP (FILE *fp, SEXP s, OutputRoutines *m, SaveLoadData *d)
     m->OutString(fp, CHAR(s), d);
 }
 
-static void NewWriteVec (SEXP s, SEXP sym_list, SEXP env_list, FILE *fp, OutputRoutines *m, SaveLoadData *d)
+static void NewWriteVec (SEXP s, R_ptrhash_t *sym_list, R_ptrhash_t *env_list, FILE *fp, OutputRoutines *m, SaveLoadData *d)
 {
     int count;
 
@@ -1024,7 +989,7 @@ static void NewWriteVec (SEXP s, SEXP sym_list, SEXP env_list, FILE *fp, OutputR
     }
 }
 
-static void NewWriteItem (SEXP s, SEXP sym_list, SEXP env_list, FILE *fp, OutputRoutines *m, SaveLoadData *d)
+static void NewWriteItem (SEXP s, R_ptrhash_t *sym_list, R_ptrhash_t *env_list, FILE *fp, OutputRoutines *m, SaveLoadData *d)
 {
     int i;
 
@@ -1104,19 +1069,33 @@ static void newdatasave_cleanup(void *data)
     cinfo->methods->OutTerm(fp, cinfo->data);
 }
 
+static void newdatasave_tables_cleanup(void *data)
+{
+    R_ptrhash_t *tables = (R_ptrhash_t *) data;
+    R_PtrHashFree(&tables[0]);
+    R_PtrHashFree(&tables[1]);
+}
+
 static void NewDataSave (SEXP s, FILE *fp, OutputRoutines *m, SaveLoadData *d)
 {
-    SEXP sym_table, env_table, iterator;
-    int sym_count, env_count;
-    RCNTXT cntxt;
+    SEXP sym_keys, env_keys;
+    R_ptrhash_t tables[2], *sym_table = &tables[0], *env_table = &tables[1];
+    int sym_count, env_count, i;
+    RCNTXT cntxt, tcntxt;
     OutputCtxtData cinfo;
     cinfo.fp = fp; cinfo.methods = m;  cinfo.data = d;
 
-    PROTECT(sym_table = MakeHashTable());
-    PROTECT(env_table = MakeHashTable());
+    /* set up a context which will free the tables if there is an error */
+    memset(tables, 0, sizeof(tables));
+    begincontext(&tcntxt, CTXT_CCODE, R_NilValue, R_BaseEnv, R_BaseEnv,
+		 R_NilValue, R_NilValue);
+    tcntxt.cend = &newdatasave_tables_cleanup;
+    tcntxt.cenddata = tables;
+    R_PtrHashInit(sym_table, HASHSIZE);
+    R_PtrHashInit(env_table, HASHSIZE);
     NewMakeLists(s, sym_table, env_table);
-    FixHashEntries(sym_table);
-    FixHashEntries(env_table);
+    PROTECT(sym_keys = FixHashEntries(sym_table));
+    PROTECT(env_keys = FixHashEntries(env_table));
 
     m->OutInit(fp, d);
     /* set up a context which will call OutTerm if there is an error */
@@ -1125,22 +1104,20 @@ static void NewDataSave (SEXP s, FILE *fp, OutputRoutines *m, SaveLoadData *d)
     cntxt.cend = &newdatasave_cleanup;
     cntxt.cenddata = &cinfo;
 
-    m->OutInteger(fp, sym_count = HASH_TABLE_COUNT(sym_table), d); m->OutSpace(fp, 1, d);
-    m->OutInteger(fp, env_count = HASH_TABLE_COUNT(env_table), d); m->OutNewline(fp, d);
-    for (iterator = HASH_TABLE_KEYS_LIST(sym_table);
-	 sym_count--;
-	 iterator = CDR(iterator)) {
-	R_assert(TYPEOF(CAR(iterator)) == SYMSXP);
-	m->OutString(fp, CHAR(PRINTNAME(CAR(iterator))), d);
+    m->OutInteger(fp, sym_count = LENGTH(sym_keys), d); m->OutSpace(fp, 1, d);
+    m->OutInteger(fp, env_count = LENGTH(env_keys), d); m->OutNewline(fp, d);
+    for (i = 0; i < sym_count; i++) {
+	SEXP sym = VECTOR_ELT(sym_keys, i);
+	R_assert(TYPEOF(sym) == SYMSXP);
+	m->OutString(fp, CHAR(PRINTNAME(sym)), d);
 	m->OutNewline(fp, d);
     }
-    for (iterator = HASH_TABLE_KEYS_LIST(env_table);
-	 env_count--;
-	 iterator = CDR(iterator)) {
-	R_assert(TYPEOF(CAR(iterator)) == ENVSXP);
-	NewWriteItem(ENCLOS(CAR(iterator)), sym_table, env_table, fp, m, d);
-	NewWriteItem(FRAME(CAR(iterator)), sym_table, env_table, fp, m, d);
-	NewWriteItem(TAG(CAR(iterator)), sym_table, env_table, fp, m, d);
+    for (i = 0; i < env_count; i++) {
+	SEXP env = VECTOR_ELT(env_keys, i);
+	R_assert(TYPEOF(env) == ENVSXP);
+	NewWriteItem(ENCLOS(env), sym_table, env_table, fp, m, d);
+	NewWriteItem(FRAME(env), sym_table, env_table, fp, m, d);
+	NewWriteItem(TAG(env), sym_table, env_table, fp, m, d);
     }
     NewWriteItem(s, sym_table, env_table, fp, m, d);
 
@@ -1149,6 +1126,8 @@ static void NewDataSave (SEXP s, FILE *fp, OutputRoutines *m, SaveLoadData *d)
     endcontext(&cntxt);
 
     m->OutTerm(fp, d);
+    endcontext(&tcntxt);
+    newdatasave_tables_cleanup(tables);
     UNPROTECT(2);
 }
 
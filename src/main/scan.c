@@ -45,6 +45,8 @@
 
 /* The size of vector initially allocated by scan */
 #define SCAN_BLOCKSIZE		1000
+/* The size of the blocks read ahead from files */
+#define SCAN_CHUNKSIZE		65536
 /* The size of the console buffer */
 /* NB:  in Windows this also needs to be set in gnuwin32/getline/getline.c */
 #define CONSOLE_PROMPT_SIZE	256
@@ -78,8 +80,19 @@ typedef struct {
     Rboolean embedWarn;
     Rboolean skipNul;
     char convbuf[100];
+    /* reading ahead from files, see scan_fill_block */
+    Rboolean blockread;
+    Rboolean runs;
+    char *block;
+    size_t bpos, blen;
+    Rboolean bfile; /* the block came from the file, not from pushback */
+    /* bytes that end a run of field bytes copied at once, see scan_run */
+    char runstop[2][256];
 } LocalData;
 
+/* blocks and bytes read ahead, and bytes copied in runs, for the tracer */
+unsigned long scan_blocks, scan_block_bytes, scan_run_bytes;
+
 static SEXP insertString(char *str, LocalData *l)
 {
     cetype_t enc = CE_NATIVE;
@@ -209,15 +222,82 @@ strtoraw (const char *nptr, char **endptr)
     return (Rbyte) val;
 }
 
-static R_INLINE int scanchar_raw(LocalData *d)
+/* Files and compressed files are read in blocks instead of by
+   Rconn_fgetc, see Rconn_canReadBlocks. */
+static Rboolean scan_fill_block(LocalData *d)
+{
+    d->bpos = 0;
+    d->bfile = d->con->nPushBack <= 0;
+    d->blen = Rconn_readBlock(d->con, d->block, SCAN_CHUNKSIZE);
+    if (d->blen == 0) return FALSE;
+    scan_blocks++;
+    scan_block_bytes += d->blen;
+    return TRUE;
+}
+
+static R_INLINE int scanchar_block(LocalData *d)
+{
+    int c;
+
+    if (d->bpos == d->blen && !scan_fill_block(d)) return R_EOF;
+    c = (unsigned char) d->block[d->bpos++];
+    if (c == '\r') {
+	/* map CR or CRLF to LF, as Rconn_fgetc does */
+	if ((d->bpos < d->blen || scan_fill_block(d)) &&
+	    d->block[d->bpos] == '\n')
+	    d->bpos++;
+	c = '\n';
+    }
+    return c;
+}
+
+/* Returns the unread part of the block to the connection, by seeking
+   back in the file or in front of anything pushed back before, and
+   stops reading in blocks. */
+static void scan_unread_block(LocalData *d)
+{
+    Rconnection con = d->con;
+    char *p;
+
+    if (!d->block) return;
+    if (d->wasopen && d->bpos < d->blen && d->bfile)
+	Rconn_unreadBlock(con, d->blen - d->bpos);
+    else if (d->wasopen && d->bpos < d->blen) {
+	if (con->nPushBack > 0 && con->posPushBack > 0) {
+	    /* keep only the unread part of a partly read line */
+	    p = con->PushBack[con->nPushBack-1];
+	    memmove(p, p + con->posPushBack, strlen(p + con->posPushBack) + 1);
+	    con->posPushBack = 0;
+	}
+	/* pushed back lines are strings, so push back the pieces between
+	   nuls, last first */
+	d->block[d->blen] = '\0';
+	for (p = d->block + d->blen; p > d->block + d->bpos; ) {
+	    char *q = p;
+	    while (q > d->block + d->bpos && q[-1] != '\0') q--;
+	    if (q < p) con_pushback(con, FALSE, q);
+	    p = (q > d->block + d->bpos) ? q - 1 : q;
+	}
+    }
+    free(d->block);
+    d->block = NULL;
+    d->blockread = d->runs = FALSE;
+}
+
+static R_INLINE int scan_getc(LocalData *d)
 {
-    int c = (d->ttyflag) ? ConsoleGetcharWithPushBack(d->con) :
+    if (d->blockread) return scanchar_block(d);
+    return (d->ttyflag) ? ConsoleGetcharWithPushBack(d->con) :
 	Rconn_fgetc(d->con);
+}
+
+static R_INLINE int scanchar_raw(LocalData *d)
+{
+    int c = scan_getc(d);
     if(c == 0) {
 	if(d->skipNul) {
 	    do {
-		c = (d->ttyflag) ? ConsoleGetcharWithPushBack(d->con) :
-		    Rconn_fgetc(d->con);
+		c = scan_getc(d);
 	    } while(c == 0);
 	} else d->embedWarn = TRUE;
     }
@@ -303,16 +383,60 @@ static int scanchar(Rboolean inQuote, LocalData *d)
     return next;
 }
 
+/* The stop bytes of scan_run: [0] for character fields with a
+   separator and for quoted strings, [1] also for white space. */
+static void scan_init_runs(LocalData *d)
+{
+    char *stop = d->runstop[0];
+    const char *q;
+
+    memset(d->runstop, 0, sizeof(d->runstop));
+    stop['\0'] = stop['\n'] = stop['\r'] = stop['\\'] = 1;
+    if (d->sepchar) stop[d->sepchar] = 1;
+    if (d->comchar != NO_COMCHAR) stop[d->comchar] = 1;
+    for (q = d->quoteset; *q; q++) stop[(unsigned char) *q] = 1;
+    memcpy(d->runstop[1], stop, sizeof(d->runstop[1]));
+    stop = d->runstop[1];
+    stop[' '] = stop['\t'] = stop[0xa0] = 1; /* see Rspace */
+}
+
 /* utility to close connections after interrupts */
 static void scan_cleanup(void *data)
 {
     LocalData *ld = data;
+    scan_unread_block(ld);
     if(!ld->ttyflag && !ld->wasopen) ld->con->close(ld->con);
     if (ld->quoteset[0]) free(ld->quoteset);
 }
 
 #include "RBufferUtils.h"
 
+/* Copies the bytes of a field up to the next one in stop from the block
+   to the buffer, so the ordinary bytes of a field are found by a table
+   lookup each instead of going through scanchar.  The stop bytes are
+   everything scanchar or fillBuffer treat specially. */
+static R_INLINE void scan_run(const char *stop, int *m, int *nbuf,
+			      LocalData *d, R_StringBuffer *buffer)
+{
+    const unsigned char *p, *q, *end;
+    size_t len;
+
+    if (!d->runs || d->save) return;
+    p = q = (const unsigned char *) d->block + d->bpos;
+    end = (const unsigned char *) d->block + d->blen;
+    while (q < end && !stop[*q]) q++;
+    len = q - p;
+    if (len == 0) return;
+    if (*m + len >= *nbuf - 3) {
+	while (*m + len >= *nbuf - 3) *nbuf *= 2;
+	R_AllocStringBuffer(*nbuf, buffer);
+    }
+    memcpy(buffer->data + *m, p, len);
+    *m += (int) len;
+    d->bpos += len;
+    scan_run_bytes += len;
+}
+
 /*XX  Can we pass this routine an R_StringBuffer? appears so.
    But do we have to worry about continuation lines and whatever
    is currently in the buffer before we call this? In other words,
@@ -359,6 +483,7 @@ fillBuffer(SEXPTYPE type, int strip, int *bch, LocalData *d,
 		buffer->data[m++] = (char) c;
 		if(dbcslocale && btowc(c) == WEOF)
 		    buffer->data[m++] = (char) scanchar2(d);
+		scan_run(d->runstop[0], &m, &nbuf, d, buffer);
 	    }
 	    if (c == R_EOF)
 		warning(_("EOF within quoted string"));
@@ -374,6 +499,7 @@ fillBuffer(SEXPTYPE type, int strip, int *bch, LocalData *d,
 		buffer->data[m++] = (char) c;
 		if(dbcslocale && btowc(c) == WEOF)
 		    buffer->data[m++] = (char) scanchar2(d);
+		scan_run(d->runstop[1], &m, &nbuf, d, buffer);
 		c = scanchar(FALSE, d);
 	    } while (!Rspace(c) && c != R_EOF);
 	}
@@ -409,6 +535,7 @@ fillBuffer(SEXPTYPE type, int strip, int *bch, LocalData *d,
 			buffer->data[m++] = (char) c;
 			if(dbcslocale && btowc(c) == WEOF)
 			    buffer->data[m++] = (char) scanchar2(d);
+			scan_run(d->runstop[0], &m, &nbuf, d, buffer);
 		    }
 		    if (c == R_EOF)
 			warning(_("EOF within quoted string"));
@@ -440,6 +567,8 @@ fillBuffer(SEXPTYPE type, int strip, int *bch, LocalData *d,
 		    buffer->data[m++] = (char) c;
 		    if(dbcslocale && btowc(c) == WEOF)
 			buffer->data[m++] = (char) scanchar2(d);
+		    scan_run(d->runstop[type == STRSXP || type == NILSXP ? 0 : 1],
+			     &m, &nbuf, d, buffer);
 		}
 	    }
 	filled = c; /* last lead byte in a DBCS */
@@ -939,6 +1068,14 @@ SEXP attribute_hidden do_scan(SEXP call, SEXP op, SEXP args, SEXP rho)
 	    if(!data.con->canread)
 		error(_("cannot read from this connection"));
 	}
+	if (Rconn_canReadBlocks(data.con, data.wasopen)) {
+	    /* one more byte to terminate the rest for scan_unread_block */
+	    data.block = malloc(SCAN_CHUNKSIZE + 1);
+	    data.blockread = data.block != NULL;
+	    /* runs cannot tell lead bytes in a DBCS */
+	    data.runs = data.blockread && MB_CUR_MAX != 2;
+	    if (data.runs) scan_init_runs(&data);
+	}
 	for (i = 0; i < nskip; i++) /* MBCS-safe */
 	    while ((c = scanchar(FALSE, &data)) != '\n' && c != R_EOF);
     }
@@ -974,6 +1111,9 @@ SEXP attribute_hidden do_scan(SEXP call, SEXP op, SEXP args, SEXP rho)
     PROTECT(ans);
     endcontext(&cntxt);
 
+    /* return what was read ahead, then the character below */
+    scan_unread_block(&data);
+
     /* we might have a character that was unscanchar-ed.
        So pushback if possible */
     if (data.save && !data.ttyflag && data.wasopen) {
@@ -36,6 +36,27 @@
 #ifdef Win32
 #include <trioremap.h>
 #endif
+#include <sys/stat.h>		/* for unserializeFromFile */
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+#if defined(HAVE_MMAP) && !defined(Win32)
+# define FILE_VECTOR_MAPPING
+# include <sys/mman.h>		/* mapped .rds files */
+# include <R_ext/Rallocators.h>
+# if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#  define MAP_ANONYMOUS MAP_ANON
+# endif
+# ifndef MAP_ANONYMOUS
+#  undef FILE_VECTOR_MAPPING
+# endif
+#endif
 
 /* From time to time changes in R, such as the addition of a new SXP,
  * may require changes in the save file format.  Here are some
@@ -110,8 +131,9 @@
    CHARSXPs are now handled in a way that preserves both embedded null
    characters and NA_STRING values.
 
-   The XDR save format now only uses the in-memory xdr facility for
-   converting integers and doubles to a portable format.
+   The XDR format stores integers and IEEE doubles big-endian.  They
+   are converted by reversing the bytes of whole chunks on
+   little-endian hosts rather than through the xdr library.
 
    The output format packs the type flag and other flags into a single
    integer.  This produces more compact output for code; it has little
@@ -158,10 +180,10 @@
  * Forward Declarations
  */
 
-static void OutStringVec(R_outpstream_t stream, SEXP s, SEXP ref_table);
-static void WriteItem (SEXP s, SEXP ref_table, R_outpstream_t stream);
+static void OutStringVec(R_outpstream_t stream, SEXP s, R_ptrhash_t *ref_table);
+static void WriteItem (SEXP s, R_ptrhash_t *ref_table, R_outpstream_t stream);
 static SEXP ReadItem(SEXP ref_table, R_inpstream_t stream);
-static void WriteBC(SEXP s, SEXP ref_table, R_outpstream_t stream);
+static void WriteBC(SEXP s, R_ptrhash_t *ref_table, R_outpstream_t stream);
 static SEXP ReadBC(SEXP ref_table, R_inpstream_t stream);
 
 /*
@@ -201,6 +223,94 @@ static int Rsnprintf(char *buf, int size, const char *format, ...)
 }
 
 
+/*
+ * XDR Conversion
+ *
+ * XDR is big-endian, so on little-endian hosts converting n integers
+ * or doubles in either direction reverses the bytes of each element.
+ * This works in place (dst == src). With SSE2 four integers or two
+ * doubles are swapped per instruction sequence.
+ */
+
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
+
+#ifdef WORDS_BIGENDIAN
+static R_INLINE void XDRSwap32(void *dst, const void *src, R_xlen_t n)
+{
+    if (dst != src) memcpy(dst, src, 4 * n);
+}
+
+static R_INLINE void XDRSwap64(void *dst, const void *src, R_xlen_t n)
+{
+    if (dst != src) memcpy(dst, src, 8 * n);
+}
+#else
+static R_INLINE uint32_t bswap32(uint32_t x)
+{
+#ifdef __GNUC__
+    return __builtin_bswap32(x);
+#else
+    return (x << 24) | ((x & 0xff00) << 8) | ((x & 0xff0000) >> 8) | (x >> 24);
+#endif
+}
+
+static R_INLINE uint64_t bswap64(uint64_t x)
+{
+#ifdef __GNUC__
+    return __builtin_bswap64(x);
+#else
+    return ((uint64_t) bswap32((uint32_t) x) << 32) | bswap32((uint32_t) (x >> 32));
+#endif
+}
+
+static void XDRSwap32(void *dst, const void *src, R_xlen_t n)
+{
+    const char *s = src;
+    char *d = dst;
+    R_xlen_t i = 0;
+#ifdef __SSE2__
+    for (; i + 4 <= n; i += 4) {
+	__m128i x = _mm_loadu_si128((const __m128i *) (s + 4 * i));
+	x = _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8));
+	x = _mm_shufflelo_epi16(x, _MM_SHUFFLE(2, 3, 0, 1));
+	x = _mm_shufflehi_epi16(x, _MM_SHUFFLE(2, 3, 0, 1));
+	_mm_storeu_si128((__m128i *) (d + 4 * i), x);
+    }
+#endif
+    for (; i < n; i++) {
+	uint32_t x;
+	memcpy(&x, s + 4 * i, 4);
+	x = bswap32(x);
+	memcpy(d + 4 * i, &x, 4);
+    }
+}
+
+static void XDRSwap64(void *dst, const void *src, R_xlen_t n)
+{
+    const char *s = src;
+    char *d = dst;
+    R_xlen_t i = 0;
+#ifdef __SSE2__
+    for (; i + 2 <= n; i += 2) {
+	__m128i x = _mm_loadu_si128((const __m128i *) (s + 8 * i));
+	x = _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8));
+	x = _mm_shufflelo_epi16(x, _MM_SHUFFLE(0, 1, 2, 3));
+	x = _mm_shufflehi_epi16(x, _MM_SHUFFLE(0, 1, 2, 3));
+	_mm_storeu_si128((__m128i *) (d + 8 * i), x);
+    }
+#endif
+    for (; i < n; i++) {
+	uint64_t x;
+	memcpy(&x, s + 8 * i, 8);
+	x = bswap64(x);
+	memcpy(d + 8 * i, &x, 8);
+    }
+}
+#endif
+
+
 /*
  * Basic Output Routines
  */
@@ -218,10 +328,11 @@ static void OutInteger(R_outpstream_t stream, int i)
 	stream->OutBytes(stream, buf, (int)strlen(buf));
 	break;
     case R_pstream_binary_format:
+    case R_pstream_aligned_binary_format:
 	stream->OutBytes(stream, &i, sizeof(int));
 	break;
     case R_pstream_xdr_format:
-	R_XDREncodeInteger(i, buf);
+	XDRSwap32(buf, &i, 1);
 	stream->OutBytes(stream, buf, R_XDR_INTEGER_SIZE);
 	break;
     default:
@@ -265,10 +376,11 @@ static void OutReal(R_outpstream_t stream, double d)
 	stream->OutBytes(stream, buf, (int)strlen(buf));
 	break;
     case R_pstream_binary_format:
+    case R_pstream_aligned_binary_format:
 	stream->OutBytes(stream, &d, sizeof(double));
 	break;
     case R_pstream_xdr_format:
-	R_XDREncodeDouble(d, buf);
+	XDRSwap64(buf, &d, 1);
 	stream->OutBytes(stream, buf, R_XDR_DOUBLE_SIZE);
 	break;
     default:
@@ -292,6 +404,7 @@ static void OutByte(R_outpstream_t stream, Rbyte i)
 	stream->OutBytes(stream, buf, (int)strlen(buf));
 	break;
     case R_pstream_binary_format:
+    case R_pstream_aligned_binary_format:
     case R_pstream_xdr_format:
 	stream->OutBytes(stream, &i, 1);
 	break;
@@ -378,11 +491,13 @@ static int InInteger(R_inpstream_t stream)
 	    if(sscanf(buf, "%d", &i) != 1) error(_("read error"));
 	return i;
     case R_pstream_binary_format:
+    case R_pstream_aligned_binary_format:
 	stream->InBytes(stream, &i, sizeof(int));
 	return i;
     case R_pstream_xdr_format:
 	stream->InBytes(stream, buf, R_XDR_INTEGER_SIZE);
-	return R_XDRDecodeInteger(buf);
+	XDRSwap32(&i, buf, 1);
+	return i;
     default:
 	return NA_INTEGER;
     }
@@ -421,11 +536,13 @@ static double InReal(R_inpstream_t stream)
 		!= 1) error(_("read error"));
 	return d;
     case R_pstream_binary_format:
+    case R_pstream_aligned_binary_format:
 	stream->InBytes(stream, &d, sizeof(double));
 	return d;
     case R_pstream_xdr_format:
 	stream->InBytes(stream, buf, R_XDR_DOUBLE_SIZE);
-	return R_XDRDecodeDouble(buf);
+	XDRSwap64(&d, buf, 1);
+	return d;
     default:
 	return NA_REAL;
     }
@@ -522,8 +639,11 @@ static void InString(R_inpstream_t stream, char *buf, int length)
 /*
  * Format Header Reading and Writing
  *
- * The header starts with one of three characters, A for ascii, B for
- * binary, or X for xdr.
+ * The header starts with one of four characters, A for ascii, B for
+ * binary, X for xdr, or P for aligned binary.  Aligned binary is
+ * binary with the payload of large atomic vectors padded to a page
+ * boundary in the file, so a mapped reader can use it in place (see
+ * "Aligned Vector Payloads" below).
  */
 
 static void OutFormat(R_outpstream_t stream)
@@ -538,6 +658,8 @@ static void OutFormat(R_outpstream_t stream)
 	stream->OutBytes(stream, "A\n", 2); break;
     case R_pstream_binary_format: stream->OutBytes(stream, "B\n", 2); break;
     case R_pstream_xdr_format:    stream->OutBytes(stream, "X\n", 2); break;
+    case R_pstream_aligned_binary_format:
+	stream->OutBytes(stream, "P\n", 2); break;
     case R_pstream_any_format:
 	error(_("must specify ascii, binary, or xdr format"));
     default: error(_("unknown output format"));
@@ -553,6 +675,7 @@ static void InFormat(R_inpstream_t stream)
     case 'A': type = R_pstream_ascii_format; break;
     case 'B': type = R_pstream_binary_format; break;
     case 'X': type = R_pstream_xdr_format; break;
+    case 'P': type = R_pstream_aligned_binary_format; break;
     case '\n':
 	/* GROSS HACK: ASCII unserialize may leave a trailing newline
 	   in the stream.  If the stream contains a second
@@ -585,53 +708,162 @@ static void InFormat(R_inpstream_t stream)
  *
  * Hashing functions for hashing reference objects during writing.
  * Objects are entered, and the order in which they are encountered is
- * recorded.  GashGet returns this number, a positive integer, if the
- * object was seen before, and zero if not.  A fixed hash table size
- * is used; this is not ideal but seems adequate for now.  The hash
- * table representation consists of a (R_NilValue . vector) pair.  The
- * hash buckets are in the vector.  This indirect representation
- * should allow resizing the table at some point.
+ * recorded.  HashGet returns this number, a positive integer, if the
+ * object was seen before, and zero if not.  The table is open
+ * addressing with linear probing on a power of two number of slots,
+ * kept at most half full, in memory outside the R heap.  The keys
+ * are also stored in a VECSXP that is preserved while the table is
+ * in use: persistence and class hooks run R code while an object is
+ * written, and a key that became garbage and was collected could
+ * otherwise have its address reused by a new object, which would then
+ * be written as a reference to the old one.  The vector is allocated
+ * on the first entry and doubled as needed, so most entries allocate
+ * nothing.  The tables are also used by ScanForCircles and for
+ * version 1 workspaces in saveload.c.
  */
 
-#define HASHSIZE 1099
+/* lookups, slots probed and lookups whose first slot held another
+   key, for the tracer */
+unsigned long ptrhash_lookups, ptrhash_probes, ptrhash_collisions;
 
-#define PTRHASH(obj) (((R_size_t) (obj)) >> 2)
+#define PTRHASH_MULTIPLIER 0x9E3779B97F4A7C15ULL
 
-#define HASH_TABLE_COUNT(ht) TRUELENGTH(CDR(ht))
-#define SET_HASH_TABLE_COUNT(ht, val) SET_TRUELENGTH(CDR(ht), val)
+#define PTRHASH(ht, obj) \
+    ((R_size_t) (((uint64_t) (uintptr_t) (obj) * PTRHASH_MULTIPLIER) >> \
+		 (ht)->shift))
 
-#define HASH_TABLE_SIZE(ht) LENGTH(CDR(ht))
+static void PtrHashAlloc(R_ptrhash_t *ht, R_size_t size)
+{
+    R_ptrhash_entry_t *tab;
+    R_size_t n = 2;
+    int bits = 1;
 
-#define HASH_BUCKET(ht, pos) VECTOR_ELT(CDR(ht), pos)
-#define SET_HASH_BUCKET(ht, pos, val) SET_VECTOR_ELT(CDR(ht), pos, val)
+    while (n < size) {
+	n <<= 1;
+	bits++;
+    }
+    tab = calloc(n, sizeof(R_ptrhash_entry_t));
+    if (tab == NULL)
+	error(_("cannot allocate reference hash table"));
+    ht->tab = tab;
+    ht->size = n;
+    ht->shift = 64 - bits;
+}
 
-static SEXP MakeHashTable(void)
+attribute_hidden void R_PtrHashInit(R_ptrhash_t *ht, R_size_t size)
 {
-    SEXP val = CONS(R_NilValue, allocVector(VECSXP, HASHSIZE));
-    SET_HASH_TABLE_COUNT(val, 0);
-    return val;
+    ht->tab = NULL;
+    ht->count = 0;
+    ht->keys = NULL;
+    PtrHashAlloc(ht, size);
+}
+
+/* may be called on a zeroed table and more than once */
+attribute_hidden void R_PtrHashFree(R_ptrhash_t *ht)
+{
+    free(ht->tab);
+    ht->tab = NULL;
+    ht->size = ht->count = 0;
+    if (ht->keys != NULL) {
+	R_ReleaseObject(ht->keys);
+	ht->keys = NULL;
+    }
+}
+
+/* empty the table for reuse, keeping its slots and key vector */
+static void PtrHashClear(R_ptrhash_t *ht)
+{
+    memset(ht->tab, 0, ht->size * sizeof(R_ptrhash_entry_t));
+    ht->count = 0;
+}
+
+#define PTRHASH_MINKEYS 32
+
+/* store key as the count-th entry of the key vector; count may have
+   skipped entries when keys were entered again */
+static void PtrHashKeep(R_ptrhash_t *ht, SEXP key)
+{
+    R_xlen_t i, n = ht->keys == NULL ? 0 : XLENGTH(ht->keys);
+
+    if ((R_xlen_t) ht->count >= n) {
+	SEXP keys;
+	R_xlen_t size = n > 0 ? 2 * n : PTRHASH_MINKEYS;
+	while (size <= (R_xlen_t) ht->count)
+	    size *= 2;
+	PROTECT(key);
+	keys = allocVector(VECSXP, size);
+	for (i = 0; i < n; i++)
+	    SET_VECTOR_ELT(keys, i, VECTOR_ELT(ht->keys, i));
+	R_PreserveObject(keys);
+	if (ht->keys != NULL)
+	    R_ReleaseObject(ht->keys);
+	ht->keys = keys;
+	UNPROTECT(1);
+    }
+    SET_VECTOR_ELT(ht->keys, ht->count, key);
 }
 
-static void HashAdd(SEXP obj, SEXP ht)
+static void PtrHashGrow(R_ptrhash_t *ht)
 {
-    R_size_t pos = PTRHASH(obj) % HASH_TABLE_SIZE(ht);
-    int count = HASH_TABLE_COUNT(ht) + 1;
-    SEXP val = ScalarInteger(count);
-    SEXP cell = CONS(val, HASH_BUCKET(ht, pos));
+    R_ptrhash_entry_t *old = ht->tab;
+    R_size_t i, j, size = ht->size;
 
-    SET_HASH_TABLE_COUNT(ht, count);
-    SET_HASH_BUCKET(ht, pos, cell);
-    SET_TAG(cell, obj);
+    PtrHashAlloc(ht, 2 * size); /* leaves ht as it was on failure */
+    for (i = 0; i < size; i++)
+	if (old[i].key != NULL) {
+	    for (j = PTRHASH(ht, old[i].key); ht->tab[j].key != NULL;
+		 j = (j + 1) & (ht->size - 1))
+		;
+	    ht->tab[j] = old[i];
+	}
+    free(old);
 }
 
-static int HashGet(SEXP item, SEXP ht)
+/* Returns the value of key in the table, or NULL if there is none.
+   With add, key gets the next number even if it is in the table
+   already, as a persistent object is entered each time it is written
+   and the reader numbers its references the same way. */
+attribute_hidden int *R_PtrHashLookup(R_ptrhash_t *ht, SEXP key, Rboolean add)
 {
-    R_size_t pos = PTRHASH(item) % HASH_TABLE_SIZE(ht);
-    SEXP cell;
-    for (cell = HASH_BUCKET(ht, pos); cell != R_NilValue; cell = CDR(cell))
-	if (item == TAG(cell))
-	    return INTEGER(CAR(cell))[0];
-    return 0;
+    R_size_t mask = ht->size - 1, i = PTRHASH(ht, key);
+
+    ptrhash_lookups++;
+    if (ht->tab[i].key != key && ht->tab[i].key != NULL)
+	ptrhash_collisions++;
+    for (;; i = (i + 1) & mask) {
+	ptrhash_probes++;
+	if (ht->tab[i].key == key) {
+	    if (add) ht->tab[i].val = (int) ++ht->count;
+	    return &ht->tab[i].val;
+	}
+	if (ht->tab[i].key == NULL) break;
+    }
+    if (! add) return NULL;
+
+    PtrHashKeep(ht, key);
+    if (2 * (ht->count + 1) > ht->size) {
+	PtrHashGrow(ht);
+	mask = ht->size - 1;
+	for (i = PTRHASH(ht, key); ht->tab[i].key != NULL; i = (i + 1) & mask)
+	    ;
+    }
+    ht->tab[i].key = key;
+    ht->tab[i].val = (int) ++ht->count;
+    return &ht->tab[i].val;
+}
+
+#define HASHSIZE 512
+#define CIRCLE_HASHSIZE 64
+
+static void HashAdd(SEXP obj, R_ptrhash_t *ht)
+{
+    R_PtrHashLookup(ht, obj, TRUE);
+}
+
+static int HashGet(SEXP item, R_ptrhash_t *ht)
+{
+    int *val = R_PtrHashLookup(ht, item, FALSE);
+    return val ? *val : 0;
 }
 
 
@@ -822,7 +1054,7 @@ static void WriteLENGTH(R_outpstream_t stream, SEXP s)
 #endif
 }
 
-static void OutStringVec(R_outpstream_t stream, SEXP s, SEXP ref_table)
+static void OutStringVec(R_outpstream_t stream, SEXP s, R_ptrhash_t *ref_table)
 {
     R_assert(TYPEOF(s) == STRSXP);
 
@@ -839,35 +1071,65 @@ static void OutStringVec(R_outpstream_t stream, SEXP s, SEXP ref_table)
 	WriteItem(STRING_ELT(s, i), ref_table, stream);
 }
 
-#include <rpc/types.h>
-#include <rpc/xdr.h>
-
 #define CHUNK_SIZE 8096
 
 #define min2(a, b) ((a) < (b)) ? (a) : (b)
 
+/* XDR output is converted into a buffer on the stack of OutXDRVec,
+   which is kept out of line so that the buffer does not become part
+   of the frames of the recursive WriteItem. Input is read into the
+   vector and converted in place. */
+#define XDR_CHUNK_BYTES 16384
+
+#ifdef __GNUC__
+# define attribute_noinline __attribute__((noinline))
+#else
+# define attribute_noinline
+#endif
+
+static attribute_noinline void
+OutXDRVec(R_outpstream_t stream, const void *data, R_xlen_t n, int size)
+{
+    double buf[XDR_CHUNK_BYTES / sizeof(double)];
+    R_xlen_t chunk = XDR_CHUNK_BYTES / size, done, this;
+    const char *p = data;
+
+    for (done = 0; done < n; done += this) {
+	this = min2(chunk, n - done);
+	if (size == R_XDR_INTEGER_SIZE)
+	    XDRSwap32(buf, p + size * done, this);
+	else
+	    XDRSwap64(buf, p + size * done, this);
+	stream->OutBytes(stream, buf, (int)(size * this));
+    }
+}
+
+static void
+InXDRVec(R_inpstream_t stream, void *data, R_xlen_t n, int size)
+{
+    R_xlen_t done, this;
+    char *p = data;
+
+    for (done = 0; done < n; done += this) {
+	this = min2(CHUNK_SIZE, n - done);
+	stream->InBytes(stream, p + size * done, (int)(size * this));
+	if (size == R_XDR_INTEGER_SIZE)
+	    XDRSwap32(p + size * done, p + size * done, this);
+	else
+	    XDRSwap64(p + size * done, p + size * done, this);
+    }
+}
+
 
 static R_INLINE void
 OutIntegerVec(R_outpstream_t stream, SEXP s, R_xlen_t length)
 {
     switch (stream->type) {
     case R_pstream_xdr_format:
-    {
-	static char buf[CHUNK_SIZE * sizeof(int)];
-	R_xlen_t done, this;
-	XDR xdrs;
-	for (done = 0; done < length; done += this) {
-	    this = min2(CHUNK_SIZE, length - done);
-	    xdrmem_create(&xdrs, buf, (int)(this * sizeof(int)), XDR_ENCODE);
-	    for(int cnt = 0; cnt < this; cnt++)
-		if(!xdr_int(&xdrs, INTEGER(s) + done + cnt))
-		    error(_("XDR write failed"));
-	    xdr_destroy(&xdrs);
-	    stream->OutBytes(stream, buf, (int)(sizeof(int) * this));
-	}
+	OutXDRVec(stream, INTEGER(s), length, R_XDR_INTEGER_SIZE);
 	break;
-    }
     case R_pstream_binary_format:
+    case R_pstream_aligned_binary_format:
     {
 	/* write in chunks to avoid overflowing ints */
 	R_xlen_t done, this;
@@ -889,22 +1151,10 @@ OutRealVec(R_outpstream_t stream, SEXP s, R_xlen_t length)
 {
     switch (stream->type) {
     case R_pstream_xdr_format:
-    {
-	static char buf[CHUNK_SIZE * sizeof(double)];
-	R_xlen_t done, this;
-	XDR xdrs;
-	for (done = 0; done < length; done += this) {
-	    this = min2(CHUNK_SIZE, length - done);
-	    xdrmem_create(&xdrs, buf, (int)(this * sizeof(double)), XDR_ENCODE);
-	    for(int cnt = 0; cnt < this; cnt++)
-		if(!xdr_double(&xdrs, REAL(s) + done + cnt))
-		    error(_("XDR write failed"));
-	    xdr_destroy(&xdrs);
-	    stream->OutBytes(stream, buf, (int)(sizeof(double) * this));
-	}
+	OutXDRVec(stream, REAL(s), length, R_XDR_DOUBLE_SIZE);
 	break;
-    }
     case R_pstream_binary_format:
+    case R_pstream_aligned_binary_format:
     {
 	R_xlen_t done, this;
 	for (done = 0; done < length; done += this) {
@@ -925,25 +1175,10 @@ OutComplexVec(R_outpstream_t stream, SEXP s, R_xlen_t length)
 {
     switch (stream->type) {
     case R_pstream_xdr_format:
-    {
-	static char buf[CHUNK_SIZE * sizeof(Rcomplex)];
-	R_xlen_t done, this;
-	XDR xdrs;
-	Rcomplex *c = COMPLEX(s);
-	for (done = 0; done < length; done += this) {
-	    this = min2(CHUNK_SIZE, length - done);
-	    xdrmem_create(&xdrs, buf, (int)(this * sizeof(Rcomplex)), XDR_ENCODE);
-	    for(int cnt = 0; cnt < this; cnt++) {
-		if(!xdr_double(&xdrs, &(c[done+cnt].r)) ||
-		   !xdr_double(&xdrs, &(c[done+cnt].i)))
-		    error(_("XDR write failed"));
-	    }
-	    stream->OutBytes(stream, buf, (int)(sizeof(Rcomplex) * this));
-	    xdr_destroy(&xdrs);
-	}
+	OutXDRVec(stream, COMPLEX(s), 2 * length, R_XDR_DOUBLE_SIZE);
 	break;
-    }
     case R_pstream_binary_format:
+    case R_pstream_aligned_binary_format:
     {
 	R_xlen_t done, this;
 	for (done = 0; done < length; done += this) {
@@ -959,7 +1194,46 @@ OutComplexVec(R_outpstream_t stream, SEXP s, R_xlen_t length)
     }
 }
 
-static void WriteItem (SEXP s, SEXP ref_table, R_outpstream_t stream)
+
+/*
+ * Aligned Vector Payloads
+ *
+ * In the aligned binary format the length of a logical, integer,
+ * double, complex or raw vector with at least ALIGNED_VECTOR_BYTES of
+ * data is followed by an integer count of zero bytes and those bytes,
+ * which place the data on an ALIGNED_VECTOR_BOUNDARY (page) offset in
+ * the file.  The count is in the stream, so reading does not depend on
+ * the offset, and a writer that cannot tell the offset writes zero.
+ * unserializeFromFile maps such a file and allocates the large vectors
+ * with a custom allocator over a private mapping of their data, so the
+ * pages are read on first use and copied only when written.
+ */
+
+#define ALIGNED_VECTOR_BYTES (64 * 1024)
+#define ALIGNED_VECTOR_BOUNDARY 4096
+
+static void OutBytesCounted(R_outpstream_t stream, void *buf, int length);
+static size_t CountedBytes(R_outpstream_t stream);
+
+static void OutPadding(R_outpstream_t stream, double bytes)
+{
+    static char zeros[ALIGNED_VECTOR_BOUNDARY];
+    int pad = 0;
+
+    if (stream->type != R_pstream_aligned_binary_format ||
+	bytes < ALIGNED_VECTOR_BYTES)
+	return;
+    if (stream->OutBytes == OutBytesCounted) {
+	size_t pos = CountedBytes(stream) + sizeof(int);
+	pad = (int) ((ALIGNED_VECTOR_BOUNDARY - pos % ALIGNED_VECTOR_BOUNDARY)
+		     % ALIGNED_VECTOR_BOUNDARY);
+    }
+    OutInteger(stream, pad);
+    if (pad > 0)
+	stream->OutBytes(stream, zeros, pad);
+}
+
+static void WriteItem (SEXP s, R_ptrhash_t *ref_table, R_outpstream_t stream)
 {
     int i;
     SEXP t;
@@ -1085,16 +1359,19 @@ static void WriteItem (SEXP s, SEXP ref_table, R_outpstream_t stream)
 	case INTSXP:
 	    len = XLENGTH(s);
 	    WriteLENGTH(stream, s);
+	    OutPadding(stream, (double) len * sizeof(int));
 	    OutIntegerVec(stream, s, len);
 	    break;
 	case REALSXP:
 	    len = XLENGTH(s);
 	    WriteLENGTH(stream, s);
+	    OutPadding(stream, (double) len * sizeof(double));
 	    OutRealVec(stream, s, len);
 	    break;
 	case CPLXSXP:
 	    len = XLENGTH(s);
 	    WriteLENGTH(stream, s);
+	    OutPadding(stream, (double) len * sizeof(Rcomplex));
 	    OutComplexVec(stream, s, len);
 	    break;
 	case STRSXP:
@@ -1116,9 +1393,11 @@ static void WriteItem (SEXP s, SEXP ref_table, R_outpstream_t stream)
 	case RAWSXP:
 	    len = XLENGTH(s);
 	    WriteLENGTH(stream, s);
+	    OutPadding(stream, (double) len);
 	    switch (stream->type) {
 	    case R_pstream_xdr_format:
 	    case R_pstream_binary_format:
+	    case R_pstream_aligned_binary_format:
 	    {
 		R_xlen_t done, this;
 		for (done = 0; done < len; done += this) {
@@ -1142,43 +1421,33 @@ static void WriteItem (SEXP s, SEXP ref_table, R_outpstream_t stream)
     }
 }
 
-static SEXP MakeCircleHashTable(void)
+/* The cells seen a second time are added to the list in CAR(reps);
+   their value in the table is negated so they are added only once. */
+static Rboolean AddCircleHash(SEXP item, R_ptrhash_t *ct, SEXP reps)
 {
-    return CONS(R_NilValue, allocVector(VECSXP, HASHSIZE));
-}
-
-static Rboolean AddCircleHash(SEXP item, SEXP ct)
-{
-    SEXP table, bucket, list;
+    int *val = R_PtrHashLookup(ct, item, FALSE);
 
-    table = CDR(ct);
-    R_size_t pos = PTRHASH(item) % LENGTH(table);
-    bucket = VECTOR_ELT(table, pos);
-    for (list = bucket; list != R_NilValue; list = CDR(list))
-	if (TAG(list) == item) {
-	    if (CAR(list) == R_NilValue) {
-		/* this is the second time; enter in list and mark */
-		SETCAR(list, R_UnboundValue); /* anything different will do */
-		SETCAR(ct, CONS(item, CAR(ct)));
-	    }
-	    return TRUE;
-	}
-
-    /* If we get here then this is a new item; enter in the table */
-    bucket = CONS(R_NilValue, bucket);
-    SET_TAG(bucket, item);
-    SET_VECTOR_ELT(table, pos, bucket);
-    return FALSE;
+    if (val == NULL) {
+	/* a new item; enter in the table */
+	R_PtrHashLookup(ct, item, TRUE);
+	return FALSE;
+    }
+    if (*val > 0) {
+	/* this is the second time; enter in list and mark */
+	*val = -*val;
+	SETCAR(reps, CONS(item, CAR(reps)));
+    }
+    return TRUE;
 }
 
-static void ScanForCircles1(SEXP s, SEXP ct)
+static void ScanForCircles1(SEXP s, R_ptrhash_t *ct, SEXP reps)
 {
     switch (TYPEOF(s)) {
     case LANGSXP:
     case LISTSXP:
-	if (! AddCircleHash(s, ct)) {
-	    ScanForCircles1(CAR(s), ct);
-	    ScanForCircles1(CDR(s), ct);
+	if (! AddCircleHash(s, ct, reps)) {
+	    ScanForCircles1(CAR(s), ct, reps);
+	    ScanForCircles1(CDR(s), ct, reps);
 	}
 	break;
     case BCODESXP:
@@ -1187,20 +1456,27 @@ static void ScanForCircles1(SEXP s, SEXP ct)
 	    SEXP consts = BCODE_CONSTS(s);
 	    n = LENGTH(consts);
 	    for (i = 0; i < n; i++)
-		ScanForCircles1(VECTOR_ELT(consts, i), ct);
+		ScanForCircles1(VECTOR_ELT(consts, i), ct, reps);
 	}
 	break;
     default: break;
     }
 }
 
-static SEXP ScanForCircles(SEXP s)
+/* ct is the circle table of R_Serialize, set up on first use and
+   emptied for each byte code object */
+static SEXP ScanForCircles(SEXP s, R_ptrhash_t *ct)
 {
-    SEXP ct;
-    PROTECT(ct = MakeCircleHashTable());
-    ScanForCircles1(s, ct);
+    SEXP reps;
+
+    PROTECT(reps = CONS(R_NilValue, R_NilValue));
+    if (ct->tab == NULL)
+	R_PtrHashInit(ct, CIRCLE_HASHSIZE);
+    else
+	PtrHashClear(ct);
+    ScanForCircles1(s, ct, reps);
     UNPROTECT(1);
-    return CAR(ct);
+    return CAR(reps);
 }
 
 static SEXP findrep(SEXP x, SEXP reps)
@@ -1211,7 +1487,7 @@ static SEXP findrep(SEXP x, SEXP reps)
     return R_NilValue;
 }
 
-static void WriteBCLang(SEXP s, SEXP ref_table, SEXP reps,
+static void WriteBCLang(SEXP s, R_ptrhash_t *ref_table, SEXP reps,
 			R_outpstream_t stream)
 {
     int type = TYPEOF(s);
@@ -1258,7 +1534,8 @@ static void WriteBCLang(SEXP s, SEXP ref_table, SEXP reps,
     }
 }
 
-static void WriteBC1(SEXP s, SEXP ref_table, SEXP reps, R_outpstream_t stream)
+static void WriteBC1(SEXP s, R_ptrhash_t *ref_table, SEXP reps,
+		     R_outpstream_t stream)
 {
     int i, n;
     SEXP code, consts;
@@ -1287,9 +1564,11 @@ static void WriteBC1(SEXP s, SEXP ref_table, SEXP reps, R_outpstream_t stream)
     UNPROTECT(1);
 }
 
-static void WriteBC(SEXP s, SEXP ref_table, R_outpstream_t stream)
+/* ref_table is the first of the two tables of R_Serialize, the
+   second one is used by ScanForCircles */
+static void WriteBC(SEXP s, R_ptrhash_t *ref_table, R_outpstream_t stream)
 {
-    SEXP reps = ScanForCircles(s);
+    SEXP reps = ScanForCircles(s, &ref_table[1]);
     PROTECT(reps = CONS(R_NilValue, reps));
     OutInteger(stream, length(reps));
     SETCAR(reps, allocVector(INTSXP, 1));
@@ -1298,9 +1577,17 @@ static void WriteBC(SEXP s, SEXP ref_table, R_outpstream_t stream)
     UNPROTECT(1);
 }
 
+static void serialize_tables_cleanup(void *data)
+{
+    R_ptrhash_t *tables = (R_ptrhash_t *) data;
+    R_PtrHashFree(&tables[0]);
+    R_PtrHashFree(&tables[1]);
+}
+
 void R_Serialize(SEXP s, R_outpstream_t stream)
 {
-    SEXP ref_table;
+    R_ptrhash_t tables[2]; /* references, circles in byte code */
+    RCNTXT cntxt;
     int version = stream->version;
 
     OutFormat(stream);
@@ -1314,9 +1601,16 @@ void R_Serialize(SEXP s, R_outpstream_t stream)
     default: error(_("version %d not supported"), version);
     }
 
-    PROTECT(ref_table = MakeHashTable());
-    WriteItem(s, ref_table, stream);
-    UNPROTECT(1);
+    /* free the tables if writing fails */
+    memset(tables, 0, sizeof(tables));
+    begincontext(&cntxt, CTXT_CCODE, R_NilValue, R_BaseEnv, R_BaseEnv,
+		 R_NilValue, R_NilValue);
+    cntxt.cend = &serialize_tables_cleanup;
+    cntxt.cenddata = tables;
+    R_PtrHashInit(&tables[0], HASHSIZE);
+    WriteItem(s, &tables[0], stream);
+    endcontext(&cntxt);
+    serialize_tables_cleanup(tables);
 }
 
 
@@ -1383,28 +1677,15 @@ static SEXP InStringVec(R_inpstream_t stream, SEXP ref_table)
     return s;
 }
 
-/* use static buffer to reuse storage */
 static R_INLINE void
 InIntegerVec(R_inpstream_t stream, SEXP obj, R_xlen_t length)
 {
     switch (stream->type) {
     case R_pstream_xdr_format:
-    {
-	static char buf[CHUNK_SIZE * sizeof(int)];
-	R_xlen_t done, this;
-	XDR xdrs;
-	for (done = 0; done < length; done += this) {
-	    this = min2(CHUNK_SIZE, length - done);
-	    stream->InBytes(stream, buf, (int)(sizeof(int) * this));
-	    xdrmem_create(&xdrs, buf, (int)(this * sizeof(int)), XDR_DECODE);
-	    for(int cnt = 0; cnt < this; cnt++)
-		if(!xdr_int(&xdrs, INTEGER(obj) + done + cnt))
-		    error(_("XDR read failed"));
-	    xdr_destroy(&xdrs);
-	}
+	InXDRVec(stream, INTEGER(obj), length, R_XDR_INTEGER_SIZE);
 	break;
-    }
     case R_pstream_binary_format:
+    case R_pstream_aligned_binary_format:
     {
 	R_xlen_t done, this;
 	for (done = 0; done < length; done += this) {
@@ -1425,22 +1706,10 @@ InRealVec(R_inpstream_t stream, SEXP obj, R_xlen_t length)
 {
     switch (stream->type) {
     case R_pstream_xdr_format:
-    {
-	static char buf[CHUNK_SIZE * sizeof(double)];
-	R_xlen_t done, this;
-	XDR xdrs;
-	for (done = 0; done < length; done += this) {
-	    this = min2(CHUNK_SIZE, length - done);
-	    stream->InBytes(stream, buf, (int)(sizeof(double) * this));
-	    xdrmem_create(&xdrs, buf, (int)(this * sizeof(double)), XDR_DECODE);
-	    for(R_xlen_t cnt = 0; cnt < this; cnt++)
-		if(!xdr_double(&xdrs, REAL(obj) + done + cnt))
-		    error(_("XDR read failed"));
-	    xdr_destroy(&xdrs);
-	}
+	InXDRVec(stream, REAL(obj), length, R_XDR_DOUBLE_SIZE);
 	break;
-    }
     case R_pstream_binary_format:
+    case R_pstream_aligned_binary_format:
     {
 	R_xlen_t done, this;
 	for (done = 0; done < length; done += this) {
@@ -1461,25 +1730,10 @@ InComplexVec(R_inpstream_t stream, SEXP obj, R_xlen_t length)
 {
     switch (stream->type) {
     case R_pstream_xdr_format:
-    {
-	static char buf[CHUNK_SIZE * sizeof(Rcomplex)];
-	R_xlen_t done, this;
-	XDR xdrs;
-	Rcomplex *output = COMPLEX(obj);
-	for (done = 0; done < length; done += this) {
-	    this = min2(CHUNK_SIZE, length - done);
-	    stream->InBytes(stream, buf, (int)(sizeof(Rcomplex) * this));
-	    xdrmem_create(&xdrs, buf, (int)(this * sizeof(Rcomplex)), XDR_DECODE);
-	    for(R_xlen_t cnt = 0; cnt < this; cnt++) {
-		if(!xdr_double(&xdrs, &(output[done+cnt].r)) ||
-		   !xdr_double(&xdrs, &(output[done+cnt].i)))
-		    error(_("XDR read failed"));
-	    }
-	    xdr_destroy(&xdrs);
-	}
+	InXDRVec(stream, COMPLEX(obj), 2 * length, R_XDR_DOUBLE_SIZE);
 	break;
-    }
     case R_pstream_binary_format:
+    case R_pstream_aligned_binary_format:
     {
 	R_xlen_t done, this;
 	for (done = 0; done < length; done += this) {
@@ -1533,6 +1787,174 @@ static SEXP R_FindNamespace1(SEXP info)
 }
 
 
+/* a file mapped for reading by unserializeFromFile */
+typedef struct {
+    int fd;
+    char *base;
+    size_t size, pos;
+    Rboolean share;	/* map aligned vectors rather than copy them */
+} mapped_file_t;
+
+/* aligned vectors mapped from files or copied, for the tracer */
+unsigned long unserialize_mapped_vectors, unserialize_mapped_bytes;
+unsigned long unserialize_copied_vectors;
+
+static void InBytesMapped(R_inpstream_t stream, void *buf, int length)
+{
+    mapped_file_t *mf = stream->data;
+    if (length > mf->size - mf->pos)
+	error(_("read failed"));
+    memcpy(buf, mf->base + mf->pos, length);
+    mf->pos += length;
+}
+
+static int InCharMapped(R_inpstream_t stream)
+{
+    mapped_file_t *mf = stream->data;
+    if (mf->pos >= mf->size)
+	error(_("read failed"));
+    return (unsigned char) mf->base[mf->pos++];
+}
+
+#ifdef FILE_VECTOR_MAPPING
+/* The allocator gets the block of a vector from an anonymous page,
+   which ends in the header, followed by a private mapping of the data
+   in the file.  Keeping the header out of the file mapping matters as
+   truncating a file drops even the copied pages of its mappings.
+   mem_alloc finds the file offset of the data in the request that
+   data points to and replaces it with the length of the mapping,
+   which custom_node_alloc then copies into the block for mem_free.  A
+   length of zero means the mapping failed and the block came from
+   malloc. */
+typedef struct {
+    int fd;
+    size_t offset;	/* of the data in the file, a page multiple */
+    size_t header;	/* bytes of the block before the data */
+    Rboolean mapped;
+} file_vector_request_t;
+
+static void *FileVectorAlloc(R_allocator_t *allocator, size_t size)
+{
+    file_vector_request_t *req = allocator->data;
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    size_t length = page + size - req->header;
+    char *base = mmap(NULL, length, PROT_READ | PROT_WRITE,
+		      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base != MAP_FAILED &&
+	mmap(base + page, size - req->header, PROT_READ | PROT_WRITE,
+	     MAP_PRIVATE | MAP_FIXED, req->fd, (off_t) req->offset)
+	== MAP_FAILED) {
+	munmap(base, length);
+	base = MAP_FAILED;
+    }
+    if (base == MAP_FAILED) {
+	void *mem = malloc(size);
+	if (mem != NULL) allocator->data = NULL;
+	return mem;
+    }
+    req->mapped = TRUE;
+    allocator->data = (void *) (uintptr_t) length;
+    return base + page - req->header;
+}
+
+static void FileVectorFree(R_allocator_t *allocator, void *mem)
+{
+    size_t length = (size_t) (uintptr_t) allocator->data;
+    if (length == 0)
+	free(mem);
+    else {
+	size_t page = (size_t) sysconf(_SC_PAGESIZE);
+	munmap((char *) mem - (uintptr_t) mem % page, length);
+    }
+}
+
+/* Returns the vector with its data mapped from the file at the current
+   position, or with the data still to be read if the mapping failed,
+   or NULL if the data cannot be mapped. */
+static SEXP MapVector(mapped_file_t *mf, SEXPTYPE type, R_xlen_t len,
+		      size_t bytes, Rboolean *mapped)
+{
+    size_t hdr = sizeof(R_allocator_t) + sizeof(SEXPREC_ALIGN);
+    SEXP s;
+#ifdef LONG_VECTOR_SUPPORT
+    if (len > R_SHORT_LEN_MAX)
+	hdr += sizeof(R_long_vec_hdr_t);
+#endif
+    /* the block takes whole VECRECs, which the file has to cover */
+    if (!mf->share || mf->pos % (size_t) sysconf(_SC_PAGESIZE) != 0 ||
+	BYTE2VEC(bytes) * sizeof(VECREC) > mf->size - mf->pos)
+	return NULL;
+
+    file_vector_request_t req = { mf->fd, mf->pos, hdr, FALSE };
+    R_allocator_t allocator = { FileVectorAlloc, FileVectorFree, NULL, &req };
+    s = allocVector3(type, len, &allocator);
+    if ((*mapped = req.mapped)) {
+	mf->pos += bytes;
+	unserialize_mapped_vectors++;
+	unserialize_mapped_bytes += bytes;
+    }
+    return s;
+}
+#endif
+
+/* reads the data of an atomic vector, which in the aligned format may
+   be mapped from the file */
+static SEXP InAtomicVector(R_inpstream_t stream, SEXPTYPE type,
+			   R_xlen_t len)
+{
+    SEXP s = NULL;
+    Rboolean mapped = FALSE;
+    size_t bytes = len;
+
+    switch (type) {
+    case LGLSXP:
+    case INTSXP: bytes *= sizeof(int); break;
+    case REALSXP: bytes *= sizeof(double); break;
+    case CPLXSXP: bytes *= sizeof(Rcomplex); break;
+    default: break;
+    }
+    if (stream->type == R_pstream_aligned_binary_format &&
+	bytes >= ALIGNED_VECTOR_BYTES) {
+	char buf[ALIGNED_VECTOR_BOUNDARY];
+	int pad = InInteger(stream);
+	if (pad < 0 || pad >= ALIGNED_VECTOR_BOUNDARY)
+	    error(_("invalid padding of aligned vector"));
+	stream->InBytes(stream, buf, pad);
+#ifdef FILE_VECTOR_MAPPING
+	if (stream->InBytes == InBytesMapped)
+	    s = MapVector(stream->data, type, len, bytes, &mapped);
+#endif
+	if (!mapped)
+	    unserialize_copied_vectors++;
+    }
+    if (mapped)
+	return s;
+
+    PROTECT(s = s != NULL ? s : allocVector(type, len));
+    switch (type) {
+    case LGLSXP:
+    case INTSXP:
+	InIntegerVec(stream, s, len);
+	break;
+    case REALSXP:
+	InRealVec(stream, s, len);
+	break;
+    case CPLXSXP:
+	InComplexVec(stream, s, len);
+	break;
+    default:
+    {
+	R_xlen_t done, this;
+	for (done = 0; done < len; done += this) {
+	    this = min2(CHUNK_SIZE, len - done);
+	    stream->InBytes(stream, RAW(s) + done, (int) this);
+	}
+    }
+    }
+    UNPROTECT(1);
+    return s;
+}
+
 static SEXP ReadItem (SEXP ref_table, R_inpstream_t stream)
 {
     SEXPTYPE type;
@@ -1708,18 +2130,15 @@ static SEXP ReadItem (SEXP ref_table, R_inpstream_t stream)
 	case LGLSXP:
 	case INTSXP:
 	    len = ReadLENGTH(stream);
-	    PROTECT(s = allocVector(type, len));
-	    InIntegerVec(stream, s, len);
+	    PROTECT(s = InAtomicVector(stream, type, len));
 	    break;
 	case REALSXP:
 	    len = ReadLENGTH(stream);
-	    PROTECT(s = allocVector(type, len));
-	    InRealVec(stream, s, len);
+	    PROTECT(s = InAtomicVector(stream, type, len));
 	    break;
 	case CPLXSXP:
 	    len = ReadLENGTH(stream);
-	    PROTECT(s = allocVector(type, len));
-	    InComplexVec(stream, s, len);
+	    PROTECT(s = InAtomicVector(stream, type, len));
 	    break;
 	case STRSXP:
 	    len = ReadLENGTH(stream);
@@ -1750,14 +2169,7 @@ static SEXP ReadItem (SEXP ref_table, R_inpstream_t stream)
 	    error(_("this version of R cannot read generic function references"));
 	case RAWSXP:
 	    len = ReadLENGTH(stream);
-	    PROTECT(s = allocVector(type, len));
-	    {
-		R_xlen_t done, this;
-		for (done = 0; done < len; done += this) {
-		    this = min2(CHUNK_SIZE, len - done);
-		    stream->InBytes(stream, RAW(s) + done, (int) this);
-		}
-	    }
+	    PROTECT(s = InAtomicVector(stream, type, len));
 	    break;
 	case S4SXP:
 	    PROTECT(s = allocS4Object());
@@ -2169,16 +2581,44 @@ static void con_cleanup(void *data)
     if(con->isopen) con->close(con);
 }
 
+/* Connection streams for the aligned format count the bytes written,
+   which gives the file offsets for the padding of large vectors. */
+typedef struct {
+    Rconnection con;
+    size_t count;
+} counted_conn_t;
+
+static void OutBytesCounted(R_outpstream_t stream, void *buf, int length)
+{
+    counted_conn_t *cc = stream->data;
+    CheckOutConn(cc->con);
+    if (length != cc->con->write(buf, 1, length, cc->con))
+	error(_("error writing to connection"));
+    cc->count += length;
+}
+
+static void OutCharCounted(R_outpstream_t stream, int c)
+{
+    char buf[1];
+    buf[0] = (char) c;
+    OutBytesCounted(stream, buf, 1);
+}
+
+static size_t CountedBytes(R_outpstream_t stream)
+{
+    return ((counted_conn_t *) stream->data)->count;
+}
+
 /* Used from saveRDS().
    This became public in R 2.13.0, and that version added support for
    connections internally */
 SEXP attribute_hidden
 do_serializeToConn(SEXP call, SEXP op, SEXP args, SEXP env)
 {
-    /* serializeToConn(object, conn, ascii, version, hook) */
+    /* serializeToConn(object, conn, ascii, version, hook, align) */
 
     SEXP object, fun;
-    Rboolean ascii, wasopen;
+    Rboolean ascii, align, wasopen;
     int version;
     Rconnection con;
     struct R_outpstream_st out;
@@ -2210,6 +2650,11 @@ do_serializeToConn(SEXP call, SEXP op, SEXP args, SEXP env)
     fun = CAR(nthcdr(args,4));
     hook = fun != R_NilValue ? CallHook : NULL;
 
+    align = asLogical(CAR(nthcdr(args,5)));
+    if (align == NA_LOGICAL)
+	error(_("'align' must be TRUE or FALSE"));
+    if (align && ascii == FALSE) type = R_pstream_aligned_binary_format;
+
     /* Now we need to do some sanity checking of the arguments.
        A filename will already have been opened, so anything
        not open was specified as a connection directly.
@@ -2232,8 +2677,20 @@ do_serializeToConn(SEXP call, SEXP op, SEXP args, SEXP env)
     if(!con->canwrite)
 	error(_("connection not open for writing"));
 
-    R_InitConnOutPStream(&out, con, type, version, hook, fun);
-    R_Serialize(object, &out);
+    if (type == R_pstream_aligned_binary_format) {
+	/* count from the position of a connection opened by the caller */
+	counted_conn_t cc = { con, 0 };
+	if (wasopen && con->seek != NULL && con->canseek) {
+	    double pos = con->seek(con, NA_REAL, 1, 2);
+	    if (pos > 0) cc.count = (size_t) pos;
+	}
+	R_InitOutPStream(&out, (R_pstream_data_t) &cc, type, version,
+			 OutCharCounted, OutBytesCounted, hook, fun);
+	R_Serialize(object, &out);
+    } else {
+	R_InitConnOutPStream(&out, con, type, version, hook, fun);
+	R_Serialize(object, &out);
+    }
     if(!wasopen) {endcontext(&cntxt); con->close(con);}
 
     return R_NilValue;
@@ -2287,6 +2744,121 @@ do_unserializeFromConn(SEXP call, SEXP op, SEXP args, SEXP env)
     return ans;
 }
 
+static void mapped_file_cleanup(void *data)
+{
+    mapped_file_t *mf = data;
+#ifdef FILE_VECTOR_MAPPING
+    if (mf->base != NULL) munmap(mf->base, mf->size);
+#else
+    free(mf->base);
+#endif
+    if (mf->fd >= 0) close(mf->fd);
+    mf->base = NULL;
+    mf->fd = -1;
+}
+
+/* The format letter of a regular file that starts with a binary
+   serialization header, "" otherwise.  Other files are not opened, so
+   no bytes of a fifo or device are consumed, and readRDS() and
+   saveRDS() only map or replace the files that this finds to be "P"
+   (or "B" and "X" with mmap = TRUE). */
+SEXP attribute_hidden
+do_rdsFileFormat(SEXP call, SEXP op, SEXP args, SEXP env)
+{
+    struct stat sb;
+    const char *path;
+    char magic[2], format[2] = "";
+    int fd;
+
+    checkArity(op, args);
+    if (!isString(CAR(args)) || LENGTH(CAR(args)) != 1 ||
+	STRING_ELT(CAR(args), 0) == NA_STRING)
+	error(_("invalid '%s' argument"), "file");
+    path = R_ExpandFileName(translateChar(STRING_ELT(CAR(args), 0)));
+
+    if (stat(path, &sb) == 0 && S_ISREG(sb.st_mode) && sb.st_size >= 2 &&
+	(fd = open(path, O_RDONLY | O_BINARY)) >= 0) {
+	if (read(fd, magic, 2) == 2 && magic[1] == '\n' &&
+	    (magic[0] == 'B' || magic[0] == 'P' || magic[0] == 'X'))
+	    format[0] = magic[0];
+	close(fd);
+    }
+    return mkString(format);
+}
+
+/* Used from readRDS() for uncompressed binary files.  The file is
+   mapped, or read into memory if mapping is not available, and the
+   data of large vectors in the aligned format are mapped privately
+   when share is true.  Such vectors keep referring to the file, which
+   must then not be changed while they are in use. */
+SEXP attribute_hidden
+do_unserializeFromFile(SEXP call, SEXP op, SEXP args, SEXP env)
+{
+    /* unserializeFromFile(file, hook, share) */
+
+    struct R_inpstream_st in;
+    mapped_file_t mf = { -1, NULL, 0, 0, FALSE };
+    struct stat sb;
+    const char *path;
+    SEXP fun, ans;
+    SEXP (*hook)(SEXP, SEXP);
+    RCNTXT cntxt;
+
+    checkArity(op, args);
+
+    if (!isString(CAR(args)) || LENGTH(CAR(args)) != 1 ||
+	STRING_ELT(CAR(args), 0) == NA_STRING)
+	error(_("invalid '%s' argument"), "file");
+    path = R_ExpandFileName(translateChar(STRING_ELT(CAR(args), 0)));
+
+    fun = CADR(args);
+    hook = fun != R_NilValue ? CallHook : NULL;
+
+    mf.share = asLogical(CADDR(args));
+    if (mf.share == NA_LOGICAL)
+	error(_("invalid '%s' argument"), "share");
+
+    mf.fd = open(path, O_RDONLY | O_BINARY);
+    if (mf.fd < 0)
+	error(_("cannot open file '%s': %s"), path, strerror(errno));
+    if (fstat(mf.fd, &sb) != 0 || sb.st_size == 0) {
+	close(mf.fd);
+	error(_("cannot read file '%s'"), path);
+    }
+    mf.size = (size_t) sb.st_size;
+#ifdef FILE_VECTOR_MAPPING
+    mf.base = mmap(NULL, mf.size, PROT_READ, MAP_PRIVATE, mf.fd, 0);
+    if (mf.base == MAP_FAILED) {
+	close(mf.fd);
+	error(_("cannot map file '%s': %s"), path, strerror(errno));
+    }
+# ifdef MADV_SEQUENTIAL
+    madvise(mf.base, mf.size, MADV_SEQUENTIAL);
+# endif
+#else
+    mf.base = malloc(mf.size);
+    if (mf.base == NULL || read(mf.fd, mf.base, mf.size) != (ssize_t) mf.size) {
+	free(mf.base);
+	close(mf.fd);
+	error(_("cannot read file '%s'"), path);
+    }
+#endif
+
+    /* Set up a context which will unmap and close the file on error */
+    begincontext(&cntxt, CTXT_CCODE, R_NilValue, R_BaseEnv, R_BaseEnv,
+		 R_NilValue, R_NilValue);
+    cntxt.cend = &mapped_file_cleanup;
+    cntxt.cenddata = &mf;
+
+    R_InitInPStream(&in, (R_pstream_data_t) &mf, R_pstream_any_format,
+		    InCharMapped, InBytesMapped, hook, fun);
+    PROTECT(ans = R_Unserialize(&in));
+    endcontext(&cntxt);
+    mapped_file_cleanup(&mf);
+    UNPROTECT(1);
+    return ans;
+}
+
 
 /*
  * Persistent Buffered Binary Connection Streams
@@ -156,8 +156,15 @@ void R_DefParams(Rstart Rp)
     Rp->DebugInitFile = FALSE;
     Rp->TraceLevel = TR_DISABLED;
     Rp->TraceExternalCalls = FALSE;
+    Rp->TraceNativeCalls = FALSE;
     Rp->TraceDir = NULL;
     Rp->TraceFile = NULL;
+    Rp->TraceFormat = TR_FORMAT_TEXT;
+    Rp->TraceCheckpoint = 60;
+    Rp->TraceClosures = 0;
+    Rp->TraceAllocSample = 0;
+    Rp->TraceMemInterval = 1000;
+    Rp->TraceBCProf = 0;
     Rp->vsize = R_VSIZE;
     Rp->nsize = R_NSIZE;
     Rp->max_vsize = R_SIZE_T_MAX;
@@ -253,7 +260,14 @@ void R_SetParams(Rstart Rp)
     R_TraceDir = Rp->TraceDir;
     R_TraceFile = Rp->TraceFile;
     traceR_TraceExternalCalls = Rp->TraceExternalCalls;
+    R_TraceNativeCalls = Rp->TraceNativeCalls;
     R_TraceLevel = Rp->TraceLevel;
+    R_TraceFormat = Rp->TraceFormat;
+    R_TraceCheckpoint = Rp->TraceCheckpoint;
+    R_TraceClosures = Rp->TraceClosures;
+    R_TraceAllocSample = Rp->TraceAllocSample;
+    R_TraceMemInterval = Rp->TraceMemInterval;
+    R_TraceBCProf = Rp->TraceBCProf;
     SetSize(Rp->vsize, Rp->nsize);
     R_SetMaxNSize(Rp->max_nsize);
     R_SetMaxVSize(Rp->max_vsize);